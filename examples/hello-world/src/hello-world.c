@@ -7,8 +7,10 @@
 
 #ifdef INKY_SPIDEV_AS_SUBMODULE
 #include "inky-spidev.h"
+#include "inky-spidev-probe.h"
 #else
 #include <inkyuserspace/inky-spidev.h>
+#include <inkyuserspace/inky-spidev-probe.h>
 #endif /* #ifdef INKY_SPIDEV_AS_SUBMODULE */
 
 #include "hello-world.h"
@@ -48,20 +50,20 @@ size_t bytestream_size(bytestream *stream);
 
 uint8_t bytestream_get_next(bytestream *stream);
 
-char spidev[APP_ARG_BUFFER]; /* Path to SPI special device */
-char gpiochip[APP_ARG_BUFFER]; /* Search string for gpio chip */
-
-uint8_t reset_pin; /* Offset for reset gpio line */
-uint8_t busy_pin; /* Offset for busy gpio line */
-uint8_t dc_pin; /* Offset for DC gpio line */
+typedef struct {
+	char spidev[APP_ARG_BUFFER]; /* Path to SPI special device */
+	char gpiochip[APP_ARG_BUFFER]; /* Search string for gpio chip */
 
-uint16_t app_flags = 0; /* Additional app control flags */
+	uint8_t reset_pin; /* Offset for reset gpio line */
+	uint8_t busy_pin; /* Offset for busy gpio line */
+	uint8_t dc_pin; /* Offset for DC gpio line */
 
-inky_spidev_intf intf; /* Interface configuration */
+	uint16_t flags; /* Additional app control flags */
+} app_options;
 
 bool check_numeric(const char *str);
 
-int parse_options(int argc, char *const argv[]);
+int parse_options(int argc, char *const argv[], app_options *opts);
 
 void error_handler(int8_t rst);
 
@@ -125,7 +127,7 @@ bool check_numeric(const char *str)
 	return true;
 }
 
-int parse_options(int argc, char *const argv[])
+int parse_options(int argc, char *const argv[], app_options *opts)
 {
 	int opt;
 
@@ -137,7 +139,7 @@ int parse_options(int argc, char *const argv[])
 				exit(EXIT_FAILURE);
 			}
 
-			reset_pin = atoi(optarg);
+			opts->reset_pin = atoi(optarg);
 
 			break;
 
@@ -147,7 +149,7 @@ int parse_options(int argc, char *const argv[])
 				exit(EXIT_FAILURE);
 			}
 
-			busy_pin = atoi(optarg);
+			opts->busy_pin = atoi(optarg);
 
 			break;
 
@@ -157,27 +159,27 @@ int parse_options(int argc, char *const argv[])
 				exit(EXIT_FAILURE);
 			}
 
-			dc_pin = atoi(optarg);
+			opts->dc_pin = atoi(optarg);
 
 			break;
 
 		case 's':
-			strncpy(spidev, optarg, APP_ARG_BUFFER - 1);
+			strncpy(opts->spidev, optarg, APP_ARG_BUFFER - 1);
 
 			break;
 
 		case 'g':
-			strncpy(gpiochip, optarg, APP_ARG_BUFFER -1);
+			strncpy(opts->gpiochip, optarg, APP_ARG_BUFFER - 1);
 
 			break;
 
 		case 'c':
-			app_flags = app_flags | APP_FLAG_CLEAR;
+			opts->flags |= APP_FLAG_CLEAR;
 
 			break;
 
 		case 'n':
-			app_flags = app_flags | APP_FLAG_NO_WRITE;
+			opts->flags |= APP_FLAG_NO_WRITE;
 
 			break;
 
@@ -259,16 +261,18 @@ uint8_t write_monochrome_img(inky_config *dev, bytestream *img)
 int main(int argc, char *const argv[])
 {
 	int rst;
+	app_options opts = {0};
+	inky_spidev_intf intf; /* Interface configuration */
 	inky_config *dev = &intf.dev;
 	bytestream img;
 
-	parse_options(argc, argv);
+	parse_options(argc, argv, &opts);
 
 	bytestream_init(&img, hello_world, ARRAY_LEN(hello_world));
 
 	/* Initialize the interface */
-	rst = inky_spidev_init(&intf, spidev, gpiochip, reset_pin,
-			       busy_pin, dc_pin);
+	rst = inky_spidev_init(&intf, opts.spidev, opts.gpiochip,
+			       opts.reset_pin, opts.busy_pin, opts.dc_pin);
 
 	if (rst < 0) {
 		fprintf(stderr, "ERROR: Failed to initialize interface"
@@ -277,22 +281,31 @@ int main(int argc, char *const argv[])
 		return(EXIT_FAILURE);
 	}
 
+	/* Detect panel type from the board EEPROM if possible */
+	rst = inky_spidev_probe(&intf, NULL, NULL);
+
+	if (rst < 0) {
+		fprintf(stderr, "WARNING: Panel not detected, assuming "
+			"a red Inky wHAT\n");
+	}
+
 	/* Run setup function to prepare allocate framebuffer */
 	rst = inky_setup(dev);
 	error_handler(rst);
 
-	if (app_flags & APP_FLAG_CLEAR) {
+	if (opts.flags & APP_FLAG_CLEAR) {
 		rst = inky_clear(dev);
 		error_handler(rst);
 	}
 
-	if (! (app_flags & APP_FLAG_NO_WRITE)) {
+	if (! (opts.flags & APP_FLAG_NO_WRITE)) {
 		/* Write monochrome image to display */
 		write_monochrome_img(dev, &img);
 
 		/* Must call the update function or the image won't be
-		 * displayed */
-		rst = inky_update(dev);
+		 * displayed. The spidev wrapper holds the interface lock
+		 * for the whole refresh. */
+		rst = inky_spidev_update(&intf);
 		error_handler(rst);
 	}
 
@@ -0,0 +1,104 @@
+#ifndef INKY_SPIDEV_ASYNC_H
+#define INKY_SPIDEV_ASYNC_H
+
+#include "inky-spidev.h"
+
+#include <pthread.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @defgroup inkyspidevasync Asynchronous submission
+ * @ingroup inkyspidevapi
+ *
+ * Lets one thread keep operations for several panels in flight. Each
+ * interface added to a context gets a lane that runs its jobs in
+ * order; lanes run concurrently. Completed jobs are collected on the
+ * context and signalled through an eventfd, so the submitting thread
+ * can sit in poll(), epoll or an io_uring poll request alongside its
+ * other I/O and call inky_spidev_async_reap() when it becomes
+ * readable.
+ * @{
+ */
+
+#define INKY_SPIDEV_ASYNC_LANES 8
+
+/** @brief Operation carried by a job */
+typedef enum {
+	INKY_SPIDEV_JOB_PRESENT, /**< arg is a const inky_spidev_fb* */
+	INKY_SPIDEV_JOB_REPLAY, /**< arg is a const inky_spidev_seq* */
+	INKY_SPIDEV_JOB_WRITE, /**< arg/len are raw bytes for spi_write */
+	INKY_SPIDEV_JOB_WAIT_BUSY /**< timeout in microseconds */
+} inky_spidev_job_type;
+
+/** @brief Unit of asynchronous work
+ *
+ * Owned by the caller and must stay valid until its done_cb has run.
+ */
+typedef struct inky_spidev_job {
+	inky_spidev_job_type type;
+	inky_spidev_intf *intf; /**< Selects the lane */
+	const void *arg;
+	uint32_t len;
+	uint64_t timeout;
+	int8_t result; /**< Filled in on completion */
+	void (*done_cb)(struct inky_spidev_job *job, void *user);
+	void *user;
+	struct inky_spidev_job *next; /**< Internal */
+} inky_spidev_job;
+
+struct inky_spidev_async;
+
+/** @brief Per-interface worker */
+typedef struct {
+	inky_spidev_intf *intf;
+	pthread_t thread;
+	inky_spidev_job *head;
+	inky_spidev_job *tail;
+	struct inky_spidev_async *ctx;
+} inky_spidev_async_lane;
+
+/** @brief Asynchronous submission context */
+typedef struct inky_spidev_async {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	inky_spidev_async_lane lanes[INKY_SPIDEV_ASYNC_LANES];
+	unsigned int nlanes;
+	inky_spidev_job *done_head;
+	inky_spidev_job *done_tail;
+	unsigned int inflight;
+	int event_fd;
+	bool stop;
+} inky_spidev_async;
+
+/** @brief Set up an empty context */
+int8_t inky_spidev_async_init(inky_spidev_async *ctx);
+
+/** @brief Start a lane for an interface */
+int8_t inky_spidev_async_add(inky_spidev_async *ctx,
+			     inky_spidev_intf *intf_ptr);
+
+/** @brief Queue a job on the lane of job->intf. Never blocks */
+int8_t inky_spidev_async_submit(inky_spidev_async *ctx,
+				inky_spidev_job *job);
+
+/** @brief File descriptor that is readable while completions wait */
+int inky_spidev_async_fd(const inky_spidev_async *ctx);
+
+/** @brief Run done_cb for completed jobs on the calling thread
+ *  @param ctx Context
+ *  @param wait Block until at least one job completes, if any are
+ *  in flight
+ *  @return Number of jobs reaped
+ */
+int inky_spidev_async_reap(inky_spidev_async *ctx, bool wait);
+
+/** @brief Finish all queued jobs, reap them and stop the lanes */
+int8_t inky_spidev_async_deinit(inky_spidev_async *ctx);
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef INKY_SPIDEV_ASYNC_H */
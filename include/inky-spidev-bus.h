@@ -0,0 +1,75 @@
+#ifndef INKY_SPIDEV_BUS_H
+#define INKY_SPIDEV_BUS_H
+
+#include "inky-spidev.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+/**
+ * @defgroup inkyspidevbus Shared SPI bus arbitration
+ * @ingroup inkyspidevapi
+ *
+ * Panels on different chip selects of one SPI controller, such as
+ * /dev/spidev0.0 and /dev/spidev0.1, share the clock and data lines.
+ * Attaching their interfaces to one inky_spidev_bus makes each panel
+ * own the bus for a whole upload: from the reset through the last
+ * byte of RAM and the refresh command. The bus is handed to the next
+ * panel while a panel waits on BUSY or sleeps in a long delay, so one
+ * panel's refresh overlaps the next panel's upload.
+ *
+ * Within a process, waiting panels get the bus in the order they asked
+ * for it. Across processes the bus is guarded by flock() on a lock
+ * file in INKY_SPIDEV_BUS_LOCK_DIR, so every process driving the
+ * controller must attach to a bus for the same spidev controller.
+ * @{
+ */
+
+#define INKY_SPIDEV_BUS_LOCK_DIR "/run/lock"
+
+/** @brief Delays at least this long give the bus to other panels */
+#define INKY_SPIDEV_BUS_YIELD_US 1000
+
+/** @brief Arbiter for one SPI controller */
+typedef struct inky_spidev_bus {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned long next; /**< Next ticket handed out */
+	unsigned long serving; /**< Ticket that owns the bus */
+	unsigned int users; /**< Attached interfaces */
+	int fd; /**< flock()ed lock file, -1 for in-process only */
+	char path[INKY_SPIDEV_PATH_LEN];
+	uint64_t acquired; /**< Times the bus was taken */
+	uint64_t contended; /**< Of those, times another panel held it */
+	uint64_t wait_us; /**< Total time spent waiting for the bus */
+} inky_spidev_bus;
+
+/** @brief Set up an arbiter for the controller behind a spidev node
+ *
+ * The lock file is derived from the bus number, so /dev/spidev0.0 and
+ * /dev/spidev0.1 share INKY_SPIDEV_BUS_LOCK_DIR/inky-spidev0.lock.
+ *
+ *  @param bus Arbiter to initialize
+ *  @param spidev Any chip select of the controller, or NULL to only
+ *  arbitrate between interfaces in this process
+ */
+int8_t inky_spidev_bus_init(inky_spidev_bus *bus, const char *spidev);
+
+/** @brief Route an interface's hardware access through an arbiter
+ *
+ * Call before the interface is shared with other threads.
+ */
+int8_t inky_spidev_bus_attach(inky_spidev_intf *intf_ptr,
+			      inky_spidev_bus *bus);
+
+/** @brief Stop arbitrating an interface. Also done by deinit */
+int8_t inky_spidev_bus_detach(inky_spidev_intf *intf_ptr);
+
+/** @brief Release the arbiter. No interface may still be attached */
+int8_t inky_spidev_bus_deinit(inky_spidev_bus *bus);
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef INKY_SPIDEV_BUS_H */
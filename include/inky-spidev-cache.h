@@ -0,0 +1,85 @@
+#ifndef INKY_SPIDEV_CACHE_H
+#define INKY_SPIDEV_CACHE_H
+
+#include "inky-spidev.h"
+#include "inky-spidev-fb.h"
+#include "inky-spidev-frame.h"
+#include "inky-spidev-pack.h"
+
+#include <stdint.h>
+
+/**
+ * @defgroup inkyspidevcache Packed frame cache
+ * @ingroup inkyspidevapi
+ *
+ * Images that are shown over and over, such as logos, menus and alert
+ * screens, only need converting once. The cache keys each packed frame
+ * by a SHA-256 of the source pixels and of every inky_spidev_pack_cfg
+ * field, cut to 128 bits, and keeps it as a raw frame file in a
+ * directory. The key names the file and is stored as the frame's tag,
+ * so files made by other processes and earlier runs can be trusted
+ * without converting again. A hit maps
+ * the file and points a framebuffer's planes straight into the page
+ * cache, so inky_spidev_fb_present() sends them without any copy or
+ * conversion.
+ *
+ * Files are written under a temporary name and renamed, so several
+ * processes can share one directory. A directory that can't be written
+ * only costs the caching: the frame is then packed into memory.
+ * @{
+ */
+
+/** @brief Directory for frames */
+typedef struct {
+	char dir[INKY_SPIDEV_PATH_LEN];
+	uint8_t panel; /**< Recorded in each frame written */
+	inky_spidev_frame_color color;
+	uint64_t hits;
+	uint64_t misses;
+} inky_spidev_cache;
+
+/** @brief Use a directory as a frame cache
+ *
+ * Frames are only reused for the panel type and color they were
+ * written for, so one directory can serve several panels.
+ *
+ *  @param cache Cache to initialize
+ *  @param dir Existing directory, for example /var/cache/inky-spidev
+ *  @param panel Panel type recorded in the frame headers
+ *  @param color Panel color recorded in the frame headers
+ */
+int8_t inky_spidev_cache_init(inky_spidev_cache *cache, const char *dir,
+			      uint8_t panel, inky_spidev_frame_color color);
+
+/** @brief Hash an image and its conversion parameters
+ *
+ * Only the width pixels of each row are hashed, so the padding
+ * between rows doesn't matter.
+ *
+ *  @param key Set to the key, which inky_spidev_cache_pack() also
+ *  uses as the frame tag
+ */
+void inky_spidev_cache_key(const uint8_t *pixels, uint16_t width,
+			   uint16_t height, uint32_t stride,
+			   const inky_spidev_pack_cfg *cfg,
+			   inky_spidev_frame_tag *key);
+
+/** @brief Get the packed frame for an image, converting it on a miss
+ *
+ * Takes the same arguments as inky_spidev_fb_pack() and sizes the
+ * framebuffer from the image and rotation.
+ *
+ *  @param cache Initialized cache
+ *  @param frame Set to the frame. Release with inky_spidev_frame_release()
+ */
+int8_t inky_spidev_cache_pack(inky_spidev_cache *cache,
+			      inky_spidev_frame *frame,
+			      const uint8_t *pixels, uint16_t width,
+			      uint16_t height, uint32_t stride,
+			      const inky_spidev_pack_cfg *cfg);
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef INKY_SPIDEV_CACHE_H */
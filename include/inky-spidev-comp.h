@@ -0,0 +1,126 @@
+#ifndef INKY_SPIDEV_COMP_H
+#define INKY_SPIDEV_COMP_H
+
+#include "inky-spidev-draw.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @defgroup inkyspidevcomp Layered compositor
+ * @ingroup inkyspidevapi
+ *
+ * Each layer keeps its own packed surface and an opacity mask, so its
+ * content is drawn once and stays cached until the application changes
+ * it. Changes are reported as damage rectangles; rendering rebuilds
+ * only those rectangles of the output framebuffer by stacking the
+ * layers bottom to top over the background, one byte (eight pixels)
+ * at a time.
+ *
+ * The mask is an inky_spidev_fb of the layer's size of which only
+ * plane INKY_SPIDEV_PLANE_BW is used: 1 is opaque, 0 lets lower layers
+ * show through. The drawing primitives work on it directly, with a
+ * white pen for opaque and a black pen for transparent. A new layer is
+ * fully opaque.
+ * @{
+ */
+
+#define INKY_SPIDEV_COMP_LAYERS 8
+#define INKY_SPIDEV_COMP_RECTS 16
+
+/** @brief Rectangle in screen coordinates */
+typedef struct {
+	int x;
+	int y;
+	int w;
+	int h;
+} inky_spidev_rect;
+
+struct inky_spidev_comp;
+
+/** @brief Cached layer surface */
+typedef struct {
+	inky_spidev_fb fb; /**< Layer content */
+	inky_spidev_fb mask; /**< Opacity in the BW plane */
+	int x; /**< Screen position of the layer's top left pixel */
+	int y;
+	bool visible;
+	struct inky_spidev_comp *comp; /**< Owner, NULL when detached */
+} inky_spidev_layer;
+
+/** @brief Compositor state */
+typedef struct inky_spidev_comp {
+	uint16_t width;
+	uint16_t height;
+	inky_spidev_pen background; /**< Shown where no layer is opaque */
+	inky_spidev_layer *layers[INKY_SPIDEV_COMP_LAYERS]; /**< Bottom first */
+	uint8_t nlayers;
+	inky_spidev_rect dirty[INKY_SPIDEV_COMP_RECTS];
+	uint8_t ndirty;
+} inky_spidev_comp;
+
+/** @brief Set up a compositor for a width x height screen
+ *
+ * The whole screen starts out damaged so the first render fills the
+ * output framebuffer.
+ */
+int8_t inky_spidev_comp_init(inky_spidev_comp *comp, uint16_t width,
+			     uint16_t height, const inky_spidev_pen *background);
+
+/** @brief Allocate a w x h layer at screen position (x, y)
+ *
+ * The surface starts white and fully opaque.
+ */
+int8_t inky_spidev_layer_init(inky_spidev_layer *layer, int x, int y,
+			      uint16_t w, uint16_t h);
+
+/** @brief Free a layer's surfaces, detaching it first if needed */
+void inky_spidev_layer_free(inky_spidev_layer *layer);
+
+/** @brief Stack a layer on top of the existing ones */
+int8_t inky_spidev_comp_add(inky_spidev_comp *comp, inky_spidev_layer *layer);
+
+/** @brief Take a layer off the stack and damage the area it covered */
+int8_t inky_spidev_comp_remove(inky_spidev_comp *comp,
+			       inky_spidev_layer *layer);
+
+/** @brief Mark a screen rectangle for recompositing */
+void inky_spidev_comp_damage(inky_spidev_comp *comp, int x, int y, int w,
+			     int h);
+
+/** @brief Mark part of a layer, in layer coordinates, as changed
+ *
+ * Call after drawing into the layer's surface or mask. Has no effect
+ * on a detached layer.
+ */
+void inky_spidev_layer_damage(inky_spidev_layer *layer, int x, int y, int w,
+			      int h);
+
+/** @brief Move a layer, damaging its old and new areas */
+void inky_spidev_layer_move(inky_spidev_layer *layer, int x, int y);
+
+/** @brief Show or hide a layer */
+void inky_spidev_layer_show(inky_spidev_layer *layer, bool visible);
+
+/** @brief True if anything changed since the last render */
+bool inky_spidev_comp_dirty(const inky_spidev_comp *comp);
+
+/** @brief Recomposite all damaged rectangles into dst
+ *
+ * dst must be the compositor's size and must hold the output of the
+ * previous render, since undamaged areas are not touched. The damage
+ * list is cleared.
+ *
+ *  @param comp Compositor
+ *  @param dst Output framebuffer
+ *  @param bbox If not NULL, receives the bounding box of the
+ *  recomposited area, with zero width if nothing was damaged
+ */
+int8_t inky_spidev_comp_render(inky_spidev_comp *comp, inky_spidev_fb *dst,
+			       inky_spidev_rect *bbox);
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef INKY_SPIDEV_COMP_H */
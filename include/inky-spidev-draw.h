@@ -0,0 +1,88 @@
+#ifndef INKY_SPIDEV_DRAW_H
+#define INKY_SPIDEV_DRAW_H
+
+#include "inky-spidev-fb.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @defgroup inkyspidevdraw Drawing primitives
+ * @ingroup inkyspidevapi
+ *
+ * Shapes are drawn straight into the packed planes of an
+ * inky_spidev_fb. Horizontal runs are written as masked edge bytes
+ * around a memset, so filled shapes cost a few byte operations per
+ * row instead of one call per pixel. Coordinates are signed and
+ * everything is clipped to the framebuffer.
+ * @{
+ */
+
+/** @brief Plane fill bytes for one color */
+typedef struct {
+	uint8_t bw; /**< Byte written to INKY_SPIDEV_PLANE_BW */
+	uint8_t col; /**< Byte written to INKY_SPIDEV_PLANE_COLOR */
+} inky_spidev_pen;
+
+/** @brief Resolve a color to plane values for a panel
+ *
+ * Red and yellow both set the color plane, which shows whichever
+ * third color the panel has. On a panel with neither, they are drawn
+ * black and the color plane is left clear.
+ *
+ *  @param cfg Colors the panel supports, NULL to allow all
+ *  @param c Color to draw with
+ */
+inky_spidev_pen inky_spidev_pen_make(const inky_color_config *cfg,
+				     inky_color c);
+
+/** @brief Set one pixel */
+void inky_spidev_draw_pixel(inky_spidev_fb *fb, const inky_spidev_pen *pen,
+			    int x, int y);
+
+/** @brief Fill pixels x0 to x1 inclusive on row y */
+void inky_spidev_draw_hspan(inky_spidev_fb *fb, const inky_spidev_pen *pen,
+			    int x0, int x1, int y);
+
+/** @brief Draw a one pixel wide line between two points, inclusive */
+void inky_spidev_draw_line(inky_spidev_fb *fb, const inky_spidev_pen *pen,
+			   int x0, int y0, int x1, int y1);
+
+/** @brief Draw a rectangle outline or filled rectangle
+ *  @param fb Framebuffer
+ *  @param pen Color to draw with
+ *  @param x Left edge
+ *  @param y Top edge
+ *  @param w Width in pixels
+ *  @param h Height in pixels
+ *  @param fill Fill the interior instead of drawing the outline
+ */
+void inky_spidev_draw_rect(inky_spidev_fb *fb, const inky_spidev_pen *pen,
+			   int x, int y, int w, int h, bool fill);
+
+/** @brief Draw a circle outline or disc of radius r around (cx, cy) */
+void inky_spidev_draw_circle(inky_spidev_fb *fb, const inky_spidev_pen *pen,
+			     int cx, int cy, int r, bool fill);
+
+/** @brief Copy a w x h region between framebuffers
+ *
+ * Both planes are copied. Source and destination may be the same
+ * framebuffer and may overlap. The region is clipped against both.
+ */
+int8_t inky_spidev_draw_copy(inky_spidev_fb *dst, int dx, int dy,
+			     const inky_spidev_fb *src, int sx, int sy,
+			     int w, int h);
+
+/** @brief Shift the framebuffer contents by (dx, dy)
+ *
+ * Pixels moved off the edge are lost and the uncovered area is
+ * filled with pen.
+ */
+int8_t inky_spidev_draw_scroll(inky_spidev_fb *fb, int dx, int dy,
+			       const inky_spidev_pen *pen);
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef INKY_SPIDEV_DRAW_H */
@@ -0,0 +1,191 @@
+#ifndef INKY_SPIDEV_FB_H
+#define INKY_SPIDEV_FB_H
+
+#include "inky-spidev.h"
+#include "inky-spidev-lat.h"
+
+#include <pthread.h>
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @defgroup inkyspidevfb Packed framebuffers and double buffering
+ * @ingroup inkyspidevapi
+ *
+ * Framebuffers in the controller's native layout: one bit per pixel,
+ * MSB first, rows padded to whole bytes. Plane INKY_SPIDEV_PLANE_BW
+ * holds 1 for white and 0 for black, plane INKY_SPIDEV_PLANE_COLOR
+ * holds 1 where the panel's third color (red or yellow) is shown.
+ * @{
+ */
+
+#define INKY_SPIDEV_PLANE_BW 0
+#define INKY_SPIDEV_PLANE_COLOR 1
+#define INKY_SPIDEV_PLANES 2
+
+/** @brief Packed two-plane framebuffer */
+typedef struct {
+	uint16_t width;
+	uint16_t height;
+	uint16_t stride; /**< Bytes per row of one plane */
+	uint32_t plane_len; /**< Bytes per plane */
+	uint8_t *planes[INKY_SPIDEV_PLANES];
+	uint8_t *buf; /**< Backing allocation, NULL if not owned */
+	inky_spidev_stamp stamp; /**< Origin, see inky_spidev_fb_stamp() */
+} inky_spidev_fb;
+
+/** @brief Allocate a white framebuffer of width x height pixels
+ *  @param fb Framebuffer to initialize
+ *  @param width Width in pixels
+ *  @param height Height in pixels
+ */
+int8_t inky_spidev_fb_init(inky_spidev_fb *fb, uint16_t width,
+			   uint16_t height);
+
+/** @brief Release memory owned by a framebuffer */
+void inky_spidev_fb_free(inky_spidev_fb *fb);
+
+/** @brief Fill the whole framebuffer with one color */
+void inky_spidev_fb_clear(inky_spidev_fb *fb, inky_color c);
+
+/** @brief Set a single pixel. Out of range coordinates are ignored */
+void inky_spidev_fb_set_pixel(inky_spidev_fb *fb, uint16_t x, uint16_t y,
+			      inky_color c);
+
+/** @brief Read back a single pixel */
+inky_color inky_spidev_fb_get_pixel(const inky_spidev_fb *fb, uint16_t x,
+				    uint16_t y);
+
+/** @brief Tag a frame for latency tracking
+ *
+ * Call once the frame is drawn. Buffers handed back by a double or
+ * triple buffer, or a pipeline, come back unstamped.
+ *
+ *  @param fb Framebuffer holding the frame
+ *  @param id Caller's frame ID, for inky_spidev_lat_find()
+ *  @param content_us When the content changed, from
+ *  inky_spidev_lat_now_us(), or 0 for now
+ */
+void inky_spidev_fb_stamp(inky_spidev_fb *fb, uint64_t id,
+			  uint64_t content_us);
+
+/** @brief Upload a framebuffer and refresh the panel
+ *
+ * Resets and configures the controller, writes both planes, waits
+ * for the refresh to finish and puts the controller back to sleep.
+ * Blocks for the full refresh time, holding the interface lock.
+ *
+ * The stamp is left as it is. Presenting the same buffer again
+ * without inky_spidev_fb_stamp() records it against its first content
+ * time, so its total latency includes the time since then. Restamp
+ * before each present to measure them separately.
+ *
+ *  @param intf_ptr Initialized interface
+ *  @param fb Framebuffer matching the panel resolution
+ */
+int8_t inky_spidev_fb_present(inky_spidev_intf *intf_ptr,
+			      const inky_spidev_fb *fb);
+
+/** @brief Double buffer with a background uploader
+ *
+ * The application draws into the back buffer while the front buffer
+ * is uploaded and refreshed on a worker thread.
+ */
+typedef struct {
+	inky_spidev_intf *intf;
+	inky_spidev_fb fbs[2];
+	inky_spidev_fb *front;
+	inky_spidev_fb *back;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool pending; /**< Front buffer queued for upload */
+	bool stop;
+	int8_t last_rst; /**< Result of the most recent upload */
+} inky_spidev_dbuf;
+
+/** @brief Allocate both buffers and start the uploader thread
+ *  @param dbuf Double buffer to initialize
+ *  @param intf_ptr Initialized interface the uploads go to
+ *  @param width Panel width in pixels
+ *  @param height Panel height in pixels
+ */
+int8_t inky_spidev_dbuf_init(inky_spidev_dbuf *dbuf,
+			     inky_spidev_intf *intf_ptr,
+			     uint16_t width, uint16_t height);
+
+/** @brief Framebuffer the application should draw into */
+inky_spidev_fb *inky_spidev_dbuf_back(inky_spidev_dbuf *dbuf);
+
+/** @brief Exchange front and back buffers and queue the new front
+ *
+ * Waits for the previous upload to finish, then swaps the buffer
+ * pointers. The new back buffer still holds the frame that was
+ * displayed before the swap.
+ *
+ *  @return Result of the previous upload
+ */
+int8_t inky_spidev_dbuf_swap(inky_spidev_dbuf *dbuf);
+
+/** @brief Block until no upload is pending
+ *  @return Result of the last upload
+ */
+int8_t inky_spidev_dbuf_wait(inky_spidev_dbuf *dbuf);
+
+/** @brief Finish any pending upload, stop the thread and free buffers */
+int8_t inky_spidev_dbuf_deinit(inky_spidev_dbuf *dbuf);
+
+/** @brief Triple buffer with lock-free, latest-wins submission
+ *
+ * One producer thread draws into the back buffer and publishes it
+ * with inky_spidev_tbuf_submit(), which never blocks: the back buffer
+ * is exchanged with the shared middle slot by a single atomic
+ * operation. The uploader thread takes the newest frame from the
+ * middle slot when it is ready for one, so frames submitted faster
+ * than the panel refreshes are dropped rather than queued.
+ */
+typedef struct {
+	inky_spidev_intf *intf;
+	inky_spidev_fb fbs[3];
+	uint8_t back; /**< Owned by the producer */
+	uint8_t front; /**< Owned by the uploader */
+	atomic_uint_fast8_t middle; /**< Index, plus INKY_SPIDEV_TBUF_FRESH */
+	atomic_bool stop;
+	atomic_int last_rst; /**< Result of the most recent upload */
+	atomic_uint frames; /**< Frames uploaded so far */
+	int event_fd; /**< Wakes the uploader */
+	pthread_t thread;
+} inky_spidev_tbuf;
+
+#define INKY_SPIDEV_TBUF_FRESH 0x04
+
+/** @brief Allocate three buffers and start the uploader thread */
+int8_t inky_spidev_tbuf_init(inky_spidev_tbuf *tbuf,
+			     inky_spidev_intf *intf_ptr,
+			     uint16_t width, uint16_t height);
+
+/** @brief Framebuffer the producer should draw into
+ *
+ * After a submit its contents are an older frame, not the one just
+ * submitted; redraw it completely.
+ */
+inky_spidev_fb *inky_spidev_tbuf_back(inky_spidev_tbuf *tbuf);
+
+/** @brief Publish the back buffer without waiting
+ *
+ * Only one thread may draw and submit on a given triple buffer.
+ *
+ *  @return Result of the most recent completed upload
+ */
+int8_t inky_spidev_tbuf_submit(inky_spidev_tbuf *tbuf);
+
+/** @brief Stop the uploader after its current frame and free buffers */
+int8_t inky_spidev_tbuf_deinit(inky_spidev_tbuf *tbuf);
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef INKY_SPIDEV_FB_H */
@@ -0,0 +1,121 @@
+#ifndef INKY_SPIDEV_FRAME_H
+#define INKY_SPIDEV_FRAME_H
+
+#include "inky-spidev.h"
+#include "inky-spidev-fb.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @defgroup inkyspidevframe Packed frame files
+ * @ingroup inkyspidevapi
+ *
+ * A frame file holds one ready-to-send framebuffer, so content can be
+ * converted once, for example on a build server, and only streamed out
+ * by the device. All fields are little endian.
+ *
+ * | Offset | Size | Field                                         |
+ * |--------|------|-----------------------------------------------|
+ * | 0      | 4    | Magic, "INKF"                                 |
+ * | 4      | 1    | Version, INKY_SPIDEV_FRAME_VERSION            |
+ * | 5      | 1    | Panel type, free for the producer             |
+ * | 6      | 1    | Panel color, an inky_spidev_frame_color       |
+ * | 7      | 1    | Reserved, 0                                   |
+ * | 8      | 2    | Width in pixels                               |
+ * | 10     | 2    | Height in pixels                              |
+ * | 12     | 4    | Bytes per plane, (width + 7) / 8 * height     |
+ * | 16     | 8    | File offset of the BW and of the color plane  |
+ * | 24     | 8    | Stored size of each plane                     |
+ * | 32     | 2    | Encoding of each plane, inky_spidev_frame_enc |
+ * | 34     | 2    | Reserved, 0                                   |
+ * | 36     | 4    | CRC-32                                        |
+ * | 40     | 16   | Tag, free for the producer                    |
+ * | 56     | 8    | Reserved, 0                                   |
+ *
+ * The CRC-32 (as used by zlib) covers the header, with the CRC field
+ * taken as 0, followed by the stored planes.
+ *
+ * Planes follow the header at INKY_SPIDEV_FRAME_ALIGN byte boundaries
+ * in the framebuffer's layout. A raw plane is used in place, so a
+ * frame with raw planes is opened with one mmap() and its planes go
+ * to inky_spidev_fb_present() without being read first.
+ *
+ * An RLE plane is a series of runs, each starting with a control byte
+ * c. When c is below 128, c + 1 literal bytes follow. Otherwise the
+ * next byte is repeated c - 125 times.
+ * @{
+ */
+
+#define INKY_SPIDEV_FRAME_MAGIC "INKF"
+#define INKY_SPIDEV_FRAME_VERSION 2
+#define INKY_SPIDEV_FRAME_HDR_LEN 64
+#define INKY_SPIDEV_FRAME_ALIGN 16
+#define INKY_SPIDEV_FRAME_TAG_LEN 16
+
+/** @brief Plane encodings */
+typedef enum {
+	INKY_SPIDEV_FRAME_RAW = 0,
+	INKY_SPIDEV_FRAME_RLE
+} inky_spidev_frame_enc;
+
+/** @brief Third color of the panel a frame was made for */
+typedef enum {
+	INKY_SPIDEV_FRAME_BW = 0,
+	INKY_SPIDEV_FRAME_RED,
+	INKY_SPIDEV_FRAME_YELLOW
+} inky_spidev_frame_color;
+
+/** @brief Producer's identity for a frame, such as a content hash */
+typedef struct {
+	uint8_t bytes[INKY_SPIDEV_FRAME_TAG_LEN];
+} inky_spidev_frame_tag;
+
+/** @brief A packed frame, mapped from a file or owned in memory */
+typedef struct {
+	inky_spidev_fb fb; /**< Read only when mapped */
+	void *map; /**< File mapping, NULL if fb owns its buffer */
+	size_t map_len;
+	uint8_t panel;
+	inky_spidev_frame_color color;
+	inky_spidev_frame_tag tag;
+	inky_spidev_frame_enc enc[INKY_SPIDEV_PLANES]; /**< As stored */
+} inky_spidev_frame;
+
+/** @brief Write a framebuffer to a frame file
+ *
+ * The file is written under a temporary name and renamed, so readers
+ * never see it partly written.
+ *
+ *  @param path File to create or replace
+ *  @param fb Framebuffer to store
+ *  @param panel Panel type recorded in the header
+ *  @param color Panel color recorded in the header
+ *  @param tag Tag recorded in the header, NULL for all zeros
+ *  @param rle Run length encode each plane that gets smaller by it
+ */
+int8_t inky_spidev_frame_write(const char *path, const inky_spidev_fb *fb,
+			       uint8_t panel, inky_spidev_frame_color color,
+			       const inky_spidev_frame_tag *tag, bool rle);
+
+/** @brief Open a frame file
+ *
+ * Raw planes are mapped, RLE planes are decoded into memory.
+ *
+ *  @param frame Set to the frame. Release with inky_spidev_frame_release()
+ *  @param path Frame file
+ *  @param verify Check the CRC, which reads every page of the file
+ *  @return INKY_E_FAILURE if the file is missing or malformed
+ */
+int8_t inky_spidev_frame_open(inky_spidev_frame *frame, const char *path,
+			      bool verify);
+
+/** @brief Unmap or free a frame */
+void inky_spidev_frame_release(inky_spidev_frame *frame);
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef INKY_SPIDEV_FRAME_H */
@@ -0,0 +1,137 @@
+#ifndef INKY_SPIDEV_LAT_H
+#define INKY_SPIDEV_LAT_H
+
+#include "inky-spidev.h"
+
+#include <pthread.h>
+
+#include <stdint.h>
+
+/**
+ * @defgroup inkyspidevlat Content to glass latency
+ * @ingroup inkyspidevapi
+ *
+ * Measures how long new content takes to reach the glass: from when
+ * the caller says it changed, such as a price update arriving, to the
+ * end of the refresh that shows it. Each framebuffer carries an
+ * inky_spidev_stamp with the caller's frame ID and content time. The
+ * library adds the time the frame was handed over and, in a pipeline,
+ * the time it was converted. A tracker attached to the interface then
+ * records the upload and refresh of every frame presented, so each
+ * frame's latency splits into inky_spidev_lat_stage parts.
+ *
+ * The tracker keeps the last INKY_SPIDEV_LAT_LEN frames for lookup by
+ * ID and for percentiles. Frames replaced by a newer one before they
+ * were uploaded, by inky_spidev_tbuf_submit() or a pipeline, never
+ * reach the glass. They are only counted.
+ *
+ * Times are CLOCK_MONOTONIC microseconds, as from
+ * inky_spidev_lat_now_us().
+ * @{
+ */
+
+/** @brief Frames a tracker remembers */
+#define INKY_SPIDEV_LAT_LEN 256
+
+/** @brief Origin of a frame, carried with its framebuffer */
+typedef struct {
+	uint64_t id; /**< Caller's frame ID */
+	uint64_t content_us; /**< When the content changed */
+	uint64_t queued_us; /**< Handed to the library, 0 until then */
+	uint64_t converted_us; /**< Packed by a pipeline, 0 if not */
+} inky_spidev_stamp;
+
+/** @brief One frame from content to glass */
+typedef struct {
+	uint64_t id;
+	uint64_t content_us;
+	uint64_t queued_us;
+	uint64_t converted_us; /**< 0 if the frame came packed */
+	uint64_t upload_start_us; /**< Controller reset or first RAM write */
+	uint64_t upload_end_us; /**< Refresh command */
+	uint64_t glass_us; /**< BUSY released after the refresh */
+	int8_t rst; /**< Result of the present */
+} inky_spidev_lat_rec;
+
+/** @brief Parts of a frame's latency */
+typedef enum {
+	INKY_SPIDEV_LAT_QUEUE, /**< Content change to handover */
+	INKY_SPIDEV_LAT_CONVERT, /**< Handover to packed */
+	INKY_SPIDEV_LAT_WAIT, /**< Ready to upload start */
+	INKY_SPIDEV_LAT_UPLOAD, /**< Reset and RAM writes */
+	INKY_SPIDEV_LAT_REFRESH, /**< Refresh command to BUSY release */
+	INKY_SPIDEV_LAT_TOTAL, /**< Content change to BUSY release */
+	INKY_SPIDEV_LAT_STAGES
+} inky_spidev_lat_stage;
+
+/** @brief Distribution of one stage over the remembered frames */
+typedef struct {
+	uint32_t frames; /**< Successful frames the figures cover */
+	uint64_t min_us;
+	uint64_t p50_us;
+	uint64_t p90_us;
+	uint64_t p99_us;
+	uint64_t max_us;
+	uint64_t mean_us;
+} inky_spidev_lat_stats;
+
+/** @brief Per interface latency tracker */
+typedef struct inky_spidev_lat {
+	pthread_mutex_t lock;
+	inky_spidev_lat_rec recs[INKY_SPIDEV_LAT_LEN];
+	uint64_t presented; /**< Frames recorded, successful or not */
+	uint64_t dropped; /**< Frames replaced before their upload */
+} inky_spidev_lat;
+
+/** @brief Current time on the clock stamps use */
+uint64_t inky_spidev_lat_now_us(void);
+
+/** @brief Start an empty tracker */
+int8_t inky_spidev_lat_init(inky_spidev_lat *lat);
+
+/** @brief Free a tracker that is no longer attached */
+void inky_spidev_lat_deinit(inky_spidev_lat *lat);
+
+/** @brief Record every present on an interface
+ *
+ * Attach before any buffer or pipeline on the interface is started.
+ *
+ *  @param intf_ptr Initialized interface
+ *  @param lat Tracker, or NULL to stop
+ */
+int8_t inky_spidev_lat_attach(inky_spidev_intf *intf_ptr,
+			      inky_spidev_lat *lat);
+
+/** @brief Look up a frame by the ID it was stamped with
+ *  @return INKY_E_OUT_OF_RANGE if it isn't among the remembered frames
+ */
+int8_t inky_spidev_lat_find(inky_spidev_lat *lat, uint64_t id,
+			    inky_spidev_lat_rec *out);
+
+/** @brief Length of one stage of a recorded frame */
+uint64_t inky_spidev_lat_stage_us(const inky_spidev_lat_rec *rec,
+				  inky_spidev_lat_stage stage);
+
+/** @brief Percentile of a stage over the remembered successful frames
+ *
+ * Nearest rank, so the result is always a latency that was measured.
+ *
+ *  @param pct Percentile, 0 to 100
+ *  @return INKY_E_NOT_CONFIGURED if no frame has been recorded yet
+ */
+int8_t inky_spidev_lat_percentile(inky_spidev_lat *lat,
+				  inky_spidev_lat_stage stage, double pct,
+				  uint64_t *out_us);
+
+/** @brief Common percentiles of a stage in one pass
+ *  @return INKY_E_NOT_CONFIGURED if no frame has been recorded yet
+ */
+int8_t inky_spidev_lat_summary(inky_spidev_lat *lat,
+			       inky_spidev_lat_stage stage,
+			       inky_spidev_lat_stats *out);
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef INKY_SPIDEV_LAT_H */
@@ -0,0 +1,130 @@
+#ifndef INKY_SPIDEV_MODEL_H
+#define INKY_SPIDEV_MODEL_H
+
+#include "inky-spidev.h"
+#include "inky-spidev-fb.h"
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @defgroup inkyspidevmodel Refresh time prediction
+ * @ingroup inkyspidevapi
+ *
+ * A model attached to an interface learns how long each
+ * inky_spidev_fb_present() takes. The upload part, from reset to the
+ * last RAM byte, is tracked as a moving average. The refresh part,
+ * until BUSY releases, is fitted by least squares to the panel
+ * temperature and to the fraction of pixels that use the third color,
+ * the two things that stretch a refresh the most. Older samples are
+ * weighted down by INKY_SPIDEV_MODEL_DECAY per new one, so the fit
+ * follows the panel as it ages.
+ *
+ * The temperature is the controller's own sensor reading, taken right
+ * after each refresh. Boards that don't wire MISO can't read it, and
+ * the model then falls back to fitting color usage alone.
+ * @{
+ */
+
+/** @brief Weight kept by older samples each time one is added */
+#define INKY_SPIDEV_MODEL_DECAY 0.95
+
+/** @brief Samples needed before a fit is trusted over the averages */
+#define INKY_SPIDEV_MODEL_MIN_SAMPLES 4
+
+/** @brief Refresh time assumed before anything has been measured */
+#define INKY_SPIDEV_MODEL_DEFAULT_US 30000000
+
+/** @brief Fixed allowance for scheduling jitter and wakeup */
+#define INKY_SPIDEV_MODEL_SLACK_US 500000
+
+/** @brief Temperature readings older than this are refreshed */
+#define INKY_SPIDEV_MODEL_TEMP_AGE_S 1800
+
+/** @brief Decayed least squares sums for up to three regressors */
+typedef struct {
+	uint32_t count; /**< Samples added */
+	double n; /**< Decayed sample weight */
+	double xx[3][3];
+	double xy[3];
+	double yy;
+} inky_spidev_lsq;
+
+/** @brief Per panel refresh time model */
+typedef struct inky_spidev_model {
+	inky_spidev_lsq temp_fit; /**< 1, color, temperature */
+	inky_spidev_lsq color_fit; /**< 1, color */
+	double upload_us; /**< Moving average of the upload time */
+	uint32_t samples;
+	int16_t temp; /**< Last temperature in 0.1 C, or unknown */
+	struct timespec temp_time; /**< CLOCK_MONOTONIC */
+} inky_spidev_model;
+
+/** @brief Start an empty model */
+int8_t inky_spidev_model_init(inky_spidev_model *model);
+
+/** @brief Measure every present on an interface into a model
+ *  @param intf_ptr Initialized interface
+ *  @param model Model to train, or NULL to stop
+ */
+int8_t inky_spidev_model_attach(inky_spidev_intf *intf_ptr,
+				inky_spidev_model *model);
+
+/** @brief Add one measured update
+ *  @param temp Panel temperature in 0.1 C, or INKY_SPIDEV_TEMP_UNKNOWN
+ *  @param color Fraction of pixels in the third color, 0 to 1
+ *  @param upload_us Time from reset to the refresh command
+ *  @param refresh_us Time from the refresh command to BUSY release
+ */
+void inky_spidev_model_add(inky_spidev_model *model, int16_t temp,
+			   double color, uint32_t upload_us,
+			   uint32_t refresh_us);
+
+/** @brief Predict how long a present will take
+ *  @param temp Panel temperature in 0.1 C, or INKY_SPIDEV_TEMP_UNKNOWN
+ *  @param color Fraction of pixels in the third color
+ *  @param margin_us Set to the allowance for the model's spread, may
+ *  be NULL
+ *  @return Expected total time in microseconds
+ */
+uint32_t inky_spidev_model_predict(const inky_spidev_model *model,
+				   int16_t temp, double color,
+				   uint32_t *margin_us);
+
+/** @brief Fraction of a framebuffer's pixels in the third color */
+double inky_spidev_fb_color_fraction(const inky_spidev_fb *fb);
+
+/** @brief Read the controller's temperature sensor
+ *
+ * Runs a short sensor update, which takes a few tens of milliseconds,
+ * after waking and configuring the controller if it was asleep. When
+ * a model is attached the reading is kept for inky_spidev_present_by().
+ *
+ *  @param intf_ptr Initialized interface
+ *  @param temp Set to the temperature in 0.1 C
+ *  @return INKY_E_NOT_CONFIGURED if the controller can't be read
+ */
+int8_t inky_spidev_temperature(inky_spidev_intf *intf_ptr, int16_t *temp);
+
+/** @brief Present a frame so that it is fully shown by a deadline
+ *
+ * Sleeps until the attached model says the update must start, then
+ * presents. Without a model attached, or when the start time has
+ * already passed, presents at once.
+ *
+ *  @param intf_ptr Initialized interface
+ *  @param fb Frame to show
+ *  @param deadline CLOCK_REALTIME time the frame must be visible by
+ *  @param slack_us Set to how early the refresh finished, negative if
+ *  late. May be NULL
+ */
+int8_t inky_spidev_present_by(inky_spidev_intf *intf_ptr,
+			      const inky_spidev_fb *fb,
+			      const struct timespec *deadline,
+			      int64_t *slack_us);
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef INKY_SPIDEV_MODEL_H */
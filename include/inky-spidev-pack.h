@@ -0,0 +1,73 @@
+#ifndef INKY_SPIDEV_PACK_H
+#define INKY_SPIDEV_PACK_H
+
+#include "inky-spidev-fb.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @defgroup inkyspidevpack Image packing
+ * @ingroup inkyspidevapi
+ *
+ * Converts 8 bit grayscale or RGB images into a packed framebuffer,
+ * applying the panel orientation on the way. Source rows are packed
+ * eight at a time into a small band buffer; for quarter turns each
+ * 8x8 block of the band is transposed as a 64-bit word and stored as
+ * one destination byte per row, so neither a rotated copy of the
+ * image nor per-pixel scattered writes are needed.
+ * @{
+ */
+
+/** @brief Clockwise rotation applied while packing */
+typedef enum {
+	INKY_SPIDEV_ROTATE_0 = 0,
+	INKY_SPIDEV_ROTATE_90,
+	INKY_SPIDEV_ROTATE_180,
+	INKY_SPIDEV_ROTATE_270
+} inky_spidev_rotation;
+
+/** @brief Source pixel formats */
+typedef enum {
+	INKY_SPIDEV_PIX_GRAY8 = 0, /**< One byte per pixel */
+	INKY_SPIDEV_PIX_RGB888 /**< Three bytes per pixel, red first */
+} inky_spidev_pixfmt;
+
+/** @brief Conversion parameters */
+typedef struct {
+	inky_spidev_pixfmt format;
+	inky_spidev_rotation rotation;
+	bool mirror; /**< Flip left to right before rotating */
+	uint8_t threshold; /**< Channel level that counts as lit */
+	bool color; /**< Map red and yellow RGB pixels to the color plane */
+} inky_spidev_pack_cfg;
+
+/** @brief Default parameters: grayscale, upright, threshold 128 */
+#define INKY_SPIDEV_PACK_CFG_DEFAULT \
+	{INKY_SPIDEV_PIX_GRAY8, INKY_SPIDEV_ROTATE_0, false, 128, false}
+
+/** @brief Pack an image into a framebuffer
+ *
+ * A pixel is white when its luma is at or above the threshold. With
+ * color enabled, RGB pixels whose red channel is lit and blue channel
+ * is not are drawn in the panel's third color.
+ *
+ * For 90 and 270 degree rotations the framebuffer must be height x
+ * width, otherwise width x height.
+ *
+ *  @param fb Destination framebuffer
+ *  @param pixels Top left pixel of the source image
+ *  @param width Source width in pixels
+ *  @param height Source height in pixels
+ *  @param stride Bytes between source rows
+ *  @param cfg Conversion parameters
+ */
+int8_t inky_spidev_fb_pack(inky_spidev_fb *fb, const uint8_t *pixels,
+			   uint16_t width, uint16_t height, uint32_t stride,
+			   const inky_spidev_pack_cfg *cfg);
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef INKY_SPIDEV_PACK_H */
@@ -0,0 +1,129 @@
+#ifndef INKY_SPIDEV_PIPE_H
+#define INKY_SPIDEV_PIPE_H
+
+#include "inky-spidev.h"
+#include "inky-spidev-fb.h"
+#include "inky-spidev-pack.h"
+
+#include <pthread.h>
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/**
+ * @defgroup inkyspidevpipe Render, convert and upload pipeline
+ * @ingroup inkyspidevapi
+ *
+ * Splits an update into three stages on their own threads, so the CPU
+ * renders and converts while the panel refreshes:
+ *
+ * 1. The application renders 8 bit images on its own thread into
+ *    buffers from inky_spidev_pipe_acquire().
+ * 2. A convert thread packs each pushed image into a framebuffer.
+ * 3. An inky_spidev_tbuf uploads the newest packed frame.
+ *
+ * Render and convert are connected by a pair of bounded single
+ * producer, single consumer rings, one carrying filled images and one
+ * returning empty ones. When every image is in flight, acquiring
+ * blocks until the convert stage frees one, so rendering can't run
+ * ahead of conversion. The upload stage never holds conversion back:
+ * frames packed while a refresh is running replace each other and only
+ * the newest is shown. The pipeline then runs at the pace of its
+ * slowest stage rather than the sum of all three.
+ *
+ * For several panels, give each its own pipeline.
+ * @{
+ */
+
+/** @brief Slots in a ring, a power of two */
+#define INKY_SPIDEV_RING_LEN 8
+
+/** @brief Most images a pipeline may have in flight */
+#define INKY_SPIDEV_PIPE_MAX_DEPTH INKY_SPIDEV_RING_LEN
+
+/** @brief Bounded single producer, single consumer queue of indices */
+typedef struct {
+	atomic_uint head; /**< Next slot to read, moved by the consumer */
+	atomic_uint tail; /**< Next slot to write, moved by the producer */
+	uint8_t slots[INKY_SPIDEV_RING_LEN];
+} inky_spidev_ring;
+
+/** @brief Three stage update pipeline for one panel */
+typedef struct {
+	inky_spidev_tbuf upload; /**< Upload stage */
+	inky_spidev_pack_cfg cfg;
+	uint16_t width; /**< Source image width */
+	uint16_t height; /**< Source image height */
+	uint32_t stride; /**< Bytes per source row */
+	uint8_t depth; /**< Source images */
+	uint8_t *pixels[INKY_SPIDEV_PIPE_MAX_DEPTH];
+	inky_spidev_stamp stamps[INKY_SPIDEV_PIPE_MAX_DEPTH];
+	int cur; /**< Image held by the renderer, -1 if none */
+	inky_spidev_ring full; /**< Rendered images, to convert */
+	inky_spidev_ring empty; /**< Converted images, to render into */
+	int full_fd; /**< Wakes the convert thread */
+	int empty_fd; /**< Wakes a renderer waiting for an image */
+	atomic_bool stop;
+	atomic_int last_rst; /**< Result of the most recent conversion */
+	atomic_uint rendered; /**< Images pushed */
+	atomic_uint converted; /**< Frames handed to the upload stage */
+	pthread_t thread;
+} inky_spidev_pipe;
+
+/** @brief Allocate the stages and start their threads
+ *
+ * Packed frames are sized from the image and the rotation in cfg, as
+ * for inky_spidev_fb_pack().
+ *
+ *  @param pipe Pipeline to initialize
+ *  @param intf_ptr Initialized interface the frames go to
+ *  @param width Source image width in pixels
+ *  @param height Source image height in pixels
+ *  @param cfg Conversion parameters
+ *  @param depth Images in flight between render and convert, 2 or
+ *  more and at most INKY_SPIDEV_PIPE_MAX_DEPTH
+ */
+int8_t inky_spidev_pipe_init(inky_spidev_pipe *pipe,
+			     inky_spidev_intf *intf_ptr,
+			     uint16_t width, uint16_t height,
+			     const inky_spidev_pack_cfg *cfg, uint8_t depth);
+
+/** @brief Get an image to render into
+ *
+ * Blocks while every image is waiting to be converted. Rows are
+ * pipe->stride bytes apart. Calling again before a push returns the
+ * same image.
+ *
+ *  @return The image, or NULL once the pipeline is stopping
+ */
+uint8_t *inky_spidev_pipe_acquire(inky_spidev_pipe *pipe);
+
+/** @brief Stamp the acquired image for latency tracking
+ *
+ * As inky_spidev_fb_stamp(). The stamp follows the image through
+ * conversion to the framebuffer that is uploaded.
+ *
+ *  @return INKY_E_FAILURE if no image is acquired
+ */
+int8_t inky_spidev_pipe_stamp(inky_spidev_pipe *pipe, uint64_t id,
+			      uint64_t content_us);
+
+/** @brief Queue the acquired image for conversion and upload
+ *
+ * Only one thread may acquire and push on a given pipeline.
+ *
+ *  @return Result of the most recent conversion, or of the most recent
+ *  upload if that conversion succeeded
+ */
+int8_t inky_spidev_pipe_push(inky_spidev_pipe *pipe);
+
+/** @brief Convert what was pushed, stop the upload after its current
+ *  frame and free everything
+ */
+int8_t inky_spidev_pipe_deinit(inky_spidev_pipe *pipe);
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef INKY_SPIDEV_PIPE_H */
@@ -0,0 +1,71 @@
+#ifndef INKY_SPIDEV_PROBE_H
+#define INKY_SPIDEV_PROBE_H
+
+#include "inky-spidev.h"
+
+#include <stdint.h>
+
+/**
+ * @defgroup inkyspidevprobe Panel auto-detection
+ * @ingroup inkyspidevapi
+ * @{
+ */
+
+#define INKY_SPIDEV_EEPROM_ADDR 0x50
+#define INKY_SPIDEV_EEPROM_LEN 29
+#define INKY_SPIDEV_I2C_DEFAULT "/dev/i2c-1"
+
+/** @brief EEPROM color codes */
+#define INKY_SPIDEV_EEPROM_BLACK 1
+#define INKY_SPIDEV_EEPROM_RED 2
+#define INKY_SPIDEV_EEPROM_YELLOW 3
+#define INKY_SPIDEV_EEPROM_7COLOR 5
+
+/** @brief Contents of the Inky board ID EEPROM */
+typedef struct {
+	uint16_t width;
+	uint16_t height;
+	uint8_t color;
+	uint8_t pcb_variant;
+	uint8_t display_variant;
+	char write_time[22];
+} inky_spidev_eeprom;
+
+/** @brief Read the board ID EEPROM
+ *  @param i2cdev I2C bus special file, ex: /dev/i2c-1
+ *  @param out Decoded EEPROM contents
+ */
+int8_t inky_spidev_probe_eeprom(const char *i2cdev,
+				inky_spidev_eeprom *out);
+
+/** @brief Detect the attached panel and configure the interface
+ *
+ * Looks for a cached result for the interface's spidev path first.
+ * Otherwise reads the board EEPROM and caches what it holds. On
+ * success the product type, color configuration and panel size of the
+ * interface are updated. Call after inky_spidev_init() and before
+ * inky_setup().
+ *
+ * Without a readable EEPROM, the controller is reset and its status
+ * register read, which shows whether a panel is connected but not
+ * which one. This goes through the interface's callbacks, setting the
+ * interface up for the probe and releasing it again if inky_setup()
+ * hasn't run yet. The interface is then left as configured and nothing
+ * is cached, so the EEPROM is read again on the next probe.
+ *
+ *  @param intf_ptr Initialized interface
+ *  @param i2cdev I2C bus of the EEPROM, NULL for INKY_SPIDEV_I2C_DEFAULT
+ *  @param cache_dir Directory for cached results, NULL to disable
+ *  @return INKY_OK if the panel was identified, INKY_E_NOT_CONFIGURED
+ *  if a controller answered but its type is unknown,
+ *  INKY_E_COMM_FAILURE if nothing answered, or INKY_E_FAILURE if the
+ *  controller couldn't be asked, such as in 3-wire mode
+ */
+int8_t inky_spidev_probe(inky_spidev_intf *intf_ptr, const char *i2cdev,
+			 const char *cache_dir);
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef INKY_SPIDEV_PROBE_H */
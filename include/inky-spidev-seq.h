@@ -0,0 +1,102 @@
+#ifndef INKY_SPIDEV_SEQ_H
+#define INKY_SPIDEV_SEQ_H
+
+#include "inky-spidev.h"
+
+#include <stdint.h>
+
+/**
+ * @defgroup inkyspidevseq Recorded controller sequences
+ * @ingroup inkyspidevapi
+ *
+ * A sequence is a compact blob of the hardware operations issued
+ * through the interface callbacks: DC and RESET levels, SPI data,
+ * delays and BUSY waits. Consecutive data bytes with the same DC level
+ * are merged into a single record so a replay needs one transfer per
+ * command or data run.
+ *
+ * Replaying shortens reset pulses to INKY_SPIDEV_SEQ_RESET_US, but
+ * keeps other delays, including those before a BUSY wait, where BUSY
+ * may rise late. Each BUSY wait starts from the length
+ * measured while recording, see inky_spidev_busy_hint(), so it sleeps
+ * through most of it instead of polling from the shortest interval.
+ * @{
+ */
+
+#define INKY_SPIDEV_SEQ_MAGIC "ISEQ"
+#define INKY_SPIDEV_SEQ_VERSION 1
+#define INKY_SPIDEV_SEQ_RESET_US 10000
+
+/** @brief Longest sequence saved or loaded, far above any init */
+#define INKY_SPIDEV_SEQ_MAX_LEN (1u << 20)
+
+/** @brief Record types in a sequence blob */
+typedef enum {
+	INKY_SEQ_OP_DC = 1, /**< 1 byte level */
+	INKY_SEQ_OP_RESET, /**< 1 byte level */
+	INKY_SEQ_OP_DATA, /**< 2 byte little endian length, then data */
+	INKY_SEQ_OP_DELAY, /**< 4 byte little endian microseconds */
+	INKY_SEQ_OP_BUSY /**< 4 byte timeout, 4 byte measured us */
+} inky_spidev_seq_op;
+
+/** @brief Recorded sequence */
+typedef struct inky_spidev_seq {
+	uint8_t *buf;
+	uint32_t len;
+	uint32_t cap;
+	uint16_t width; /**< Panel geometry the sequence was made for */
+	uint16_t height;
+	int16_t last_dc; /**< Recording state, -1 if unknown */
+	uint32_t data_rec; /**< Offset + 1 of the open data record */
+} inky_spidev_seq;
+
+/** @brief Start capturing hardware operations into seq
+ *
+ * Any previous contents of seq are discarded. A sequence that has
+ * not been used before must be zero initialized.
+ *
+ *  @param intf_ptr Interface to capture from
+ *  @param seq Sequence to record into
+ */
+int8_t inky_spidev_seq_record_begin(inky_spidev_intf *intf_ptr,
+				    inky_spidev_seq *seq);
+
+/** @brief Stop capturing */
+int8_t inky_spidev_seq_record_end(inky_spidev_intf *intf_ptr);
+
+/** @brief Issue a recorded sequence through the interface callbacks */
+int8_t inky_spidev_seq_replay(inky_spidev_intf *intf_ptr,
+			      const inky_spidev_seq *seq);
+
+/** @brief Write a sequence to a file
+ *  @return INKY_E_OUT_OF_RANGE if longer than INKY_SPIDEV_SEQ_MAX_LEN
+ */
+int8_t inky_spidev_seq_save(const inky_spidev_seq *seq, const char *path);
+
+/** @brief Read and validate a sequence file
+ *  @return INKY_E_FAILURE if the file is truncated, too long or
+ *  malformed
+ */
+int8_t inky_spidev_seq_load(inky_spidev_seq *seq, const char *path);
+
+/** @brief Release memory held by a sequence */
+void inky_spidev_seq_free(inky_spidev_seq *seq);
+
+/** @brief Cache the controller init sequence in a directory
+ *
+ * The first inky_spidev_fb_present() for a panel type records the
+ * reset and setup sequence and stores it in dir. Later processes load
+ * it and replay it instead of rebuilding the sequence. Pass NULL to
+ * stop caching.
+ *
+ *  @param intf_ptr Interface
+ *  @param dir Writable directory, for example /var/cache/inky-spidev
+ */
+int8_t inky_spidev_seq_cache_dir(inky_spidev_intf *intf_ptr,
+				 const char *dir);
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef INKY_SPIDEV_SEQ_H */
@@ -0,0 +1,90 @@
+#ifndef INKY_SPIDEV_TEXT_H
+#define INKY_SPIDEV_TEXT_H
+
+#include "inky-spidev-fb.h"
+
+#include <stdint.h>
+
+/**
+ * @defgroup inkyspidevtext Bitmap font text rendering
+ * @ingroup inkyspidevapi
+ *
+ * Fonts are loaded once from PSF (v1 or v2) or BDF files into a 1bpp
+ * atlas in the same MSB-first layout as the framebuffer planes, so
+ * drawing a glyph is a shift and a handful of byte masks per row
+ * instead of a call per pixel.
+ * @{
+ */
+
+/** @brief Glyph metrics and atlas location */
+typedef struct {
+	uint32_t codepoint;
+	uint16_t width; /**< Bitmap width in pixels */
+	uint16_t height; /**< Bitmap height in pixels */
+	int16_t left; /**< Bitmap x offset from the pen position */
+	int16_t top; /**< Bitmap y offset from the baseline, down positive */
+	int16_t advance; /**< Pen movement after drawing */
+	uint16_t stride; /**< Bytes per bitmap row in the atlas */
+	uint32_t offset; /**< Bitmap position in the atlas */
+} inky_spidev_glyph;
+
+/** @brief Kerning adjustment between two code points */
+typedef struct {
+	uint32_t left;
+	uint32_t right;
+	int16_t adjust;
+} inky_spidev_kern;
+
+/** @brief Loaded bitmap font */
+typedef struct {
+	inky_spidev_glyph *glyphs; /**< Sorted by code point */
+	uint32_t nglyphs;
+	uint8_t *atlas;
+	uint32_t atlas_len;
+	int16_t ascent; /**< Baseline distance from the top of a line */
+	uint16_t line_height;
+	inky_spidev_kern *kerns; /**< Sorted by pair */
+	uint32_t nkerns;
+	int32_t latin1[256]; /**< Glyph index for code points below 256 */
+} inky_spidev_font;
+
+/** @brief Load a PSF1 or PSF2 console font */
+int8_t inky_spidev_font_load_psf(inky_spidev_font *font, const char *path);
+
+/** @brief Load a BDF font */
+int8_t inky_spidev_font_load_bdf(inky_spidev_font *font, const char *path);
+
+/** @brief Release a loaded font */
+void inky_spidev_font_free(inky_spidev_font *font);
+
+/** @brief Replace the font's kerning table
+ *  @param font Loaded font
+ *  @param kerns Pairs to copy, in any order
+ *  @param n Number of pairs
+ */
+int8_t inky_spidev_font_set_kerning(inky_spidev_font *font,
+				    const inky_spidev_kern *kerns,
+				    uint32_t n);
+
+/** @brief Look up a glyph, NULL if the font does not have it */
+const inky_spidev_glyph *inky_spidev_font_glyph(const inky_spidev_font *font,
+						uint32_t codepoint);
+
+/** @brief Draw UTF-8 text with the top of the line at y
+ *
+ * Only glyph pixels are drawn; the background is left untouched.
+ * Text is clipped to the framebuffer.
+ *
+ *  @return Pen x position after the last glyph
+ */
+int inky_spidev_text_draw(inky_spidev_fb *fb, const inky_spidev_font *font,
+			  int x, int y, const char *text, inky_color c);
+
+/** @brief Width in pixels that inky_spidev_text_draw() would advance */
+int inky_spidev_text_width(const inky_spidev_font *font, const char *text);
+
+/**
+ * @}
+ */
+
+#endif /* #ifndef INKY_SPIDEV_TEXT_H */
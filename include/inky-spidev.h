@@ -4,8 +4,12 @@
 #include "inky.h"
 
 #include <gpiod.h>
+#include <pthread.h>
+#include <linux/spi/spidev.h>
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 
 /**
  * @defgroup inkyspidevapi Inky Linux Userspace API
@@ -15,6 +19,167 @@
 #define INKY_SPIDEV_CONSUMER "inky-spidev"
 #define INKY_SPIDEV_SPEED 800000
 #define INKY_SPIDEV_SPECIAL_LEN 64
+#define INKY_SPIDEV_BUFSIZ_DEFAULT 4096
+#define INKY_SPIDEV_BUFSIZ_PARAM "/sys/module/spidev/parameters/bufsiz"
+#define INKY_SPIDEV_PINS 3
+#define INKY_SPIDEV_PATH_LEN 256
+#define INKY_SPIDEV_BUSY_MIN_US 100
+#define INKY_SPIDEV_BUSY_MAX_US 10000
+#define INKY_SPIDEV_BUSY_OPS 8
+#define INKY_SPIDEV_THERMAL_DEFAULT "/sys/class/thermal/thermal_zone0/temp"
+#define INKY_SPIDEV_TEMP_BAND 50
+
+/** @brief Temperature not available */
+#define INKY_SPIDEV_TEMP_UNKNOWN INT16_MIN
+
+struct inky_spidev_seq;
+struct inky_spidev_bus;
+struct inky_spidev_model;
+struct inky_spidev_lat;
+
+/** @brief Hardware access backend used by the callbacks
+ *
+ * All SPI and GPIO traffic from the callbacks goes through one of
+ * these, so an alternative backend (a test double, an asynchronous
+ * executor, a different GPIO library) can be dropped in with
+ * inky_spidev_set_transport().
+ */
+typedef struct {
+	const char *name;
+
+	/** Run n chained transfers as one SPI message. Returns
+	 * INKY_E_OUT_OF_RANGE if the controller rejects a transfer's
+	 * word size before sending anything, which 9 and 16 bit writes
+	 * take as a cue to fall back to bytes */
+	inky_error_state (*spi_transfer)(void *intf_ptr,
+					 struct spi_ioc_transfer *xfers,
+					 uint32_t n);
+
+	/** Drive an output line to value 0 or 1 */
+	inky_error_state (*gpio_set)(void *intf_ptr, inky_pin gpin,
+				     int value);
+
+	/** Read an input line as 0 or 1 */
+	inky_error_state (*gpio_get)(void *intf_ptr, inky_pin gpin,
+				     int *value);
+} inky_spidev_transport;
+
+/** @brief Default backend: spidev ioctls and libgpiod line access */
+extern const inky_spidev_transport inky_spidev_transport_ioctl;
+
+/** @brief Last configuration requested for a GPIO line
+ *
+ * Kept so lines can be re-requested after the idle manager has
+ * released them.
+ */
+typedef struct {
+	bool valid;
+	inky_pin pin;
+	struct gpiod_line *line;
+	inky_gpio_direction dir;
+	inky_pin_state state;
+	inky_gpio_pull_up_down pull;
+} inky_spidev_pincfg;
+
+/** @brief Idle power management state
+ *
+ * See inky_spidev_idle_enable().
+ */
+typedef struct {
+	bool enabled;
+	bool stop;
+	bool asleep; /**< Controller in deep sleep, fd and lines released */
+	bool ctrl_ready; /**< Controller reset and configured */
+	unsigned int active; /**< Hardware operations in progress */
+	uint32_t timeout_ms;
+	struct timespec last_use; /**< CLOCK_MONOTONIC */
+	pthread_t thread;
+	pthread_cond_t cond; /**< Waited on with the interface lock */
+} inky_spidev_idle;
+
+/** @brief How inky_spidev_gpio_poll_pin() spaces its reads of BUSY */
+typedef enum {
+	INKY_SPIDEV_BUSY_FIXED, /**< Read every max_us */
+	INKY_SPIDEV_BUSY_ADAPTIVE /**< Back off from min_us to max_us */
+} inky_spidev_busy_mode;
+
+/** @brief Learned length of the waits that follow one command */
+typedef struct {
+	uint16_t key; /**< See inky_spidev_busy_expected() */
+	uint32_t samples;
+	uint32_t expected_us; /**< Moving average of past waits */
+} inky_spidev_busy_hist;
+
+/** @brief BUSY wait strategy and history
+ *
+ * See inky_spidev_busy_config().
+ */
+typedef struct {
+	inky_spidev_busy_mode mode;
+	uint32_t min_us;
+	uint32_t max_us;
+	bool cmd_mode; /**< DC is low, SPI bytes are commands */
+	uint16_t key; /**< Key for a wait starting now */
+	uint8_t arg; /**< First data byte of the last command */
+	bool have_arg;
+	unsigned int nhist;
+	inky_spidev_busy_hist hist[INKY_SPIDEV_BUSY_OPS];
+} inky_spidev_busy;
+
+/** @brief Where the temperature used to pick the waveform comes from */
+typedef enum {
+	INKY_SPIDEV_TEMP_INTERNAL, /**< Controller sensor, every refresh */
+	INKY_SPIDEV_TEMP_THERMAL, /**< sysfs file in millidegrees */
+	INKY_SPIDEV_TEMP_MANUAL /**< inky_spidev_temp_set() */
+} inky_spidev_temp_source;
+
+/** @brief Temperature compensation state
+ *
+ * See inky_spidev_temp_config().
+ */
+typedef struct {
+	inky_spidev_temp_source source;
+	char path[INKY_SPIDEV_PATH_LEN]; /**< Thermal source file */
+	int16_t manual; /**< Manual temperature in 0.1 C */
+	uint16_t band; /**< Band width in 0.1 C */
+	int16_t loaded; /**< Band of the last LUT loaded, in 0.1 C */
+	bool lut_ready; /**< LUT loaded since the last reset */
+} inky_spidev_temp;
+
+/** @brief What inky_spidev_fb_present() knows is in controller RAM */
+typedef struct {
+	bool valid[2]; /**< Per plane, copy matches the RAM contents */
+	uint8_t *copy[2]; /**< Last plane written to RAM */
+	uint32_t copy_len[2];
+	bool writing; /**< A present is writing RAM */
+	uint64_t sent; /**< Planes transferred in full */
+	uint64_t filled; /**< Planes cleared with a RAM fill command */
+	uint64_t skipped; /**< Planes already in RAM */
+} inky_spidev_ram;
+
+/** @brief Words held back in 3-wire mode before a transfer */
+#define INKY_SPIDEV_WIRE_BATCH 2048
+
+/** @brief How the D/C signal reaches the controller */
+typedef enum {
+	INKY_SPIDEV_WIRE_4, /**< D/C on its own GPIO, 8 bit words */
+	INKY_SPIDEV_WIRE_3, /**< D/C as the first of 9 bits per word */
+	INKY_SPIDEV_WIRE_3_PACKED /**< 9 bit words packed into bytes */
+} inky_spidev_wire_mode;
+
+/** @brief What goes into the next SPI message
+ *
+ * See inky_spidev_wire_config() and inky_spidev_delay().
+ */
+typedef struct {
+	inky_spidev_wire_mode mode;
+	uint32_t delay_us; /**< Settle time to send ahead of the next data */
+	bool swap16; /**< 16 bit words rejected, sent as byte pairs */
+	bool data; /**< D/C level of the next bytes, true for data */
+	uint32_t len; /**< Words pending */
+	uint16_t pending[INKY_SPIDEV_WIRE_BATCH]; /**< D/C << 8 | byte */
+	uint64_t transfers; /**< SPI transfers sent */
+} inky_spidev_wire;
 
 /** @brief interface object for inky-spidev driver
  *
@@ -22,14 +187,34 @@
  * interface.
  */
 typedef struct {
+	pthread_mutex_t lock; /**< Recursive, see inky_spidev_lock() */
 	char special[INKY_SPIDEV_SPECIAL_LEN];
 	int fd;
+	uint32_t bufsiz; /**< Largest transfer spidev accepts */
+	const inky_spidev_transport *transport;
 	inky_config dev;
+	uint16_t width; /**< Panel width in pixels */
+	uint16_t height; /**< Panel height in pixels */
 	struct gpiod_chip *gpio_chip;
 	struct gpiod_line *gpio_reset;
 	struct gpiod_line *gpio_busy;
 	struct gpiod_line *gpio_dc;
 	inky_color_config color_cfg;
+	inky_spidev_pincfg pincfg[INKY_SPIDEV_PINS];
+	inky_spidev_idle idle;
+	inky_spidev_busy busy;
+	inky_spidev_temp temp;
+	inky_spidev_ram ram;
+	inky_spidev_wire wire;
+	unsigned int hw_depth; /**< Nested hardware accesses */
+	struct inky_spidev_seq *seq_rec; /**< Sequence being recorded */
+	struct inky_spidev_seq *init_seq; /**< Cached init sequence */
+	char seq_dir[INKY_SPIDEV_PATH_LEN]; /**< Init sequence cache */
+	struct inky_spidev_bus *bus; /**< Shared bus arbiter, or NULL */
+	unsigned int bus_depth; /**< Nested hardware accesses on the bus */
+	bool bus_yielded; /**< Bus lent out during a wait */
+	struct inky_spidev_model *model; /**< Refresh time model, or NULL */
+	struct inky_spidev_lat *lat; /**< Latency tracker, or NULL */
 } inky_spidev_intf;
 
 /** @defgroup inkyspidevgpiocb GPIO function user callbacks
@@ -60,21 +245,41 @@ inky_error_state inky_spidev_gpio_poll_pin(inky_pin, uint64_t,
 inky_error_state inky_spidev_spi_setup(void *intf_ptr);
 
 /* Typical kernel callbacks */
+
+/** @brief Wait, or schedule a settle time
+ *
+ * Inside a hardware access, such as inky_spidev_update(), delays below
+ * INKY_SPIDEV_BUS_YIELD_US are not slept but sent as part of the next
+ * SPI message, which the kernel holds back for exactly that long. They
+ * are still sent before any BUSY wait, input read, reset, or the end of
+ * the access. Longer delays sleep and lend a shared bus out.
+ */
 inky_error_state inky_spidev_delay(uint32_t delay_us, void *intf_ptr);
 
 /** @brief User callback to write byte to SPI
+ *
+ * Buffers longer than the spidev bufsiz module parameter are split
+ * into several transfers.
+ *
  *  @param buf ptr to buffer to write
  *  @param len length of buffer to write
  */
 inky_error_state inky_spidev_spi_write(const uint8_t* buf, uint32_t len,
 				       void *intf_ptr);
 
-/** @brief User callback to write 16bit word to SPI
- *  @param buf Ptr to buffer to write
- *  @param len Length of buffer to write
+/** @brief User callback to write 16bit words to SPI
+ *
+ * Words are in host order and go out most significant byte first.
+ * They are split into transfers of at most the spidev bufsiz. If the
+ * SPI controller can't send 16 bit words, they are sent as byte pairs
+ * instead. Panels that need a gap between words can add it with
+ * inky_spidev_delay().
+ *
+ *  @param buf Words to write
+ *  @param len Number of words, not bytes
  */
-inky_error_state inky_spidev_spi_write_16(uint16_t* buf, uint32_t len,
-					  void *intf_ptr);
+inky_error_state inky_spidev_spi_write16(const uint16_t* buf, uint32_t len,
+					 void *intf_ptr);
 
 /**
  * @}
@@ -97,11 +302,229 @@ int8_t inky_spidev_init(inky_spidev_intf *intf_ptr, const char* spidev,
 			const char* gpiochip, unsigned int reset_offset,
 			unsigned int busy_offset, unsigned int dc_offset);
 
+/** @brief Replace the hardware access backend
+ *  @param intf_ptr Initialized interface
+ *  @param transport Backend, must outlive the interface
+ */
+int8_t inky_spidev_set_transport(inky_spidev_intf *intf_ptr,
+				 const inky_spidev_transport *transport);
+
 /** @brief Deinitialize and return resources to GPIO and SPI devices
+ *
+ * No other thread may be using the interface.
+ *
  *  @param intf_ptr Device interface pointer
  */
 int8_t inky_spidev_deinit(inky_spidev_intf *intf_ptr);
 
+/**
+ * @}
+ */
+
+/**
+ * @defgroup inkyspidevlock Thread safety
+ *
+ * Every interface has its own recursive lock. Each callback, and each
+ * library call that touches hardware or interface state, holds it for
+ * its whole duration, so a single frame upload is never interleaved
+ * with traffic from another thread. Interfaces share no state with
+ * each other and the library has no globals, so different panels can
+ * be driven from different threads without contention.
+ *
+ * The pimoroni driver calls (inky_setup(), inky_update(), inky_fb_*)
+ * work on the unlocked inky_config. Use inky_spidev_update() or hold
+ * inky_spidev_lock() around them when the interface is shared.
+ *
+ * inky_spidev_init() and inky_spidev_deinit() must not race with any
+ * other use of the same interface.
+ * @{
+ */
+
+/** @brief Take the interface lock, blocking until it is available
+ *
+ * The lock is recursive; calls into the library while holding it are
+ * allowed. Use it to make a sequence of operations atomic.
+ */
+void inky_spidev_lock(inky_spidev_intf *intf_ptr);
+
+/** @brief Release the interface lock */
+void inky_spidev_unlock(inky_spidev_intf *intf_ptr);
+
+/** @brief Run inky_update() on the interface's device under its lock
+ *
+ * With a shared bus attached, the whole update is also one burst on
+ * the bus, apart from BUSY waits.
+ */
+int8_t inky_spidev_update(inky_spidev_intf *intf_ptr);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup inkyspidevbusy BUSY wait strategy
+ *
+ * The default adaptive strategy reads BUSY immediately, then sleeps
+ * min_us and doubles the sleep after every read up to max_us, so short
+ * settle times return quickly and long refreshes cost few wakeups.
+ * The length of each successful wait is remembered per command that
+ * preceded it, qualified by the first data byte of the command before
+ * that, so a refresh (0x22 0xf7, 0x20) and a LUT load (0x22 0x91,
+ * 0x20) are learned apart. Once a command has history, the wait
+ * sleeps through most of the expected time in one go and only polls
+ * closely around the expected end.
+ * @{
+ */
+
+/** @brief Choose how BUSY is polled
+ *  @param intf_ptr Initialized interface
+ *  @param mode Fixed interval or adaptive backoff
+ *  @param min_us First adaptive interval, ignored when fixed
+ *  @param max_us Longest interval, and the fixed interval
+ */
+int8_t inky_spidev_busy_config(inky_spidev_intf *intf_ptr,
+			       inky_spidev_busy_mode mode,
+			       uint32_t min_us, uint32_t max_us);
+
+/** @brief Expected BUSY time after a command, learned from history
+ *  @param key Command byte in the high byte, first data byte of the
+ *  command before it in the low byte, ex: 0x20f7 for a full refresh
+ *  @return Microseconds, or 0 if the command has no history yet
+ */
+uint32_t inky_spidev_busy_expected(inky_spidev_intf *intf_ptr,
+				   uint16_t key);
+
+/** @brief Drop what was learned about a command, when conditions that
+ *  set its duration have changed
+ */
+int8_t inky_spidev_busy_forget(inky_spidev_intf *intf_ptr, uint16_t key);
+
+/** @brief Suggest how long the waits after a command take
+ *
+ * Used until the first wait for the command is measured, which then
+ * replaces it. Ignored if the command already has history.
+ *
+ *  @param key As for inky_spidev_busy_expected()
+ *  @param expected_us Expected wait, 0 to do nothing
+ */
+int8_t inky_spidev_busy_hint(inky_spidev_intf *intf_ptr, uint16_t key,
+			     uint32_t expected_us);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup inkyspidevtemp Temperature compensation
+ *
+ * The controller picks its refresh waveform from OTP by temperature.
+ * By default it samples its own sensor at the start of every refresh,
+ * which reads the die rather than the panel and runs warm in a closed
+ * case. With a thermal zone or a manual source,
+ * inky_spidev_fb_present() writes that temperature to the controller
+ * instead. It loads the matching LUT once and refreshes without
+ * reloading it until the temperature leaves its band or the
+ * controller is reset. Each band is represented by its center, so the
+ * waveform doesn't flip on sensor noise. When the band changes, the
+ * learned refresh time is dropped so BUSY polling relearns it.
+ *
+ * Below INKY_SPIDEV_TEMP_COLD the refresh timeout is doubled, as the
+ * cold waveforms are much longer.
+ * @{
+ */
+
+/** @brief Bands below this (0.1 C) get a longer refresh timeout */
+#define INKY_SPIDEV_TEMP_COLD 50
+
+/** @brief Select the temperature source
+ *  @param intf_ptr Initialized interface
+ *  @param source Internal sensor, a thermal file, or manual
+ *  @param path File holding millidegrees C for INKY_SPIDEV_TEMP_THERMAL,
+ *  NULL for INKY_SPIDEV_THERMAL_DEFAULT. Ignored otherwise
+ *  @param band Band width in 0.1 C, 0 for INKY_SPIDEV_TEMP_BAND
+ */
+int8_t inky_spidev_temp_config(inky_spidev_intf *intf_ptr,
+			       inky_spidev_temp_source source,
+			       const char *path, uint16_t band);
+
+/** @brief Set the temperature and switch to INKY_SPIDEV_TEMP_MANUAL
+ *  @param temp Temperature in 0.1 C
+ */
+int8_t inky_spidev_temp_set(inky_spidev_intf *intf_ptr, int16_t temp);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup inkyspidevwire 3-wire SPI
+ *
+ * Controllers strapped for 3-wire SPI take the D/C level as a ninth
+ * bit in front of every byte instead of on a GPIO. The library then
+ * never touches the DC line: the level each callback would set is
+ * stored, and bytes are queued as 9 bit words until something has to
+ * happen in order with them, such as a delay, a BUSY wait, a reset or
+ * the end of the outermost hardware access. A whole command sequence,
+ * commands and parameters alike, goes out as one SPI transfer rather
+ * than one per DC change.
+ *
+ * SPI controllers that can't send 9 bit words get the same bit stream
+ * packed into bytes, 8 words to 9 bytes, with each transfer ending on
+ * a word boundary. The first rejected transfer switches to this mode
+ * for good. Any padding bits in the last byte are dropped by the
+ * controller when chip select rises.
+ *
+ * Reads, as done by inky_spidev_cmd_read(), need the 4-wire DC line and
+ * fail with INKY_E_NOT_CONFIGURED in 3-wire mode.
+ * @{
+ */
+
+/** @brief Select how D/C is sent
+ *
+ * Call before the first update. The DC line passed to
+ * inky_spidev_init() is not requested in 3-wire mode.
+ *
+ *  @param intf_ptr Initialized interface
+ *  @param mode INKY_SPIDEV_WIRE_3 to use 9 bit words where the SPI
+ *  controller can, INKY_SPIDEV_WIRE_3_PACKED to always pack them
+ */
+int8_t inky_spidev_wire_config(inky_spidev_intf *intf_ptr,
+			       inky_spidev_wire_mode mode);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup inkyspidevidle Idle power management
+ * @{
+ */
+
+/** @brief Put the controller to sleep when it has been idle
+ *
+ * Starts a thread that, once no hardware access has happened for
+ * timeout_ms, puts the controller in deep sleep, closes the spidev
+ * file descriptor and releases the GPIO lines. The next access
+ * through any callback or inky_spidev_fb_present() reopens them, and
+ * the next present re-runs the reset and setup sequence with a short
+ * reset pulse. While enabled, inky_spidev_fb_present() leaves the
+ * controller awake and configured between frames.
+ *
+ * Enable and disable before the interface is shared with other
+ * threads, and never while holding inky_spidev_lock().
+ *
+ *  @param intf_ptr Initialized interface
+ *  @param timeout_ms Idle time before sleeping
+ */
+int8_t inky_spidev_idle_enable(inky_spidev_intf *intf_ptr,
+			       uint32_t timeout_ms);
+
+/** @brief Stop the idle manager. Resources stay in their current state */
+int8_t inky_spidev_idle_disable(inky_spidev_intf *intf_ptr);
+
+/** @brief Enter deep sleep and release resources immediately */
+int8_t inky_spidev_idle_sleep_now(inky_spidev_intf *intf_ptr);
+
 /**
  * @}
  */
@@ -0,0 +1,268 @@
+#include <inky-spidev-async.h>
+#include <inky-spidev-fb.h>
+#include <inky-spidev-seq.h>
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+static void *lane_worker(void *arg);
+
+static int8_t run_job(inky_spidev_job *job);
+
+/*
+**********************************************************************
+******************* ASYNC IMPLEMENTATION *****************************
+**********************************************************************
+*/
+
+int8_t inky_spidev_async_init(inky_spidev_async *ctx)
+{
+	if (!ctx) {
+		return INKY_E_NULL_PTR;
+	}
+
+	ctx->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	if (ctx->event_fd < 0) {
+		return INKY_E_FAILURE;
+	}
+
+	pthread_mutex_init(&ctx->lock, NULL);
+	pthread_cond_init(&ctx->cond, NULL);
+	ctx->nlanes = 0;
+	ctx->done_head = NULL;
+	ctx->done_tail = NULL;
+	ctx->inflight = 0;
+	ctx->stop = false;
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_async_add(inky_spidev_async *ctx,
+			     inky_spidev_intf *intf_ptr)
+{
+	inky_spidev_async_lane *lane;
+	int8_t rst = INKY_OK;
+
+	if (!ctx || !intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+
+	if (ctx->nlanes == INKY_SPIDEV_ASYNC_LANES) {
+		pthread_mutex_unlock(&ctx->lock);
+		return INKY_E_OUT_OF_RANGE;
+	}
+
+	lane = &ctx->lanes[ctx->nlanes];
+	lane->intf = intf_ptr;
+	lane->head = NULL;
+	lane->tail = NULL;
+	lane->ctx = ctx;
+
+	if (pthread_create(&lane->thread, NULL, lane_worker, lane) != 0) {
+		rst = INKY_E_FAILURE;
+	} else {
+		++ctx->nlanes;
+	}
+
+	pthread_mutex_unlock(&ctx->lock);
+
+	return rst;
+}
+
+int8_t inky_spidev_async_submit(inky_spidev_async *ctx,
+				inky_spidev_job *job)
+{
+	inky_spidev_async_lane *lane = NULL;
+
+	if (!ctx || !job) {
+		return INKY_E_NULL_PTR;
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+
+	for (unsigned int i = 0; i < ctx->nlanes; ++i) {
+		if (ctx->lanes[i].intf == job->intf) {
+			lane = &ctx->lanes[i];
+			break;
+		}
+	}
+
+	if (!lane) {
+		pthread_mutex_unlock(&ctx->lock);
+		return INKY_E_NOT_CONFIGURED;
+	}
+
+	job->next = NULL;
+
+	if (lane->tail) {
+		lane->tail->next = job;
+	} else {
+		lane->head = job;
+	}
+
+	lane->tail = job;
+	++ctx->inflight;
+
+	pthread_cond_broadcast(&ctx->cond);
+	pthread_mutex_unlock(&ctx->lock);
+
+	return INKY_OK;
+}
+
+int inky_spidev_async_fd(const inky_spidev_async *ctx)
+{
+	return ctx->event_fd;
+}
+
+int inky_spidev_async_reap(inky_spidev_async *ctx, bool wait)
+{
+	inky_spidev_job *done;
+	uint64_t count;
+	int n = 0;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	while (wait && !ctx->done_head && ctx->inflight > 0) {
+		pthread_cond_wait(&ctx->cond, &ctx->lock);
+	}
+
+	done = ctx->done_head;
+	ctx->done_head = NULL;
+	ctx->done_tail = NULL;
+
+	/* Drain the counter while holding the lock so a completion
+	 * posted after this point re-arms it */
+	if (read(ctx->event_fd, &count, sizeof(count)) < 0) {
+		count = 0;
+	}
+
+	pthread_mutex_unlock(&ctx->lock);
+
+	/* Callbacks run unlocked so they may submit follow-up jobs */
+	while (done) {
+		inky_spidev_job *next = done->next;
+
+		if (done->done_cb) {
+			done->done_cb(done, done->user);
+		}
+
+		done = next;
+		++n;
+	}
+
+	return n;
+}
+
+int8_t inky_spidev_async_deinit(inky_spidev_async *ctx)
+{
+	if (!ctx) {
+		return INKY_E_NULL_PTR;
+	}
+
+	/* Reaping with wait only returns 0 once nothing is in flight */
+	while (inky_spidev_async_reap(ctx, true) > 0) {
+		continue;
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+	ctx->stop = true;
+	pthread_cond_broadcast(&ctx->cond);
+	pthread_mutex_unlock(&ctx->lock);
+
+	for (unsigned int i = 0; i < ctx->nlanes; ++i) {
+		pthread_join(ctx->lanes[i].thread, NULL);
+	}
+
+	close(ctx->event_fd);
+	pthread_cond_destroy(&ctx->cond);
+	pthread_mutex_destroy(&ctx->lock);
+
+	return INKY_OK;
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+static void *lane_worker(void *arg)
+{
+	inky_spidev_async_lane *lane = (inky_spidev_async_lane*) arg;
+	inky_spidev_async *ctx = lane->ctx;
+	const uint64_t one = 1;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	for (;;) {
+		inky_spidev_job *job;
+
+		while (!lane->head && !ctx->stop) {
+			pthread_cond_wait(&ctx->cond, &ctx->lock);
+		}
+
+		if (!lane->head) {
+			break;
+		}
+
+		job = lane->head;
+		lane->head = job->next;
+
+		if (!lane->head) {
+			lane->tail = NULL;
+		}
+
+		pthread_mutex_unlock(&ctx->lock);
+
+		job->result = run_job(job);
+
+		pthread_mutex_lock(&ctx->lock);
+
+		job->next = NULL;
+
+		if (ctx->done_tail) {
+			ctx->done_tail->next = job;
+		} else {
+			ctx->done_head = job;
+		}
+
+		ctx->done_tail = job;
+		--ctx->inflight;
+
+		if (write(ctx->event_fd, &one, sizeof(one)) < 0) {
+			/* Counter saturated; the reader is behind but
+			 * will still see a readable fd */
+		}
+
+		pthread_cond_broadcast(&ctx->cond);
+	}
+
+	pthread_mutex_unlock(&ctx->lock);
+
+	return NULL;
+}
+
+static int8_t run_job(inky_spidev_job *job)
+{
+	inky_config *dev = &job->intf->dev;
+
+	switch (job->type) {
+	case INKY_SPIDEV_JOB_PRESENT:
+		return inky_spidev_fb_present(job->intf,
+					      (const inky_spidev_fb*) job->arg);
+	case INKY_SPIDEV_JOB_REPLAY:
+		return inky_spidev_seq_replay(job->intf,
+					      (const inky_spidev_seq*) job->arg);
+	case INKY_SPIDEV_JOB_WRITE:
+		return dev->spi_write_cb((const uint8_t*) job->arg, job->len,
+					 dev->intf_ptr);
+	case INKY_SPIDEV_JOB_WAIT_BUSY:
+		return dev->gpio_poll_cb(INKY_PIN_BUSY, job->timeout,
+					 dev->intf_ptr);
+	}
+
+	return INKY_E_NOT_CONFIGURED;
+}
@@ -0,0 +1,33 @@
+/**
+ * @file inky-spidev-bus-arb.h
+ *
+ * Internal hooks used by the hardware access bracket to hold and hand
+ * over a shared SPI bus. All of them are called with the interface
+ * lock held and do nothing when no bus is attached.
+ */
+
+#ifndef INKY_SPIDEV_BUS_ARB_H
+#define INKY_SPIDEV_BUS_ARB_H
+
+#include <inky-spidev-bus.h>
+
+#include <stdbool.h>
+
+/** @brief Take the bus on the outermost hardware access */
+inky_error_state inky_spidev_bus_enter(inky_spidev_intf *iptr);
+
+/** @brief Give the bus back when the outermost access ends */
+void inky_spidev_bus_leave(inky_spidev_intf *iptr);
+
+/** @brief Let other panels use the bus during a wait
+ *  @return true if the bus was released and must be resumed
+ */
+bool inky_spidev_bus_yield(inky_spidev_intf *iptr);
+
+/** @brief Take the bus back after inky_spidev_bus_yield()
+ *  @param yielded Return value of the matching yield
+ */
+inky_error_state inky_spidev_bus_resume(inky_spidev_intf *iptr,
+					bool yielded);
+
+#endif /* #ifndef INKY_SPIDEV_BUS_ARB_H */
@@ -0,0 +1,290 @@
+#include <inky-spidev-bus.h>
+
+#include "inky-spidev-bus-arb.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+static int bus_lock_path(const char *spidev, char *path, size_t len);
+
+static inky_error_state bus_acquire(inky_spidev_bus *bus);
+
+static void bus_release(inky_spidev_bus *bus);
+
+static uint64_t bus_now_us(void);
+
+/*
+**********************************************************************
+****************** BUS ARBITRATION IMPLEMENTATION ********************
+**********************************************************************
+*/
+
+int8_t inky_spidev_bus_init(inky_spidev_bus *bus, const char *spidev)
+{
+	if (!bus) {
+		return INKY_E_NULL_PTR;
+	}
+
+	memset(bus, 0, sizeof(*bus));
+	bus->fd = -1;
+
+	if (spidev) {
+		if (bus_lock_path(spidev, bus->path, sizeof(bus->path)) < 0) {
+			return INKY_E_OUT_OF_RANGE;
+		}
+
+		bus->fd = open(bus->path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+
+		if (bus->fd < 0) {
+			return errno == EACCES ? INKY_E_BAD_PERMISSIONS
+				: INKY_E_FAILURE;
+		}
+	}
+
+	pthread_mutex_init(&bus->lock, NULL);
+	pthread_cond_init(&bus->cond, NULL);
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_bus_attach(inky_spidev_intf *intf_ptr,
+			      inky_spidev_bus *bus)
+{
+	if (!intf_ptr || !bus) {
+		return INKY_E_NULL_PTR;
+	}
+
+	inky_spidev_bus_detach(intf_ptr);
+
+	pthread_mutex_lock(&bus->lock);
+	++bus->users;
+	pthread_mutex_unlock(&bus->lock);
+
+	inky_spidev_lock(intf_ptr);
+	intf_ptr->bus = bus;
+	intf_ptr->bus_depth = 0;
+	intf_ptr->bus_yielded = false;
+	inky_spidev_unlock(intf_ptr);
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_bus_detach(inky_spidev_intf *intf_ptr)
+{
+	inky_spidev_bus *bus;
+
+	if (!intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	inky_spidev_lock(intf_ptr);
+
+	bus = intf_ptr->bus;
+
+	/* Detaching from inside a hardware access would leave the bus
+	 * held by nobody */
+	if (bus && intf_ptr->bus_depth > 0) {
+		inky_spidev_unlock(intf_ptr);
+		return INKY_E_FAILURE;
+	}
+
+	intf_ptr->bus = NULL;
+
+	inky_spidev_unlock(intf_ptr);
+
+	if (bus) {
+		pthread_mutex_lock(&bus->lock);
+		--bus->users;
+		pthread_mutex_unlock(&bus->lock);
+	}
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_bus_deinit(inky_spidev_bus *bus)
+{
+	if (!bus) {
+		return INKY_E_NULL_PTR;
+	}
+
+	if (bus->users > 0) {
+		return INKY_E_FAILURE;
+	}
+
+	if (bus->fd >= 0) {
+		close(bus->fd);
+		bus->fd = -1;
+	}
+
+	pthread_cond_destroy(&bus->cond);
+	pthread_mutex_destroy(&bus->lock);
+
+	return INKY_OK;
+}
+
+inky_error_state inky_spidev_bus_enter(inky_spidev_intf *iptr)
+{
+	inky_error_state rst;
+
+	/* Nested accesses, including those made while yielded, ride on
+	 * the outermost one */
+	if (!iptr->bus || iptr->bus_depth++ > 0) {
+		return INKY_OK;
+	}
+
+	rst = bus_acquire(iptr->bus);
+
+	if (rst != INKY_OK) {
+		iptr->bus_depth = 0;
+	}
+
+	return rst;
+}
+
+void inky_spidev_bus_leave(inky_spidev_intf *iptr)
+{
+	if (!iptr->bus || iptr->bus_depth == 0 || --iptr->bus_depth > 0) {
+		return;
+	}
+
+	if (!iptr->bus_yielded) {
+		bus_release(iptr->bus);
+	}
+
+	iptr->bus_yielded = false;
+}
+
+bool inky_spidev_bus_yield(inky_spidev_intf *iptr)
+{
+	if (!iptr->bus || iptr->bus_depth == 0 || iptr->bus_yielded) {
+		return false;
+	}
+
+	bus_release(iptr->bus);
+	iptr->bus_yielded = true;
+
+	return true;
+}
+
+inky_error_state inky_spidev_bus_resume(inky_spidev_intf *iptr,
+					bool yielded)
+{
+	inky_error_state rst;
+
+	if (!yielded) {
+		return INKY_OK;
+	}
+
+	/* On failure stay yielded so the outermost leave doesn't release
+	 * a bus this panel no longer holds */
+	rst = bus_acquire(iptr->bus);
+
+	if (rst == INKY_OK) {
+		iptr->bus_yielded = false;
+	}
+
+	return rst;
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+static int bus_lock_path(const char *spidev, char *path, size_t len)
+{
+	const char *name = strrchr(spidev, '/');
+	size_t n;
+
+	name = name ? name + 1 : spidev;
+
+	if (strncmp(name, "spidev", 6) != 0) {
+		return -1;
+	}
+
+	/* Keep the bus number, drop the chip select */
+	for (n = 6; isdigit((unsigned char) name[n]); ++n)
+		;
+
+	if (n == 6) {
+		return -1;
+	}
+
+	return snprintf(path, len, "%s/inky-%.*s.lock",
+			INKY_SPIDEV_BUS_LOCK_DIR, (int) n, name)
+		< (int) len ? 0 : -1;
+}
+
+static inky_error_state bus_acquire(inky_spidev_bus *bus)
+{
+	unsigned long ticket;
+	uint64_t start = 0;
+
+	pthread_mutex_lock(&bus->lock);
+
+	/* Tickets hand the bus out in request order, so a panel that
+	 * keeps refreshing can't starve the others in this process */
+	ticket = bus->next++;
+
+	if (ticket != bus->serving) {
+		++bus->contended;
+		start = bus_now_us();
+
+		while (ticket != bus->serving) {
+			pthread_cond_wait(&bus->cond, &bus->lock);
+		}
+
+		bus->wait_us += bus_now_us() - start;
+	}
+
+	++bus->acquired;
+
+	pthread_mutex_unlock(&bus->lock);
+
+	if (bus->fd < 0) {
+		return INKY_OK;
+	}
+
+	start = bus_now_us();
+
+	while (flock(bus->fd, LOCK_EX) < 0) {
+		if (errno != EINTR) {
+			bus_release(bus);
+			return INKY_E_FAILURE;
+		}
+	}
+
+	pthread_mutex_lock(&bus->lock);
+	bus->wait_us += bus_now_us() - start;
+	pthread_mutex_unlock(&bus->lock);
+
+	return INKY_OK;
+}
+
+static void bus_release(inky_spidev_bus *bus)
+{
+	if (bus->fd >= 0) {
+		flock(bus->fd, LOCK_UN);
+	}
+
+	pthread_mutex_lock(&bus->lock);
+	++bus->serving;
+	pthread_cond_broadcast(&bus->cond);
+	pthread_mutex_unlock(&bus->lock);
+}
+
+static uint64_t bus_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
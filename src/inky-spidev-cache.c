@@ -0,0 +1,151 @@
+#include <inky-spidev-cache.h>
+
+#include "inky-spidev-hash.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int8_t cache_path(const inky_spidev_cache *cache,
+			 const inky_spidev_frame_tag *key, char *path,
+			 size_t len);
+
+/*
+**********************************************************************
+******************* FRAME CACHE IMPLEMENTATION ***********************
+**********************************************************************
+*/
+
+int8_t inky_spidev_cache_init(inky_spidev_cache *cache, const char *dir,
+			      uint8_t panel, inky_spidev_frame_color color)
+{
+	if (!cache || !dir) {
+		return INKY_E_NULL_PTR;
+	}
+
+	if (strlen(dir) >= INKY_SPIDEV_PATH_LEN - 48) {
+		return INKY_E_OUT_OF_RANGE;
+	}
+
+	memset(cache, 0, sizeof(*cache));
+	strcpy(cache->dir, dir);
+	cache->panel = panel;
+	cache->color = color;
+
+	return INKY_OK;
+}
+
+void inky_spidev_cache_key(const uint8_t *pixels, uint16_t width,
+			   uint16_t height, uint32_t stride,
+			   const inky_spidev_pack_cfg *cfg,
+			   inky_spidev_frame_tag *key)
+{
+	uint32_t row = (uint32_t) width
+		* (cfg->format == INKY_SPIDEV_PIX_RGB888 ? 3 : 1);
+	const uint8_t params[] = {
+		(uint8_t) cfg->format, (uint8_t) cfg->rotation,
+		cfg->mirror, cfg->threshold, cfg->color,
+		(uint8_t) width, (uint8_t) (width >> 8),
+		(uint8_t) height, (uint8_t) (height >> 8)
+	};
+	inky_spidev_sha256 ctx;
+	uint8_t digest[INKY_SPIDEV_SHA256_LEN];
+
+	inky_spidev_sha256_init(&ctx);
+	inky_spidev_sha256_update(&ctx, params, sizeof(params));
+
+	for (uint16_t y = 0; y < height; ++y) {
+		inky_spidev_sha256_update(&ctx, pixels + (size_t) y * stride,
+					  row);
+	}
+
+	inky_spidev_sha256_final(&ctx, digest);
+	memcpy(key->bytes, digest, sizeof(key->bytes));
+}
+
+int8_t inky_spidev_cache_pack(inky_spidev_cache *cache,
+			      inky_spidev_frame *frame,
+			      const uint8_t *pixels, uint16_t width,
+			      uint16_t height, uint32_t stride,
+			      const inky_spidev_pack_cfg *cfg)
+{
+	int8_t rst;
+	bool quarter;
+	bool stored;
+	inky_spidev_frame_tag key;
+	char path[INKY_SPIDEV_PATH_LEN];
+
+	if (!cache || !frame || !pixels || !cfg) {
+		return INKY_E_NULL_PTR;
+	}
+
+	memset(frame, 0, sizeof(*frame));
+
+	quarter = cfg->rotation == INKY_SPIDEV_ROTATE_90
+		|| cfg->rotation == INKY_SPIDEV_ROTATE_270;
+
+	inky_spidev_cache_key(pixels, width, height, stride, cfg, &key);
+	stored = cache_path(cache, &key, path, sizeof(path)) == INKY_OK;
+
+	/* The name is only a hint, the header has the final say */
+	if (stored && inky_spidev_frame_open(frame, path, false) == INKY_OK) {
+		if (memcmp(&frame->tag, &key, sizeof(key)) == 0
+		    && frame->panel == cache->panel
+		    && frame->color == cache->color
+		    && frame->fb.width == (quarter ? height : width)
+		    && frame->fb.height == (quarter ? width : height)) {
+			++cache->hits;
+			return INKY_OK;
+		}
+
+		inky_spidev_frame_release(frame);
+	}
+
+	++cache->misses;
+
+	rst = inky_spidev_fb_init(&frame->fb, quarter ? height : width,
+				  quarter ? width : height);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	rst = inky_spidev_fb_pack(&frame->fb, pixels, width, height, stride,
+				  cfg);
+	if (rst != INKY_OK) {
+		inky_spidev_fb_free(&frame->fb);
+		return rst;
+	}
+
+	/* Planes are stored raw so a hit maps them in place. A read-only
+	 * cache directory only costs the next conversion */
+	if (stored) {
+		inky_spidev_frame_write(path, &frame->fb, cache->panel,
+					cache->color, &key, false);
+	}
+
+	return INKY_OK;
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+static int8_t cache_path(const inky_spidev_cache *cache,
+			 const inky_spidev_frame_tag *key, char *path,
+			 size_t len)
+{
+	char hex[2 * INKY_SPIDEV_FRAME_TAG_LEN + 1];
+	int n;
+
+	for (int i = 0; i < INKY_SPIDEV_FRAME_TAG_LEN; ++i) {
+		snprintf(hex + 2 * i, 3, "%02x", key->bytes[i]);
+	}
+
+	n = snprintf(path, len, "%s/frame-%s.bin", cache->dir, hex);
+	if (n < 0 || (size_t) n >= len) {
+		return INKY_E_OUT_OF_RANGE;
+	}
+
+	return INKY_OK;
+}
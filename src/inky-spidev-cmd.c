@@ -0,0 +1,317 @@
+#include "inky-spidev-cmd.h"
+#include "inky-spidev-idle.h"
+#include "inky-spidev-wire.h"
+
+static inky_error_state set_dc(inky_spidev_intf *iptr, inky_pin_state s);
+
+/*
+**********************************************************************
+******************* COMMAND LAYER IMPLEMENTATION *********************
+**********************************************************************
+*/
+
+inky_error_state inky_spidev_cmd(inky_spidev_intf *iptr, uint8_t cmd,
+				 const uint8_t *data, uint32_t len)
+{
+	inky_error_state rst;
+	inky_config *dev = &iptr->dev;
+
+	rst = set_dc(iptr, INKY_PINSTATE_LOW);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	rst = dev->spi_write_cb(&cmd, 1, dev->intf_ptr);
+	if (rst != INKY_OK || len == 0) {
+		return rst;
+	}
+
+	rst = set_dc(iptr, INKY_PINSTATE_HIGH);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	return dev->spi_write_cb(data, len, dev->intf_ptr);
+}
+
+inky_error_state inky_spidev_cmd_read(inky_spidev_intf *iptr, uint8_t cmd,
+				      uint8_t *buf, uint32_t len)
+{
+	inky_error_state rst;
+	struct spi_ioc_transfer tr = {
+		.rx_buf = (unsigned long) buf,
+		.len = len,
+		.speed_hz = INKY_SPI_SPEED_HZ_MAX,
+		.bits_per_word = 8
+	};
+
+	/* Hold the bus so the command and its answer stay together */
+	rst = inky_spidev_hw_begin(iptr);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	/* Reading needs DC high on its own line while clocking in */
+	if (inky_spidev_wire_3(iptr)) {
+		rst = INKY_E_NOT_CONFIGURED;
+	} else {
+		rst = inky_spidev_cmd(iptr, cmd, NULL, 0);
+	}
+
+	if (rst == INKY_OK) {
+		rst = set_dc(iptr, INKY_PINSTATE_HIGH);
+	}
+
+	if (rst == INKY_OK) {
+		rst = iptr->transport->spi_transfer(iptr, &tr, 1);
+	}
+
+	inky_spidev_hw_end(iptr);
+
+	return rst;
+}
+
+inky_error_state inky_spidev_cmd_reset(inky_spidev_intf *iptr,
+				       uint32_t pulse_us)
+{
+	inky_error_state rst;
+	inky_config *dev = &iptr->dev;
+
+	rst = dev->gpio_output_cb(INKY_PIN_RESET, INKY_PINSTATE_LOW,
+				  dev->intf_ptr);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	dev->delay_us_cb(pulse_us, dev->intf_ptr);
+
+	rst = dev->gpio_output_cb(INKY_PIN_RESET, INKY_PINSTATE_HIGH,
+				  dev->intf_ptr);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	dev->delay_us_cb(pulse_us, dev->intf_ptr);
+
+	rst = inky_spidev_cmd(iptr, INKY_CMD_SW_RESET, NULL, 0);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	return dev->gpio_poll_cb(INKY_PIN_BUSY, INKY_CMD_RESET_TIMEOUT_US,
+				 dev->intf_ptr);
+}
+
+inky_error_state inky_spidev_cmd_setup(inky_spidev_intf *iptr,
+				       uint16_t width, uint16_t height)
+{
+	inky_error_state rst;
+	uint8_t src_voltage[3] = {0x41, 0xac, 0x32};
+	const uint8_t xrange[2] = {0x00, (uint8_t) ((width + 7) / 8 - 1)};
+	const uint8_t yrange[4] = {0x00, 0x00, (uint8_t) (height & 0xff),
+		(uint8_t) (height >> 8)};
+	const uint8_t gate[3] = {(uint8_t) (height & 0xff),
+		(uint8_t) (height >> 8), 0x00};
+
+	/* Voltages taken from the vendor's reference driver */
+	if (iptr->color_cfg.yellow) {
+		src_voltage[0] = 0x07;
+	} else if (iptr->color_cfg.red && width == 400 && height == 300) {
+		src_voltage[0] = 0x30;
+		src_voltage[2] = 0x22;
+	}
+
+	const struct {
+		uint8_t cmd;
+		const uint8_t *data;
+		uint32_t len;
+	} seq[] = {
+		{INKY_CMD_ANALOG_BLOCK, (const uint8_t[]) {0x54}, 1},
+		{INKY_CMD_DIGITAL_BLOCK, (const uint8_t[]) {0x3b}, 1},
+		{INKY_CMD_DRIVER_OUTPUT, gate, 3},
+		{INKY_CMD_GATE_VOLTAGE, (const uint8_t[]) {0x17}, 1},
+		{INKY_CMD_SOURCE_VOLTAGE, src_voltage, 3},
+		{INKY_CMD_DUMMY_LINE, (const uint8_t[]) {0x07}, 1},
+		{INKY_CMD_GATE_LINE, (const uint8_t[]) {0x04}, 1},
+		{INKY_CMD_DATA_ENTRY, (const uint8_t[]) {0x03}, 1},
+		{INKY_CMD_VCOM, (const uint8_t[]) {0x3c}, 1},
+		{INKY_CMD_BORDER, (const uint8_t[]) {0x00}, 1},
+		{INKY_CMD_RAM_X_RANGE, xrange, 2},
+		{INKY_CMD_RAM_Y_RANGE, yrange, 4}
+	};
+
+	for (size_t i = 0; i < sizeof(seq) / sizeof(seq[0]); ++i) {
+		rst = inky_spidev_cmd(iptr, seq[i].cmd, seq[i].data,
+				      seq[i].len);
+		if (rst != INKY_OK) {
+			return rst;
+		}
+	}
+
+	return INKY_OK;
+}
+
+inky_error_state inky_spidev_cmd_write_plane(inky_spidev_intf *iptr,
+					     uint8_t ram_cmd,
+					     const uint8_t *buf,
+					     uint32_t len)
+{
+	inky_error_state rst;
+	const uint8_t xstart = 0x00;
+	const uint8_t ystart[2] = {0x00, 0x00};
+
+	rst = inky_spidev_cmd(iptr, INKY_CMD_RAM_X_COUNTER, &xstart, 1);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	rst = inky_spidev_cmd(iptr, INKY_CMD_RAM_Y_COUNTER, ystart, 2);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	return inky_spidev_cmd(iptr, ram_cmd, buf, len);
+}
+
+inky_error_state inky_spidev_cmd_fill_plane(inky_spidev_intf *iptr,
+					    uint8_t ram_cmd, uint8_t value)
+{
+	inky_error_state rst;
+	inky_config *dev = &iptr->dev;
+	const uint8_t cmd = ram_cmd == INKY_CMD_WRITE_RAM_BW ?
+		INKY_CMD_FILL_RAM_BW : INKY_CMD_FILL_RAM_COLOR;
+	/* Bit 7 is the first step's value, the rest pick the largest step
+	 * height and width so the first step spans the RAM window */
+	const uint8_t pattern = (value ? 0x80 : 0x00) | 0x77;
+
+	rst = inky_spidev_cmd(iptr, cmd, &pattern, 1);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	return dev->gpio_poll_cb(INKY_PIN_BUSY, INKY_CMD_RESET_TIMEOUT_US,
+				 dev->intf_ptr);
+}
+
+inky_error_state inky_spidev_cmd_refresh(inky_spidev_intf *iptr,
+					 uint8_t seq, uint32_t timeout_us)
+{
+	inky_error_state rst;
+	inky_config *dev = &iptr->dev;
+
+	rst = inky_spidev_cmd(iptr, INKY_CMD_UPDATE_CONTROL, &seq, 1);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	rst = inky_spidev_cmd(iptr, INKY_CMD_MASTER_ACTIVATE, NULL, 0);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	dev->delay_us_cb(INKY_CMD_ACTIVATE_US, dev->intf_ptr);
+
+	return dev->gpio_poll_cb(INKY_PIN_BUSY, timeout_us, dev->intf_ptr);
+}
+
+inky_error_state inky_spidev_cmd_load_temp(inky_spidev_intf *iptr)
+{
+	inky_error_state rst;
+	inky_config *dev = &iptr->dev;
+	const uint8_t sensor = INKY_TEMP_SENSOR_INTERNAL;
+	const uint8_t seq = INKY_UPDATE_SEQ_LOAD_TEMP;
+
+	rst = inky_spidev_cmd(iptr, INKY_CMD_TEMP_SENSOR, &sensor, 1);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	rst = inky_spidev_cmd(iptr, INKY_CMD_UPDATE_CONTROL, &seq, 1);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	rst = inky_spidev_cmd(iptr, INKY_CMD_MASTER_ACTIVATE, NULL, 0);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	return dev->gpio_poll_cb(INKY_PIN_BUSY, INKY_CMD_RESET_TIMEOUT_US,
+				 dev->intf_ptr);
+}
+
+inky_error_state inky_spidev_cmd_load_lut(inky_spidev_intf *iptr,
+					  int16_t temp)
+{
+	inky_error_state rst;
+	inky_config *dev = &iptr->dev;
+	const uint8_t seq = INKY_UPDATE_SEQ_LOAD_LUT;
+	int16_t sixteenths = temp * 16 / 10;
+	const uint8_t reg[2] = {
+		(uint8_t) (sixteenths >> 4),
+		(uint8_t) ((sixteenths & 0x0f) << 4)
+	};
+
+	rst = inky_spidev_cmd(iptr, INKY_CMD_TEMP_WRITE, reg, 2);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	rst = inky_spidev_cmd(iptr, INKY_CMD_UPDATE_CONTROL, &seq, 1);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	rst = inky_spidev_cmd(iptr, INKY_CMD_MASTER_ACTIVATE, NULL, 0);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	return dev->gpio_poll_cb(INKY_PIN_BUSY, INKY_CMD_RESET_TIMEOUT_US,
+				 dev->intf_ptr);
+}
+
+inky_error_state inky_spidev_cmd_read_temp(inky_spidev_intf *iptr,
+					   int16_t *temp)
+{
+	inky_error_state rst;
+	uint8_t raw[2];
+	int16_t sixteenths;
+
+	rst = inky_spidev_cmd_read(iptr, INKY_CMD_TEMP_READ, raw, 2);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	/* A floating or unconnected line reads all zeros or all ones */
+	if ((raw[0] == 0x00 && raw[1] == 0x00)
+	    || (raw[0] == 0xff && raw[1] == 0xff)) {
+		return INKY_E_NOT_CONFIGURED;
+	}
+
+	/* 12 bit two's complement in 1/16 C, left aligned */
+	sixteenths = (int16_t) ((raw[0] << 8) | raw[1]) >> 4;
+	*temp = sixteenths * 10 / 16;
+
+	return INKY_OK;
+}
+
+inky_error_state inky_spidev_cmd_sleep(inky_spidev_intf *iptr)
+{
+	const uint8_t mode = 0x01;
+
+	return inky_spidev_cmd(iptr, INKY_CMD_DEEP_SLEEP, &mode, 1);
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+static inky_error_state set_dc(inky_spidev_intf *iptr, inky_pin_state s)
+{
+	inky_config *dev = &iptr->dev;
+
+	return dev->gpio_output_cb(INKY_PIN_DC, s, dev->intf_ptr);
+}
@@ -0,0 +1,138 @@
+/**
+ * @file inky-spidev-cmd.h
+ *
+ * Internal controller command layer used by the userspace driver when
+ * it talks to the panel directly instead of through the Inky driver.
+ */
+
+#ifndef INKY_SPIDEV_CMD_H
+#define INKY_SPIDEV_CMD_H
+
+#include <inky-spidev.h>
+
+#include <stdint.h>
+
+/* Controller commands (SSD1683 family used on the Inky wHAT) */
+#define INKY_CMD_DRIVER_OUTPUT 0x01
+#define INKY_CMD_GATE_VOLTAGE 0x03
+#define INKY_CMD_SOURCE_VOLTAGE 0x04
+#define INKY_CMD_DEEP_SLEEP 0x10
+#define INKY_CMD_DATA_ENTRY 0x11
+#define INKY_CMD_SW_RESET 0x12
+#define INKY_CMD_TEMP_SENSOR 0x18
+#define INKY_CMD_TEMP_WRITE 0x1a
+#define INKY_CMD_TEMP_READ 0x1b
+#define INKY_CMD_MASTER_ACTIVATE 0x20
+#define INKY_CMD_UPDATE_CONTROL 0x22
+#define INKY_CMD_WRITE_RAM_BW 0x24
+#define INKY_CMD_WRITE_RAM_COLOR 0x26
+#define INKY_CMD_VCOM 0x2c
+#define INKY_CMD_DUMMY_LINE 0x3a
+#define INKY_CMD_GATE_LINE 0x3b
+#define INKY_CMD_BORDER 0x3c
+#define INKY_CMD_RAM_X_RANGE 0x44
+#define INKY_CMD_RAM_Y_RANGE 0x45
+#define INKY_CMD_FILL_RAM_COLOR 0x46
+#define INKY_CMD_FILL_RAM_BW 0x47
+#define INKY_CMD_RAM_X_COUNTER 0x4e
+#define INKY_CMD_RAM_Y_COUNTER 0x4f
+#define INKY_CMD_ANALOG_BLOCK 0x74
+#define INKY_CMD_DIGITAL_BLOCK 0x7e
+
+/* Update sequence: clock on, analog on, load temperature and LUT
+ * from OTP, display mode 1, analog off, clock off */
+#define INKY_UPDATE_SEQ_FULL 0xf7
+
+/* Update sequence: clock on, load temperature, load LUT, clock off */
+#define INKY_UPDATE_SEQ_LOAD_TEMP 0xb1
+
+/* Update sequence: clock on, load LUT for the temperature register,
+ * clock off */
+#define INKY_UPDATE_SEQ_LOAD_LUT 0x91
+
+/* Update sequence: as INKY_UPDATE_SEQ_FULL with the LUT already
+ * loaded */
+#define INKY_UPDATE_SEQ_DISPLAY 0xc7
+
+/* Temperature sensor selection */
+#define INKY_TEMP_SENSOR_INTERNAL 0x80
+
+/* Timing (microseconds) */
+#define INKY_CMD_RESET_US 100000
+#define INKY_CMD_ACTIVATE_US 50000
+#define INKY_CMD_RESET_TIMEOUT_US 5000000
+#define INKY_CMD_REFRESH_TIMEOUT_US 40000000
+
+/** @brief Send a command byte followed by optional data bytes
+ *  @param iptr Interface pointer
+ *  @param cmd Command byte, sent with DC low
+ *  @param data Data bytes, sent with DC high. May be NULL if len is 0
+ *  @param len Number of data bytes
+ */
+inky_error_state inky_spidev_cmd(inky_spidev_intf *iptr, uint8_t cmd,
+				 const uint8_t *data, uint32_t len);
+
+/** @brief Send a command byte and read back len bytes
+ *
+ * Needs the controller's SDA line readable by the SPI controller.
+ */
+inky_error_state inky_spidev_cmd_read(inky_spidev_intf *iptr, uint8_t cmd,
+				      uint8_t *buf, uint32_t len);
+
+/** @brief Pulse the reset line and issue a soft reset
+ *  @param pulse_us Time to hold reset low and to wait after release
+ */
+inky_error_state inky_spidev_cmd_reset(inky_spidev_intf *iptr,
+				       uint32_t pulse_us);
+
+/** @brief Program panel registers and RAM window for width x height */
+inky_error_state inky_spidev_cmd_setup(inky_spidev_intf *iptr,
+				       uint16_t width, uint16_t height);
+
+/** @brief Write one bit plane to controller RAM
+ *  @param ram_cmd INKY_CMD_WRITE_RAM_BW or INKY_CMD_WRITE_RAM_COLOR
+ */
+inky_error_state inky_spidev_cmd_write_plane(inky_spidev_intf *iptr,
+					     uint8_t ram_cmd,
+					     const uint8_t *buf,
+					     uint32_t len);
+
+/** @brief Set every byte of one bit plane in controller RAM
+ *
+ * Uses the controller's pattern fill with the largest step sizes,
+ * which cover the whole RAM window, so nothing is transferred.
+ *
+ *  @param ram_cmd INKY_CMD_WRITE_RAM_BW or INKY_CMD_WRITE_RAM_COLOR
+ *  @param value 0x00 or 0xff
+ */
+inky_error_state inky_spidev_cmd_fill_plane(inky_spidev_intf *iptr,
+					    uint8_t ram_cmd, uint8_t value);
+
+/** @brief Trigger a display refresh and wait for BUSY to release
+ *  @param seq INKY_UPDATE_SEQ_FULL, or INKY_UPDATE_SEQ_DISPLAY when a
+ *  LUT has been loaded
+ *  @param timeout_us Longest the refresh may take
+ */
+inky_error_state inky_spidev_cmd_refresh(inky_spidev_intf *iptr,
+					 uint8_t seq, uint32_t timeout_us);
+
+/** @brief Have the controller sample its internal temperature sensor */
+inky_error_state inky_spidev_cmd_load_temp(inky_spidev_intf *iptr);
+
+/** @brief Write the temperature register and load its LUT from OTP
+ *  @param temp Temperature in 0.1 C
+ */
+inky_error_state inky_spidev_cmd_load_lut(inky_spidev_intf *iptr,
+					  int16_t temp);
+
+/** @brief Read the temperature last loaded by the controller
+ *  @param temp Set to the temperature in 0.1 C
+ *  @return INKY_E_NOT_CONFIGURED if the line reads as floating
+ */
+inky_error_state inky_spidev_cmd_read_temp(inky_spidev_intf *iptr,
+					   int16_t *temp);
+
+/** @brief Put the controller in deep sleep (RAM retained) */
+inky_error_state inky_spidev_cmd_sleep(inky_spidev_intf *iptr);
+
+#endif /* #ifndef INKY_SPIDEV_CMD_H */
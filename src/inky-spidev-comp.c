@@ -0,0 +1,393 @@
+#include <inky-spidev-comp.h>
+
+#include <string.h>
+
+static bool rect_clip(const inky_spidev_comp *comp, inky_spidev_rect *r);
+
+static bool rect_touch(const inky_spidev_rect *a, const inky_spidev_rect *b);
+
+static void rect_union(inky_spidev_rect *a, const inky_spidev_rect *b);
+
+static long rect_area(const inky_spidev_rect *r);
+
+static uint8_t fetch8(const uint8_t *row, uint16_t stride, int bit);
+
+static uint8_t valid8(uint16_t width, int bit);
+
+static void render_rect(inky_spidev_comp *comp, inky_spidev_fb *dst,
+			const inky_spidev_rect *r);
+
+/*
+**********************************************************************
+******************* COMPOSITOR IMPLEMENTATION ************************
+**********************************************************************
+*/
+
+int8_t inky_spidev_comp_init(inky_spidev_comp *comp, uint16_t width,
+			     uint16_t height, const inky_spidev_pen *background)
+{
+	if (!comp || !background) {
+		return INKY_E_NULL_PTR;
+	}
+
+	comp->width = width;
+	comp->height = height;
+	comp->background = *background;
+	comp->nlayers = 0;
+	comp->ndirty = 0;
+
+	inky_spidev_comp_damage(comp, 0, 0, width, height);
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_layer_init(inky_spidev_layer *layer, int x, int y,
+			      uint16_t w, uint16_t h)
+{
+	int8_t rst;
+
+	if (!layer) {
+		return INKY_E_NULL_PTR;
+	}
+
+	rst = inky_spidev_fb_init(&layer->fb, w, h);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	/* A white mask plane is all ones, which is fully opaque */
+	rst = inky_spidev_fb_init(&layer->mask, w, h);
+	if (rst != INKY_OK) {
+		inky_spidev_fb_free(&layer->fb);
+		return rst;
+	}
+
+	layer->x = x;
+	layer->y = y;
+	layer->visible = true;
+	layer->comp = NULL;
+
+	return INKY_OK;
+}
+
+void inky_spidev_layer_free(inky_spidev_layer *layer)
+{
+	if (layer->comp) {
+		inky_spidev_comp_remove(layer->comp, layer);
+	}
+
+	inky_spidev_fb_free(&layer->fb);
+	inky_spidev_fb_free(&layer->mask);
+}
+
+int8_t inky_spidev_comp_add(inky_spidev_comp *comp, inky_spidev_layer *layer)
+{
+	if (!comp || !layer) {
+		return INKY_E_NULL_PTR;
+	}
+
+	if (layer->comp || comp->nlayers == INKY_SPIDEV_COMP_LAYERS) {
+		return INKY_E_OUT_OF_RANGE;
+	}
+
+	comp->layers[comp->nlayers++] = layer;
+	layer->comp = comp;
+
+	inky_spidev_layer_damage(layer, 0, 0, layer->fb.width,
+				 layer->fb.height);
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_comp_remove(inky_spidev_comp *comp,
+			       inky_spidev_layer *layer)
+{
+	if (!comp || !layer) {
+		return INKY_E_NULL_PTR;
+	}
+
+	for (uint8_t i = 0; i < comp->nlayers; ++i) {
+		if (comp->layers[i] != layer) {
+			continue;
+		}
+
+		inky_spidev_layer_damage(layer, 0, 0, layer->fb.width,
+					 layer->fb.height);
+
+		memmove(&comp->layers[i], &comp->layers[i + 1],
+			(comp->nlayers - i - 1) * sizeof(comp->layers[0]));
+		--comp->nlayers;
+		layer->comp = NULL;
+
+		return INKY_OK;
+	}
+
+	return INKY_E_NOT_CONFIGURED;
+}
+
+void inky_spidev_comp_damage(inky_spidev_comp *comp, int x, int y, int w,
+			     int h)
+{
+	inky_spidev_rect r = {x, y, w, h};
+	uint8_t best = 0;
+	long best_cost = -1;
+	bool merged;
+
+	if (!rect_clip(comp, &r)) {
+		return;
+	}
+
+	/* Fold the new rectangle into any it touches, repeating since a
+	 * grown rectangle may now touch others */
+	do {
+		merged = false;
+
+		for (uint8_t i = 0; i < comp->ndirty; ++i) {
+			if (!rect_touch(&comp->dirty[i], &r)) {
+				continue;
+			}
+
+			rect_union(&r, &comp->dirty[i]);
+			comp->dirty[i] = comp->dirty[--comp->ndirty];
+			merged = true;
+			break;
+		}
+	} while (merged);
+
+	if (comp->ndirty < INKY_SPIDEV_COMP_RECTS) {
+		comp->dirty[comp->ndirty++] = r;
+		return;
+	}
+
+	/* List full: grow whichever rectangle gains the least area */
+	for (uint8_t i = 0; i < comp->ndirty; ++i) {
+		inky_spidev_rect u = comp->dirty[i];
+		long cost;
+
+		rect_union(&u, &r);
+		cost = rect_area(&u) - rect_area(&comp->dirty[i]);
+
+		if (best_cost < 0 || cost < best_cost) {
+			best = i;
+			best_cost = cost;
+		}
+	}
+
+	rect_union(&comp->dirty[best], &r);
+}
+
+void inky_spidev_layer_damage(inky_spidev_layer *layer, int x, int y, int w,
+			      int h)
+{
+	if (!layer->comp || !layer->visible) {
+		return;
+	}
+
+	inky_spidev_comp_damage(layer->comp, layer->x + x, layer->y + y, w, h);
+}
+
+void inky_spidev_layer_move(inky_spidev_layer *layer, int x, int y)
+{
+	if (x == layer->x && y == layer->y) {
+		return;
+	}
+
+	inky_spidev_layer_damage(layer, 0, 0, layer->fb.width,
+				 layer->fb.height);
+
+	layer->x = x;
+	layer->y = y;
+
+	inky_spidev_layer_damage(layer, 0, 0, layer->fb.width,
+				 layer->fb.height);
+}
+
+void inky_spidev_layer_show(inky_spidev_layer *layer, bool visible)
+{
+	if (layer->visible == visible) {
+		return;
+	}
+
+	/* Damage while visible so both transitions are recorded */
+	layer->visible = true;
+	inky_spidev_layer_damage(layer, 0, 0, layer->fb.width,
+				 layer->fb.height);
+	layer->visible = visible;
+}
+
+bool inky_spidev_comp_dirty(const inky_spidev_comp *comp)
+{
+	return comp->ndirty > 0;
+}
+
+int8_t inky_spidev_comp_render(inky_spidev_comp *comp, inky_spidev_fb *dst,
+			       inky_spidev_rect *bbox)
+{
+	inky_spidev_rect box = {0, 0, 0, 0};
+
+	if (!comp || !dst) {
+		return INKY_E_NULL_PTR;
+	}
+
+	if (dst->width != comp->width || dst->height != comp->height) {
+		return INKY_E_OUT_OF_RANGE;
+	}
+
+	for (uint8_t i = 0; i < comp->ndirty; ++i) {
+		render_rect(comp, dst, &comp->dirty[i]);
+
+		if (i == 0) {
+			box = comp->dirty[i];
+		} else {
+			rect_union(&box, &comp->dirty[i]);
+		}
+	}
+
+	comp->ndirty = 0;
+
+	if (bbox) {
+		*bbox = box;
+	}
+
+	return INKY_OK;
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+/* Clip to the screen and widen to whole bytes, since rendering works
+ * on eight pixel columns */
+static bool rect_clip(const inky_spidev_comp *comp, inky_spidev_rect *r)
+{
+	int x0 = r->x < 0 ? 0 : r->x;
+	int y0 = r->y < 0 ? 0 : r->y;
+	int x1 = r->x + r->w > comp->width ? comp->width : r->x + r->w;
+	int y1 = r->y + r->h > comp->height ? comp->height : r->y + r->h;
+
+	if (x0 >= x1 || y0 >= y1) {
+		return false;
+	}
+
+	x0 &= ~7;
+	x1 = (x1 + 7) & ~7;
+
+	if (x1 > comp->width) {
+		x1 = comp->width;
+	}
+
+	r->x = x0;
+	r->y = y0;
+	r->w = x1 - x0;
+	r->h = y1 - y0;
+
+	return true;
+}
+
+static bool rect_touch(const inky_spidev_rect *a, const inky_spidev_rect *b)
+{
+	return a->x <= b->x + b->w && b->x <= a->x + a->w
+		&& a->y <= b->y + b->h && b->y <= a->y + a->h;
+}
+
+static void rect_union(inky_spidev_rect *a, const inky_spidev_rect *b)
+{
+	int x0 = a->x < b->x ? a->x : b->x;
+	int y0 = a->y < b->y ? a->y : b->y;
+	int x1 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+	int y1 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+
+	a->x = x0;
+	a->y = y0;
+	a->w = x1 - x0;
+	a->h = y1 - y0;
+}
+
+static long rect_area(const inky_spidev_rect *r)
+{
+	return (long) r->w * r->h;
+}
+
+/* Eight pixels of a row starting at bit, which may lie partly or
+ * wholly outside the row. Missing bytes read as zero. */
+static uint8_t fetch8(const uint8_t *row, uint16_t stride, int bit)
+{
+	int idx = bit >= 0 ? bit / 8 : -((7 - bit) / 8);
+	int s = bit - idx * 8;
+	unsigned int hi = idx >= 0 && idx < stride ? row[idx] : 0;
+	unsigned int lo = idx + 1 >= 0 && idx + 1 < stride ? row[idx + 1] : 0;
+
+	return (((hi << 8) | lo) << s) >> 8;
+}
+
+/* Bits of an eight pixel group starting at bit that fall in 0..width */
+static uint8_t valid8(uint16_t width, int bit)
+{
+	uint8_t m = 0xff;
+
+	if (bit < 0) {
+		m = bit <= -8 ? 0 : 0xff >> -bit;
+	}
+
+	if (bit + 8 > width) {
+		int over = bit + 8 - width;
+
+		m &= over >= 8 ? 0 : 0xff << over;
+	}
+
+	return m;
+}
+
+static void render_rect(inky_spidev_comp *comp, inky_spidev_fb *dst,
+			const inky_spidev_rect *r)
+{
+	int b0 = r->x / 8;
+	int b1 = (r->x + r->w - 1) / 8;
+
+	for (int y = r->y; y < r->y + r->h; ++y) {
+		uint8_t *bw = dst->planes[INKY_SPIDEV_PLANE_BW]
+			+ (size_t) y * dst->stride;
+		uint8_t *col = dst->planes[INKY_SPIDEV_PLANE_COLOR]
+			+ (size_t) y * dst->stride;
+
+		memset(bw + b0, comp->background.bw, b1 - b0 + 1);
+		memset(col + b0, comp->background.col, b1 - b0 + 1);
+
+		for (uint8_t l = 0; l < comp->nlayers; ++l) {
+			const inky_spidev_layer *layer = comp->layers[l];
+			const inky_spidev_fb *fb = &layer->fb;
+			const uint8_t *lbw, *lcol, *lmask;
+			int ly = y - layer->y;
+			size_t off;
+
+			if (!layer->visible || ly < 0 || ly >= fb->height) {
+				continue;
+			}
+
+			off = (size_t) ly * fb->stride;
+			lbw = fb->planes[INKY_SPIDEV_PLANE_BW] + off;
+			lcol = fb->planes[INKY_SPIDEV_PLANE_COLOR] + off;
+			lmask = layer->mask.planes[INKY_SPIDEV_PLANE_BW] + off;
+
+			for (int b = b0; b <= b1; ++b) {
+				int bit = b * 8 - layer->x;
+				uint8_t m = valid8(fb->width, bit);
+
+				if (m) {
+					m &= fetch8(lmask, fb->stride, bit);
+				}
+
+				if (!m) {
+					continue;
+				}
+
+				bw[b] = (bw[b] & ~m)
+					| (fetch8(lbw, fb->stride, bit) & m);
+				col[b] = (col[b] & ~m)
+					| (fetch8(lcol, fb->stride, bit) & m);
+			}
+		}
+	}
+}
@@ -0,0 +1,436 @@
+#include <inky-spidev-draw.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+static inline void put_byte(uint8_t *bw, uint8_t *col, size_t i,
+			    uint8_t mask, const inky_spidev_pen *pen);
+
+static void fill_rows(inky_spidev_fb *fb, const inky_spidev_pen *pen,
+		      int x0, int x1, int y0, int y1);
+
+static void circle_points(inky_spidev_fb *fb, const inky_spidev_pen *pen,
+			  int cx, int cy, int x, int y, bool fill);
+
+static void row_get(const uint8_t *row, int x, int w, uint8_t *out);
+
+static void row_put(uint8_t *row, int x, int w, const uint8_t *in);
+
+/*
+**********************************************************************
+******************* DRAWING IMPLEMENTATION ***************************
+**********************************************************************
+*/
+
+inky_spidev_pen inky_spidev_pen_make(const inky_color_config *cfg,
+				     inky_color c)
+{
+	inky_spidev_pen pen;
+
+	if (c == INKY_COLOR_RED || c == INKY_COLOR_YELLOW) {
+		if (!cfg || cfg->red || cfg->yellow) {
+			pen.bw = 0xff;
+			pen.col = 0xff;
+			return pen;
+		}
+
+		c = INKY_COLOR_BLACK;
+	}
+
+	pen.bw = c == INKY_COLOR_BLACK ? 0x00 : 0xff;
+	pen.col = 0x00;
+
+	return pen;
+}
+
+void inky_spidev_draw_pixel(inky_spidev_fb *fb, const inky_spidev_pen *pen,
+			    int x, int y)
+{
+	if (x < 0 || y < 0 || x >= fb->width || y >= fb->height) {
+		return;
+	}
+
+	put_byte(fb->planes[INKY_SPIDEV_PLANE_BW],
+		 fb->planes[INKY_SPIDEV_PLANE_COLOR],
+		 (size_t) y * fb->stride + x / 8, 0x80 >> (x % 8), pen);
+}
+
+void inky_spidev_draw_hspan(inky_spidev_fb *fb, const inky_spidev_pen *pen,
+			    int x0, int x1, int y)
+{
+	if (x0 > x1) {
+		int t = x0;
+
+		x0 = x1;
+		x1 = t;
+	}
+
+	fill_rows(fb, pen, x0, x1, y, y);
+}
+
+void inky_spidev_draw_line(inky_spidev_fb *fb, const inky_spidev_pen *pen,
+			   int x0, int y0, int x1, int y1)
+{
+	int dx = abs(x1 - x0);
+	int dy = -abs(y1 - y0);
+	int sx = x0 < x1 ? 1 : -1;
+	int sy = y0 < y1 ? 1 : -1;
+	int err = dx + dy;
+
+	if (y0 == y1) {
+		inky_spidev_draw_hspan(fb, pen, x0, x1, y0);
+		return;
+	}
+
+	for (;;) {
+		int e2 = 2 * err;
+
+		inky_spidev_draw_pixel(fb, pen, x0, y0);
+
+		if (x0 == x1 && y0 == y1) {
+			break;
+		}
+
+		if (e2 >= dy) {
+			err += dy;
+			x0 += sx;
+		}
+
+		if (e2 <= dx) {
+			err += dx;
+			y0 += sy;
+		}
+	}
+}
+
+void inky_spidev_draw_rect(inky_spidev_fb *fb, const inky_spidev_pen *pen,
+			   int x, int y, int w, int h, bool fill)
+{
+	if (w <= 0 || h <= 0) {
+		return;
+	}
+
+	if (fill) {
+		fill_rows(fb, pen, x, x + w - 1, y, y + h - 1);
+		return;
+	}
+
+	fill_rows(fb, pen, x, x + w - 1, y, y);
+	fill_rows(fb, pen, x, x + w - 1, y + h - 1, y + h - 1);
+	fill_rows(fb, pen, x, x, y, y + h - 1);
+	fill_rows(fb, pen, x + w - 1, x + w - 1, y, y + h - 1);
+}
+
+void inky_spidev_draw_circle(inky_spidev_fb *fb, const inky_spidev_pen *pen,
+			     int cx, int cy, int r, bool fill)
+{
+	int x = r;
+	int y = 0;
+	int err = 1 - r;
+
+	if (r < 0) {
+		return;
+	}
+
+	/* Midpoint algorithm over one octant, mirrored to the others */
+	while (x >= y) {
+		circle_points(fb, pen, cx, cy, x, y, fill);
+		++y;
+
+		if (err < 0) {
+			err += 2 * y + 1;
+		} else {
+			--x;
+			err += 2 * (y - x) + 1;
+		}
+	}
+}
+
+int8_t inky_spidev_draw_copy(inky_spidev_fb *dst, int dx, int dy,
+			     const inky_spidev_fb *src, int sx, int sy,
+			     int w, int h)
+{
+	uint8_t *tmp;
+	int first, last, step;
+
+	if (!dst || !src) {
+		return INKY_E_NULL_PTR;
+	}
+
+	/* Clip against the source, then the destination */
+	if (sx < 0) {
+		w += sx;
+		dx -= sx;
+		sx = 0;
+	}
+
+	if (sy < 0) {
+		h += sy;
+		dy -= sy;
+		sy = 0;
+	}
+
+	if (dx < 0) {
+		w += dx;
+		sx -= dx;
+		dx = 0;
+	}
+
+	if (dy < 0) {
+		h += dy;
+		sy -= dy;
+		dy = 0;
+	}
+
+	if (sx + w > src->width) {
+		w = src->width - sx;
+	}
+
+	if (sy + h > src->height) {
+		h = src->height - sy;
+	}
+
+	if (dx + w > dst->width) {
+		w = dst->width - dx;
+	}
+
+	if (dy + h > dst->height) {
+		h = dst->height - dy;
+	}
+
+	if (w <= 0 || h <= 0) {
+		return INKY_OK;
+	}
+
+	tmp = malloc((w + 7) / 8);
+
+	if (!tmp) {
+		return INKY_E_FAILURE;
+	}
+
+	/* Walk rows away from the overlap when moving down */
+	if (dst == src && dy > sy) {
+		first = h - 1;
+		last = -1;
+		step = -1;
+	} else {
+		first = 0;
+		last = h;
+		step = 1;
+	}
+
+	for (int p = 0; p < INKY_SPIDEV_PLANES; ++p) {
+		for (int r = first; r != last; r += step) {
+			const uint8_t *srow = src->planes[p]
+				+ (size_t) (sy + r) * src->stride;
+			uint8_t *drow = dst->planes[p]
+				+ (size_t) (dy + r) * dst->stride;
+
+			/* Byte aligned runs need no shifting */
+			if (sx % 8 == 0 && dx % 8 == 0 && w % 8 == 0) {
+				memmove(drow + dx / 8, srow + sx / 8, w / 8);
+				continue;
+			}
+
+			row_get(srow, sx, w, tmp);
+			row_put(drow, dx, w, tmp);
+		}
+	}
+
+	free(tmp);
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_draw_scroll(inky_spidev_fb *fb, int dx, int dy,
+			       const inky_spidev_pen *pen)
+{
+	int8_t rst;
+
+	if (!fb || !pen) {
+		return INKY_E_NULL_PTR;
+	}
+
+	if (abs(dx) >= fb->width || abs(dy) >= fb->height) {
+		fill_rows(fb, pen, 0, fb->width - 1, 0, fb->height - 1);
+		return INKY_OK;
+	}
+
+	/* Whole rows are contiguous, so a vertical scroll is one move
+	 * per plane */
+	if (dx == 0) {
+		size_t off = (size_t) abs(dy) * fb->stride;
+
+		size_t len = fb->plane_len - off;
+
+		for (int p = 0; p < INKY_SPIDEV_PLANES; ++p) {
+			uint8_t *plane = fb->planes[p];
+
+			if (dy > 0) {
+				memmove(plane + off, plane, len);
+			} else {
+				memmove(plane, plane + off, len);
+			}
+		}
+	} else {
+		rst = inky_spidev_draw_copy(fb, dx, dy, fb, 0, 0, fb->width,
+					    fb->height);
+		if (rst != INKY_OK) {
+			return rst;
+		}
+	}
+
+	if (dy > 0) {
+		fill_rows(fb, pen, 0, fb->width - 1, 0, dy - 1);
+	} else if (dy < 0) {
+		fill_rows(fb, pen, 0, fb->width - 1, fb->height + dy,
+			  fb->height - 1);
+	}
+
+	if (dx > 0) {
+		fill_rows(fb, pen, 0, dx - 1, 0, fb->height - 1);
+	} else if (dx < 0) {
+		fill_rows(fb, pen, fb->width + dx, fb->width - 1, 0,
+			  fb->height - 1);
+	}
+
+	return INKY_OK;
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+static inline void put_byte(uint8_t *bw, uint8_t *col, size_t i,
+			    uint8_t mask, const inky_spidev_pen *pen)
+{
+	bw[i] = (bw[i] & ~mask) | (pen->bw & mask);
+	col[i] = (col[i] & ~mask) | (pen->col & mask);
+}
+
+/* Fill the inclusive box x0..x1, y0..y1 after clipping. Each row is a
+ * masked first byte, a memset over the whole bytes and a masked last
+ * byte; full width boxes collapse to one memset per plane. */
+static void fill_rows(inky_spidev_fb *fb, const inky_spidev_pen *pen,
+		      int x0, int x1, int y0, int y1)
+{
+	uint8_t *bw = fb->planes[INKY_SPIDEV_PLANE_BW];
+	uint8_t *col = fb->planes[INKY_SPIDEV_PLANE_COLOR];
+	int b0, b1;
+	uint8_t m0, m1;
+
+	if (x0 < 0) {
+		x0 = 0;
+	}
+
+	if (y0 < 0) {
+		y0 = 0;
+	}
+
+	if (x1 >= fb->width) {
+		x1 = fb->width - 1;
+	}
+
+	if (y1 >= fb->height) {
+		y1 = fb->height - 1;
+	}
+
+	if (x0 > x1 || y0 > y1) {
+		return;
+	}
+
+	if (x0 == 0 && x1 == fb->width - 1) {
+		size_t off = (size_t) y0 * fb->stride;
+		size_t len = (size_t) (y1 - y0 + 1) * fb->stride;
+
+		memset(bw + off, pen->bw, len);
+		memset(col + off, pen->col, len);
+		return;
+	}
+
+	b0 = x0 / 8;
+	b1 = x1 / 8;
+	m0 = 0xff >> (x0 % 8);
+	m1 = 0xff << (7 - x1 % 8);
+
+	for (int y = y0; y <= y1; ++y) {
+		size_t row = (size_t) y * fb->stride;
+
+		if (b0 == b1) {
+			put_byte(bw, col, row + b0, m0 & m1, pen);
+			continue;
+		}
+
+		put_byte(bw, col, row + b0, m0, pen);
+
+		if (b1 - b0 > 1) {
+			memset(bw + row + b0 + 1, pen->bw, b1 - b0 - 1);
+			memset(col + row + b0 + 1, pen->col, b1 - b0 - 1);
+		}
+
+		put_byte(bw, col, row + b1, m1, pen);
+	}
+}
+
+static void circle_points(inky_spidev_fb *fb, const inky_spidev_pen *pen,
+			  int cx, int cy, int x, int y, bool fill)
+{
+	if (fill) {
+		fill_rows(fb, pen, cx - x, cx + x, cy + y, cy + y);
+		fill_rows(fb, pen, cx - x, cx + x, cy - y, cy - y);
+		fill_rows(fb, pen, cx - y, cx + y, cy + x, cy + x);
+		fill_rows(fb, pen, cx - y, cx + y, cy - x, cy - x);
+		return;
+	}
+
+	inky_spidev_draw_pixel(fb, pen, cx + x, cy + y);
+	inky_spidev_draw_pixel(fb, pen, cx - x, cy + y);
+	inky_spidev_draw_pixel(fb, pen, cx + x, cy - y);
+	inky_spidev_draw_pixel(fb, pen, cx - x, cy - y);
+	inky_spidev_draw_pixel(fb, pen, cx + y, cy + x);
+	inky_spidev_draw_pixel(fb, pen, cx - y, cy + x);
+	inky_spidev_draw_pixel(fb, pen, cx + y, cy - x);
+	inky_spidev_draw_pixel(fb, pen, cx - y, cy - x);
+}
+
+/* Extract w bits starting at bit x of row into out, left aligned */
+static void row_get(const uint8_t *row, int x, int w, uint8_t *out)
+{
+	const uint8_t *p = row + x / 8;
+	int s = x % 8;
+	int n = (w + 7) / 8;
+
+	for (int i = 0; i < n; ++i) {
+		uint8_t v = p[i] << s;
+
+		/* Only touch the next byte when it holds wanted bits */
+		if (s && 8 * i + 8 - s < w) {
+			v |= p[i + 1] >> (8 - s);
+		}
+
+		out[i] = v;
+	}
+}
+
+/* Write w left aligned bits from in to row starting at bit x */
+static void row_put(uint8_t *row, int x, int w, const uint8_t *in)
+{
+	uint8_t *p = row + x / 8;
+	int s = x % 8;
+	int n = (w + 7) / 8;
+
+	for (int i = 0; i < n; ++i) {
+		int left = w - 8 * i;
+		uint8_t m = left >= 8 ? 0xff : 0xff << (8 - left);
+		uint8_t v = in[i] & m;
+
+		p[i] = (p[i] & ~(m >> s)) | (v >> s);
+
+		if (s && (uint8_t) (m << (8 - s))) {
+			p[i + 1] = (p[i + 1] & ~(uint8_t) (m << (8 - s)))
+				| (uint8_t) (v << (8 - s));
+		}
+	}
+}
@@ -0,0 +1,662 @@
+#include <inky-spidev-fb.h>
+
+#include "inky-spidev-cmd.h"
+#include "inky-spidev-idle.h"
+#include "inky-spidev-lat-rec.h"
+#include "inky-spidev-model-rec.h"
+#include "inky-spidev-seq-rec.h"
+#include "inky-spidev-temp.h"
+#include "inky-spidev-trace.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+static inky_error_state present(inky_spidev_intf *iptr,
+				const inky_spidev_fb *fb,
+				inky_spidev_lat_rec *times);
+
+static inky_error_state upload_plane(inky_spidev_intf *iptr,
+				     const inky_spidev_fb *fb, int plane,
+				     uint8_t ram_cmd);
+
+static int plane_fill(const uint8_t *buf, uint32_t len);
+
+static bool plane_in_ram(const inky_spidev_ram *ram, int plane,
+			 const uint8_t *buf, uint32_t len);
+
+static void plane_keep(inky_spidev_ram *ram, int plane, const uint8_t *buf,
+		       uint32_t len);
+
+static void *dbuf_worker(void *arg);
+
+static void *tbuf_worker(void *arg);
+
+/*
+**********************************************************************
+******************* FRAMEBUFFER IMPLEMENTATION ***********************
+**********************************************************************
+*/
+
+int8_t inky_spidev_fb_init(inky_spidev_fb *fb, uint16_t width,
+			   uint16_t height)
+{
+	if (!fb) {
+		return INKY_E_NULL_PTR;
+	}
+
+	fb->width = width;
+	fb->height = height;
+	fb->stride = (width + 7) / 8;
+	fb->plane_len = (uint32_t) fb->stride * height;
+	fb->buf = malloc((size_t) fb->plane_len * INKY_SPIDEV_PLANES);
+
+	if (!fb->buf) {
+		return INKY_E_FAILURE;
+	}
+
+	for (int p = 0; p < INKY_SPIDEV_PLANES; ++p) {
+		fb->planes[p] = fb->buf + (size_t) p * fb->plane_len;
+	}
+
+	memset(&fb->stamp, 0, sizeof(fb->stamp));
+
+	inky_spidev_fb_clear(fb, INKY_COLOR_WHITE);
+
+	return INKY_OK;
+}
+
+void inky_spidev_fb_free(inky_spidev_fb *fb)
+{
+	free(fb->buf);
+	fb->buf = NULL;
+
+	for (int p = 0; p < INKY_SPIDEV_PLANES; ++p) {
+		fb->planes[p] = NULL;
+	}
+}
+
+void inky_spidev_fb_clear(inky_spidev_fb *fb, inky_color c)
+{
+	memset(fb->planes[INKY_SPIDEV_PLANE_BW],
+	       c == INKY_COLOR_BLACK ? 0x00 : 0xff, fb->plane_len);
+	memset(fb->planes[INKY_SPIDEV_PLANE_COLOR],
+	       c == INKY_COLOR_RED || c == INKY_COLOR_YELLOW ? 0xff : 0x00,
+	       fb->plane_len);
+}
+
+void inky_spidev_fb_set_pixel(inky_spidev_fb *fb, uint16_t x, uint16_t y,
+			      inky_color c)
+{
+	size_t i;
+	uint8_t mask;
+
+	if (x >= fb->width || y >= fb->height) {
+		return;
+	}
+
+	i = (size_t) y * fb->stride + x / 8;
+	mask = 0x80 >> (x % 8);
+
+	if (c == INKY_COLOR_BLACK) {
+		fb->planes[INKY_SPIDEV_PLANE_BW][i] &= ~mask;
+	} else {
+		fb->planes[INKY_SPIDEV_PLANE_BW][i] |= mask;
+	}
+
+	if (c == INKY_COLOR_RED || c == INKY_COLOR_YELLOW) {
+		fb->planes[INKY_SPIDEV_PLANE_COLOR][i] |= mask;
+	} else {
+		fb->planes[INKY_SPIDEV_PLANE_COLOR][i] &= ~mask;
+	}
+}
+
+inky_color inky_spidev_fb_get_pixel(const inky_spidev_fb *fb, uint16_t x,
+				    uint16_t y)
+{
+	size_t i;
+	uint8_t mask;
+
+	if (x >= fb->width || y >= fb->height) {
+		return INKY_COLOR_WHITE;
+	}
+
+	i = (size_t) y * fb->stride + x / 8;
+	mask = 0x80 >> (x % 8);
+
+	if (fb->planes[INKY_SPIDEV_PLANE_COLOR][i] & mask) {
+		return INKY_COLOR_RED;
+	}
+
+	if (fb->planes[INKY_SPIDEV_PLANE_BW][i] & mask) {
+		return INKY_COLOR_WHITE;
+	}
+
+	return INKY_COLOR_BLACK;
+}
+
+void inky_spidev_fb_stamp(inky_spidev_fb *fb, uint64_t id,
+			  uint64_t content_us)
+{
+	fb->stamp.id = id;
+	fb->stamp.content_us = content_us ? content_us :
+		inky_spidev_lat_now_us();
+	fb->stamp.queued_us = 0;
+	fb->stamp.converted_us = 0;
+}
+
+int8_t inky_spidev_fb_present(inky_spidev_intf *intf_ptr,
+			      const inky_spidev_fb *fb)
+{
+	inky_error_state rst;
+	inky_error_state end_rst;
+	inky_spidev_lat_rec times = {0};
+
+	if (!intf_ptr || !fb) {
+		return INKY_E_NULL_PTR;
+	}
+
+	INKY_TRACE3(fb_present_entry, intf_ptr, fb->width, fb->height);
+
+	rst = inky_spidev_hw_begin(intf_ptr);
+	if (rst != INKY_OK) {
+		INKY_TRACE4(fb_present_return, intf_ptr, fb->width, fb->height,
+			    rst);
+		return rst;
+	}
+
+	rst = present(intf_ptr, fb, &times);
+
+	if (intf_ptr->lat) {
+		inky_spidev_lat_record(intf_ptr->lat, &fb->stamp, &times, rst);
+	}
+
+	end_rst = inky_spidev_hw_end(intf_ptr);
+	rst = rst != INKY_OK ? rst : end_rst;
+
+	INKY_TRACE4(fb_present_return, intf_ptr, fb->width, fb->height, rst);
+
+	return rst;
+}
+
+/*
+**********************************************************************
+****************** DOUBLE BUFFER IMPLEMENTATION **********************
+**********************************************************************
+*/
+
+int8_t inky_spidev_dbuf_init(inky_spidev_dbuf *dbuf,
+			     inky_spidev_intf *intf_ptr,
+			     uint16_t width, uint16_t height)
+{
+	int8_t rst;
+
+	if (!dbuf || !intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	rst = inky_spidev_fb_init(&dbuf->fbs[0], width, height);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	rst = inky_spidev_fb_init(&dbuf->fbs[1], width, height);
+	if (rst != INKY_OK) {
+		inky_spidev_fb_free(&dbuf->fbs[0]);
+		return rst;
+	}
+
+	dbuf->intf = intf_ptr;
+	dbuf->front = &dbuf->fbs[0];
+	dbuf->back = &dbuf->fbs[1];
+	dbuf->pending = false;
+	dbuf->stop = false;
+	dbuf->last_rst = INKY_OK;
+
+	pthread_mutex_init(&dbuf->lock, NULL);
+	pthread_cond_init(&dbuf->cond, NULL);
+
+	if (pthread_create(&dbuf->thread, NULL, dbuf_worker, dbuf) != 0) {
+		pthread_cond_destroy(&dbuf->cond);
+		pthread_mutex_destroy(&dbuf->lock);
+		inky_spidev_fb_free(&dbuf->fbs[0]);
+		inky_spidev_fb_free(&dbuf->fbs[1]);
+		return INKY_E_FAILURE;
+	}
+
+	return INKY_OK;
+}
+
+inky_spidev_fb *inky_spidev_dbuf_back(inky_spidev_dbuf *dbuf)
+{
+	return dbuf->back;
+}
+
+int8_t inky_spidev_dbuf_swap(inky_spidev_dbuf *dbuf)
+{
+	inky_spidev_fb *tmp;
+	int8_t rst;
+
+	pthread_mutex_lock(&dbuf->lock);
+
+	/* The front buffer is still being read by the uploader */
+	while (dbuf->pending) {
+		pthread_cond_wait(&dbuf->cond, &dbuf->lock);
+	}
+
+	tmp = dbuf->front;
+	dbuf->front = dbuf->back;
+	dbuf->back = tmp;
+
+	if (!dbuf->front->stamp.queued_us) {
+		dbuf->front->stamp.queued_us = inky_spidev_lat_now_us();
+	}
+
+	memset(&dbuf->back->stamp, 0, sizeof(dbuf->back->stamp));
+
+	rst = dbuf->last_rst;
+	dbuf->pending = true;
+
+	pthread_cond_broadcast(&dbuf->cond);
+	pthread_mutex_unlock(&dbuf->lock);
+
+	return rst;
+}
+
+int8_t inky_spidev_dbuf_wait(inky_spidev_dbuf *dbuf)
+{
+	int8_t rst;
+
+	pthread_mutex_lock(&dbuf->lock);
+
+	while (dbuf->pending) {
+		pthread_cond_wait(&dbuf->cond, &dbuf->lock);
+	}
+
+	rst = dbuf->last_rst;
+
+	pthread_mutex_unlock(&dbuf->lock);
+
+	return rst;
+}
+
+int8_t inky_spidev_dbuf_deinit(inky_spidev_dbuf *dbuf)
+{
+	int8_t rst;
+
+	rst = inky_spidev_dbuf_wait(dbuf);
+
+	pthread_mutex_lock(&dbuf->lock);
+	dbuf->stop = true;
+	pthread_cond_broadcast(&dbuf->cond);
+	pthread_mutex_unlock(&dbuf->lock);
+
+	pthread_join(dbuf->thread, NULL);
+
+	pthread_cond_destroy(&dbuf->cond);
+	pthread_mutex_destroy(&dbuf->lock);
+	inky_spidev_fb_free(&dbuf->fbs[0]);
+	inky_spidev_fb_free(&dbuf->fbs[1]);
+
+	return rst;
+}
+
+/*
+**********************************************************************
+****************** TRIPLE BUFFER IMPLEMENTATION **********************
+**********************************************************************
+*/
+
+int8_t inky_spidev_tbuf_init(inky_spidev_tbuf *tbuf,
+			     inky_spidev_intf *intf_ptr,
+			     uint16_t width, uint16_t height)
+{
+	int8_t rst = INKY_OK;
+	int n;
+
+	if (!tbuf || !intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	for (n = 0; n < 3 && rst == INKY_OK; ++n) {
+		rst = inky_spidev_fb_init(&tbuf->fbs[n], width, height);
+	}
+
+	tbuf->event_fd = rst == INKY_OK ? eventfd(0, EFD_CLOEXEC) : -1;
+
+	if (tbuf->event_fd < 0) {
+		/* n is one past the last buffer attempted */
+		for (int i = 0; i < n; ++i) {
+			inky_spidev_fb_free(&tbuf->fbs[i]);
+		}
+
+		return rst == INKY_OK ? INKY_E_FAILURE : rst;
+	}
+
+	tbuf->intf = intf_ptr;
+	tbuf->back = 0;
+	tbuf->front = 1;
+	atomic_init(&tbuf->middle, 2);
+	atomic_init(&tbuf->stop, false);
+	atomic_init(&tbuf->last_rst, INKY_OK);
+	atomic_init(&tbuf->frames, 0);
+
+	if (pthread_create(&tbuf->thread, NULL, tbuf_worker, tbuf) != 0) {
+		close(tbuf->event_fd);
+
+		for (int i = 0; i < 3; ++i) {
+			inky_spidev_fb_free(&tbuf->fbs[i]);
+		}
+
+		return INKY_E_FAILURE;
+	}
+
+	return INKY_OK;
+}
+
+inky_spidev_fb *inky_spidev_tbuf_back(inky_spidev_tbuf *tbuf)
+{
+	return &tbuf->fbs[tbuf->back];
+}
+
+int8_t inky_spidev_tbuf_submit(inky_spidev_tbuf *tbuf)
+{
+	const uint64_t one = 1;
+	uint_fast8_t prev;
+	inky_spidev_stamp *stamp = &tbuf->fbs[tbuf->back].stamp;
+
+	if (!stamp->queued_us) {
+		stamp->queued_us = inky_spidev_lat_now_us();
+	}
+
+	/* Release orders the drawing before the publish; acquire makes
+	 * the buffer we get back safe to draw into */
+	prev = atomic_exchange_explicit(&tbuf->middle,
+					tbuf->back | INKY_SPIDEV_TBUF_FRESH,
+					memory_order_acq_rel);
+	tbuf->back = prev & ~INKY_SPIDEV_TBUF_FRESH;
+
+	/* Still fresh: the uploader never took it, a newer frame wins */
+	if ((prev & INKY_SPIDEV_TBUF_FRESH) && tbuf->intf->lat) {
+		inky_spidev_lat_drop(tbuf->intf->lat);
+	}
+
+	memset(&tbuf->fbs[tbuf->back].stamp, 0, sizeof(*stamp));
+
+	/* Counter semantics: repeated submits coalesce into one wakeup */
+	if (write(tbuf->event_fd, &one, sizeof(one)) < 0) {
+		return INKY_E_FAILURE;
+	}
+
+	return atomic_load_explicit(&tbuf->last_rst, memory_order_relaxed);
+}
+
+int8_t inky_spidev_tbuf_deinit(inky_spidev_tbuf *tbuf)
+{
+	const uint64_t one = 1;
+
+	atomic_store(&tbuf->stop, true);
+
+	if (write(tbuf->event_fd, &one, sizeof(one)) < 0) {
+		return INKY_E_FAILURE;
+	}
+
+	pthread_join(tbuf->thread, NULL);
+	close(tbuf->event_fd);
+
+	for (int i = 0; i < 3; ++i) {
+		inky_spidev_fb_free(&tbuf->fbs[i]);
+	}
+
+	return atomic_load(&tbuf->last_rst);
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+static void *dbuf_worker(void *arg)
+{
+	inky_spidev_dbuf *dbuf = (inky_spidev_dbuf*) arg;
+
+	pthread_mutex_lock(&dbuf->lock);
+
+	for (;;) {
+		const inky_spidev_fb *fb;
+		int8_t rst;
+
+		while (!dbuf->pending && !dbuf->stop) {
+			pthread_cond_wait(&dbuf->cond, &dbuf->lock);
+		}
+
+		if (!dbuf->pending) {
+			break;
+		}
+
+		/* Front is only swapped while pending is clear, so it
+		 * is safe to read without the lock */
+		fb = dbuf->front;
+		pthread_mutex_unlock(&dbuf->lock);
+
+		rst = inky_spidev_fb_present(dbuf->intf, fb);
+
+		pthread_mutex_lock(&dbuf->lock);
+		dbuf->last_rst = rst;
+		dbuf->pending = false;
+		pthread_cond_broadcast(&dbuf->cond);
+	}
+
+	pthread_mutex_unlock(&dbuf->lock);
+
+	return NULL;
+}
+
+static void *tbuf_worker(void *arg)
+{
+	inky_spidev_tbuf *tbuf = (inky_spidev_tbuf*) arg;
+	uint64_t count;
+
+	while (read(tbuf->event_fd, &count, sizeof(count)) == sizeof(count)
+	       || errno == EINTR) {
+		uint_fast8_t prev;
+		int8_t rst;
+
+		if (atomic_load(&tbuf->stop)) {
+			break;
+		}
+
+		/* Nothing new since the last take */
+		if (!(atomic_load_explicit(&tbuf->middle, memory_order_relaxed)
+		      & INKY_SPIDEV_TBUF_FRESH)) {
+			continue;
+		}
+
+		prev = atomic_exchange_explicit(&tbuf->middle, tbuf->front,
+						memory_order_acq_rel);
+		tbuf->front = prev & ~INKY_SPIDEV_TBUF_FRESH;
+
+		rst = inky_spidev_fb_present(tbuf->intf,
+					     &tbuf->fbs[tbuf->front]);
+
+		atomic_store_explicit(&tbuf->last_rst, rst,
+				      memory_order_relaxed);
+		atomic_fetch_add_explicit(&tbuf->frames, 1,
+					  memory_order_relaxed);
+	}
+
+	return NULL;
+}
+
+static inky_error_state present(inky_spidev_intf *iptr,
+				const inky_spidev_fb *fb,
+				inky_spidev_lat_rec *times)
+{
+	inky_error_state rst;
+	inky_spidev_idle *idle = &iptr->idle;
+	uint64_t start = inky_spidev_lat_now_us();
+	uint64_t upload;
+	uint8_t seq;
+	uint32_t timeout;
+
+	times->upload_start_us = start;
+
+	/* With the idle manager running the controller stays configured
+	 * between frames and only needs a reset after a deep sleep */
+	if (!idle->enabled || !idle->ctrl_ready) {
+		rst = inky_spidev_seq_init_controller(iptr, fb->width,
+						      fb->height,
+						      idle->enabled ?
+						      INKY_SPIDEV_WAKE_RESET_US :
+						      INKY_CMD_RESET_US);
+		if (rst != INKY_OK) {
+			return rst;
+		}
+
+		idle->ctrl_ready = true;
+	}
+
+	rst = upload_plane(iptr, fb, INKY_SPIDEV_PLANE_BW,
+			   INKY_CMD_WRITE_RAM_BW);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	rst = upload_plane(iptr, fb, INKY_SPIDEV_PLANE_COLOR,
+			   INKY_CMD_WRITE_RAM_COLOR);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	rst = inky_spidev_temp_prepare(iptr, &seq, &timeout);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	upload = inky_spidev_lat_now_us() - start;
+	times->upload_end_us = start + upload;
+
+	rst = inky_spidev_cmd_refresh(iptr, seq, timeout);
+	times->glass_us = inky_spidev_lat_now_us();
+
+	if (rst == INKY_OK && iptr->model) {
+		inky_spidev_model_sample(iptr, fb, upload,
+					 times->glass_us - start - upload);
+	}
+
+	if (rst != INKY_OK || idle->enabled) {
+		return rst;
+	}
+
+	idle->ctrl_ready = false;
+
+	return inky_spidev_cmd_sleep(iptr);
+}
+
+static inky_error_state upload_plane(inky_spidev_intf *iptr,
+				     const inky_spidev_fb *fb, int plane,
+				     uint8_t ram_cmd)
+{
+	inky_error_state rst;
+	inky_spidev_ram *ram = &iptr->ram;
+	int fill;
+
+	/* Controller RAM keeps its contents across refreshes, so a plane
+	 * that hasn't changed since it was last written can stay */
+	if (plane_in_ram(ram, plane, fb->planes[plane], fb->plane_len)) {
+		++ram->skipped;
+		INKY_TRACE2(plane_skip, iptr, plane);
+		return INKY_OK;
+	}
+
+	fill = plane_fill(fb->planes[plane], fb->plane_len);
+
+	ram->valid[plane] = false;
+	ram->writing = true;
+
+	INKY_TRACE4(plane_upload_entry, iptr, plane, fb->plane_len, fill);
+
+	/* A blank plane, typically the color plane of a two color frame,
+	 * costs one command byte instead of a full transfer */
+	if (fill >= 0) {
+		rst = inky_spidev_cmd_fill_plane(iptr, ram_cmd,
+						 (uint8_t) fill);
+		++ram->filled;
+	} else {
+		rst = inky_spidev_cmd_write_plane(iptr, ram_cmd,
+						  fb->planes[plane],
+						  fb->plane_len);
+		++ram->sent;
+	}
+
+	ram->writing = false;
+
+	INKY_TRACE3(plane_upload_return, iptr, plane, rst);
+
+	if (rst == INKY_OK) {
+		plane_keep(ram, plane, fb->planes[plane], fb->plane_len);
+	}
+
+	return rst;
+}
+
+/* Value of every byte if they are all 0x00 or all 0xff, -1 otherwise */
+static int plane_fill(const uint8_t *buf, uint32_t len)
+{
+	uint64_t all = ~0ULL;
+	uint64_t any = 0;
+	uint64_t w;
+	uint32_t i = 0;
+
+	for (; i + sizeof(w) <= len; i += sizeof(w)) {
+		memcpy(&w, buf + i, sizeof(w));
+		all &= w;
+		any |= w;
+	}
+
+	for (; i < len; ++i) {
+		all &= 0xffffffffffffff00ULL | buf[i];
+		any |= buf[i];
+	}
+
+	if (any == 0) {
+		return 0x00;
+	}
+
+	return all == ~0ULL ? 0xff : -1;
+}
+
+/* A byte for byte comparison: a plane is only skipped when RAM is
+ * known to hold exactly these bytes, and comparing costs far less
+ * than the transfer it saves */
+static bool plane_in_ram(const inky_spidev_ram *ram, int plane,
+			 const uint8_t *buf, uint32_t len)
+{
+	return ram->valid[plane] && ram->copy_len[plane] == len
+		&& memcmp(ram->copy[plane], buf, len) == 0;
+}
+
+static void plane_keep(inky_spidev_ram *ram, int plane, const uint8_t *buf,
+		       uint32_t len)
+{
+	uint8_t *copy = ram->copy[plane];
+
+	if (ram->copy_len[plane] != len) {
+		copy = realloc(copy, len);
+
+		/* Without a copy the plane is just sent every time */
+		if (!copy) {
+			return;
+		}
+
+		ram->copy[plane] = copy;
+		ram->copy_len[plane] = len;
+	}
+
+	memcpy(copy, buf, len);
+	ram->valid[plane] = true;
+}
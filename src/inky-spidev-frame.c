@@ -0,0 +1,482 @@
+#include <inky-spidev-frame.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Header field offsets, see the table in inky-spidev-frame.h */
+#define HDR_VERSION 4
+#define HDR_PANEL 5
+#define HDR_COLOR 6
+#define HDR_WIDTH 8
+#define HDR_HEIGHT 10
+#define HDR_PLANE_LEN 12
+#define HDR_OFFSET 16
+#define HDR_SIZE 24
+#define HDR_ENC 32
+#define HDR_CRC 36
+#define HDR_TAG 40
+
+/* Longest literal and repeat run of the RLE encoding */
+#define RLE_LITERAL_MAX 128
+#define RLE_REPEAT_MIN 3
+#define RLE_REPEAT_MAX 130
+
+typedef struct {
+	uint16_t width;
+	uint16_t height;
+	uint32_t plane_len;
+	uint32_t offset[INKY_SPIDEV_PLANES];
+	uint32_t size[INKY_SPIDEV_PLANES];
+	uint8_t enc[INKY_SPIDEV_PLANES];
+} frame_layout;
+
+static uint32_t rle_encode(const uint8_t *src, uint32_t len, uint8_t *dst);
+
+static bool rle_decode(const uint8_t *src, uint32_t len, uint8_t *dst,
+		       uint32_t out_len);
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t len);
+
+static uint32_t frame_crc(const uint8_t *hdr, const uint8_t *const data[],
+			  const uint32_t size[]);
+
+static bool frame_parse(const uint8_t *map, size_t len, frame_layout *lay);
+
+static void put16(uint8_t *p, uint16_t v);
+
+static void put32(uint8_t *p, uint32_t v);
+
+static uint16_t get16(const uint8_t *p);
+
+static uint32_t get32(const uint8_t *p);
+
+/*
+**********************************************************************
+******************* FRAME FILE IMPLEMENTATION ************************
+**********************************************************************
+*/
+
+int8_t inky_spidev_frame_write(const char *path, const inky_spidev_fb *fb,
+			       uint8_t panel, inky_spidev_frame_color color,
+			       const inky_spidev_frame_tag *tag, bool rle)
+{
+	uint8_t hdr[INKY_SPIDEV_FRAME_HDR_LEN];
+	const uint8_t *data[INKY_SPIDEV_PLANES];
+	uint32_t size[INKY_SPIDEV_PLANES];
+	uint8_t *enc[INKY_SPIDEV_PLANES] = {NULL, NULL};
+	static const uint8_t zero[INKY_SPIDEV_FRAME_ALIGN];
+	char tmp[INKY_SPIDEV_PATH_LEN + 16];
+	uint32_t pos = INKY_SPIDEV_FRAME_HDR_LEN;
+	int8_t rst = INKY_E_FAILURE;
+	FILE *f;
+	int fd;
+	bool ok;
+
+	if (!path || !fb) {
+		return INKY_E_NULL_PTR;
+	}
+
+	if (strlen(path) >= INKY_SPIDEV_PATH_LEN) {
+		return INKY_E_OUT_OF_RANGE;
+	}
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, INKY_SPIDEV_FRAME_MAGIC, 4);
+	hdr[HDR_VERSION] = INKY_SPIDEV_FRAME_VERSION;
+	hdr[HDR_PANEL] = panel;
+	hdr[HDR_COLOR] = (uint8_t) color;
+	put16(hdr + HDR_WIDTH, fb->width);
+	put16(hdr + HDR_HEIGHT, fb->height);
+	put32(hdr + HDR_PLANE_LEN, fb->plane_len);
+
+	if (tag) {
+		memcpy(hdr + HDR_TAG, tag->bytes, sizeof(tag->bytes));
+	}
+
+	for (int p = 0; p < INKY_SPIDEV_PLANES; ++p) {
+		data[p] = fb->planes[p];
+		size[p] = fb->plane_len;
+
+		if (rle) {
+			/* Worst case adds one control byte per literal run */
+			enc[p] = malloc((size_t) fb->plane_len
+					+ fb->plane_len / RLE_LITERAL_MAX + 1);
+
+			if (!enc[p]) {
+				goto out;
+			}
+
+			size[p] = rle_encode(fb->planes[p], fb->plane_len,
+					     enc[p]);
+		}
+
+		if (rle && size[p] < fb->plane_len) {
+			data[p] = enc[p];
+			hdr[HDR_ENC + p] = INKY_SPIDEV_FRAME_RLE;
+		} else {
+			size[p] = fb->plane_len;
+		}
+
+		put32(hdr + HDR_OFFSET + 4 * p, pos);
+		put32(hdr + HDR_SIZE + 4 * p, size[p]);
+
+		pos += (size[p] + INKY_SPIDEV_FRAME_ALIGN - 1)
+			& ~(uint32_t) (INKY_SPIDEV_FRAME_ALIGN - 1);
+	}
+
+	put32(hdr + HDR_CRC, frame_crc(hdr, data, size));
+
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+	fd = mkstemp(tmp);
+
+	if (fd < 0) {
+		rst = INKY_E_BAD_PERMISSIONS;
+		goto out;
+	}
+
+	fchmod(fd, 0644);
+
+	f = fdopen(fd, "w");
+
+	if (!f) {
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+
+	ok = fwrite(hdr, sizeof(hdr), 1, f) == 1;
+
+	for (int p = 0; ok && p < INKY_SPIDEV_PLANES; ++p) {
+		uint32_t pad = (INKY_SPIDEV_FRAME_ALIGN
+				- size[p] % INKY_SPIDEV_FRAME_ALIGN)
+			% INKY_SPIDEV_FRAME_ALIGN;
+
+		ok = fwrite(data[p], 1, size[p], f) == size[p]
+			&& fwrite(zero, 1, pad, f) == pad;
+	}
+
+	/* Rename so a concurrent reader never sees a partial file */
+	if (fclose(f) == 0 && ok && rename(tmp, path) == 0) {
+		rst = INKY_OK;
+	} else {
+		unlink(tmp);
+	}
+
+out:
+	free(enc[0]);
+	free(enc[1]);
+
+	return rst;
+}
+
+int8_t inky_spidev_frame_open(inky_spidev_frame *frame, const char *path,
+			      bool verify)
+{
+	int fd;
+	struct stat st;
+	uint8_t *map;
+	size_t len;
+	frame_layout lay;
+	const uint8_t *data[INKY_SPIDEV_PLANES];
+	inky_spidev_fb *fb;
+	bool raw;
+
+	if (!frame || !path) {
+		return INKY_E_NULL_PTR;
+	}
+
+	fb = &frame->fb;
+
+	memset(frame, 0, sizeof(*frame));
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		return INKY_E_FAILURE;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < INKY_SPIDEV_FRAME_HDR_LEN) {
+		close(fd);
+		return INKY_E_FAILURE;
+	}
+
+	len = (size_t) st.st_size;
+	map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		return INKY_E_FAILURE;
+	}
+
+	if (!frame_parse(map, len, &lay)) {
+		munmap(map, len);
+		return INKY_E_FAILURE;
+	}
+
+	for (int p = 0; p < INKY_SPIDEV_PLANES; ++p) {
+		data[p] = map + lay.offset[p];
+	}
+
+	if (verify
+	    && frame_crc(map, data, lay.size) != get32(map + HDR_CRC)) {
+		munmap(map, len);
+		return INKY_E_FAILURE;
+	}
+
+	frame->panel = map[HDR_PANEL];
+	frame->color = (inky_spidev_frame_color) map[HDR_COLOR];
+	memcpy(frame->tag.bytes, map + HDR_TAG, sizeof(frame->tag.bytes));
+
+	for (int p = 0; p < INKY_SPIDEV_PLANES; ++p) {
+		frame->enc[p] = (inky_spidev_frame_enc) lay.enc[p];
+	}
+
+	raw = lay.enc[0] == INKY_SPIDEV_FRAME_RAW
+		&& lay.enc[1] == INKY_SPIDEV_FRAME_RAW;
+
+	if (raw) {
+		fb->width = lay.width;
+		fb->height = lay.height;
+		fb->stride = (lay.width + 7) / 8;
+		fb->plane_len = lay.plane_len;
+		fb->buf = NULL;
+
+		for (int p = 0; p < INKY_SPIDEV_PLANES; ++p) {
+			fb->planes[p] = (uint8_t *) data[p];
+		}
+
+		frame->map = map;
+		frame->map_len = len;
+
+		return INKY_OK;
+	}
+
+	if (inky_spidev_fb_init(fb, lay.width, lay.height) != INKY_OK) {
+		munmap(map, len);
+		return INKY_E_FAILURE;
+	}
+
+	for (int p = 0; p < INKY_SPIDEV_PLANES; ++p) {
+		if (lay.enc[p] == INKY_SPIDEV_FRAME_RAW) {
+			memcpy(fb->planes[p], data[p], lay.plane_len);
+		} else if (!rle_decode(data[p], lay.size[p], fb->planes[p],
+				       lay.plane_len)) {
+			inky_spidev_fb_free(fb);
+			munmap(map, len);
+			memset(frame, 0, sizeof(*frame));
+			return INKY_E_FAILURE;
+		}
+	}
+
+	munmap(map, len);
+
+	return INKY_OK;
+}
+
+void inky_spidev_frame_release(inky_spidev_frame *frame)
+{
+	if (!frame) {
+		return;
+	}
+
+	if (frame->map) {
+		munmap(frame->map, frame->map_len);
+	} else {
+		inky_spidev_fb_free(&frame->fb);
+	}
+
+	memset(frame, 0, sizeof(*frame));
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+static uint32_t rle_encode(const uint8_t *src, uint32_t len, uint8_t *dst)
+{
+	uint32_t i = 0;
+	uint32_t out = 0;
+	uint32_t lit = 0; /* Start of the pending literal run */
+
+	while (i < len) {
+		uint32_t run = 1;
+
+		while (i + run < len && run < RLE_REPEAT_MAX
+		       && src[i + run] == src[i]) {
+			++run;
+		}
+
+		if (run < RLE_REPEAT_MIN) {
+			i += run;
+
+			/* Flush literals in full-length runs as they come */
+			while (i - lit >= RLE_LITERAL_MAX) {
+				dst[out++] = RLE_LITERAL_MAX - 1;
+				memcpy(dst + out, src + lit, RLE_LITERAL_MAX);
+				out += RLE_LITERAL_MAX;
+				lit += RLE_LITERAL_MAX;
+			}
+
+			continue;
+		}
+
+		if (i > lit) {
+			dst[out++] = (uint8_t) (i - lit - 1);
+			memcpy(dst + out, src + lit, i - lit);
+			out += i - lit;
+		}
+
+		dst[out++] = (uint8_t) (run + 125);
+		dst[out++] = src[i];
+
+		i += run;
+		lit = i;
+	}
+
+	if (len > lit) {
+		dst[out++] = (uint8_t) (len - lit - 1);
+		memcpy(dst + out, src + lit, len - lit);
+		out += len - lit;
+	}
+
+	return out;
+}
+
+static bool rle_decode(const uint8_t *src, uint32_t len, uint8_t *dst,
+		       uint32_t out_len)
+{
+	uint32_t i = 0;
+	uint32_t out = 0;
+
+	while (i < len) {
+		uint8_t c = src[i++];
+		uint32_t n;
+
+		if (c < 128) {
+			n = (uint32_t) c + 1;
+
+			if (i + n > len || out + n > out_len) {
+				return false;
+			}
+
+			memcpy(dst + out, src + i, n);
+			i += n;
+		} else {
+			n = (uint32_t) c - 125;
+
+			if (i >= len || out + n > out_len) {
+				return false;
+			}
+
+			memset(dst + out, src[i++], n);
+		}
+
+		out += n;
+	}
+
+	return out == out_len;
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	/* Reflected 0xedb88320 polynomial, a nibble at a time */
+	static const uint32_t table[16] = {
+		0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+		0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+		0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+		0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+	};
+
+	for (size_t i = 0; i < len; ++i) {
+		crc ^= buf[i];
+		crc = (crc >> 4) ^ table[crc & 0x0f];
+		crc = (crc >> 4) ^ table[crc & 0x0f];
+	}
+
+	return crc;
+}
+
+static uint32_t frame_crc(const uint8_t *hdr, const uint8_t *const data[],
+			  const uint32_t size[])
+{
+	uint8_t copy[INKY_SPIDEV_FRAME_HDR_LEN];
+	uint32_t crc = 0xffffffff;
+
+	memcpy(copy, hdr, sizeof(copy));
+	put32(copy + HDR_CRC, 0);
+
+	crc = crc32_update(crc, copy, sizeof(copy));
+
+	for (int p = 0; p < INKY_SPIDEV_PLANES; ++p) {
+		crc = crc32_update(crc, data[p], size[p]);
+	}
+
+	return ~crc;
+}
+
+static bool frame_parse(const uint8_t *map, size_t len, frame_layout *lay)
+{
+	if (memcmp(map, INKY_SPIDEV_FRAME_MAGIC, 4) != 0
+	    || map[HDR_VERSION] != INKY_SPIDEV_FRAME_VERSION) {
+		return false;
+	}
+
+	lay->width = get16(map + HDR_WIDTH);
+	lay->height = get16(map + HDR_HEIGHT);
+	lay->plane_len = get32(map + HDR_PLANE_LEN);
+
+	if (lay->plane_len
+	    != (uint32_t) ((lay->width + 7) / 8) * lay->height) {
+		return false;
+	}
+
+	for (int p = 0; p < INKY_SPIDEV_PLANES; ++p) {
+		lay->offset[p] = get32(map + HDR_OFFSET + 4 * p);
+		lay->size[p] = get32(map + HDR_SIZE + 4 * p);
+		lay->enc[p] = map[HDR_ENC + p];
+
+		if (lay->offset[p] < INKY_SPIDEV_FRAME_HDR_LEN
+		    || lay->offset[p] > len
+		    || lay->size[p] > len - lay->offset[p]) {
+			return false;
+		}
+
+		if (lay->enc[p] == INKY_SPIDEV_FRAME_RAW
+		    ? lay->size[p] != lay->plane_len
+		    : lay->enc[p] != INKY_SPIDEV_FRAME_RLE) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = (uint8_t) v;
+	p[1] = (uint8_t) (v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	put16(p, (uint16_t) v);
+	put16(p + 2, (uint16_t) (v >> 16));
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+	return (uint16_t) (p[0] | p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return get16(p) | (uint32_t) get16(p + 2) << 16;
+}
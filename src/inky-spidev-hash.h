@@ -0,0 +1,32 @@
+/**
+ * @file inky-spidev-hash.h
+ *
+ * SHA-256 for content addressing, where two inputs sharing a key would
+ * silently swap frames. Incremental, so inputs with row padding can be
+ * fed a row at a time.
+ */
+
+#ifndef INKY_SPIDEV_HASH_H
+#define INKY_SPIDEV_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define INKY_SPIDEV_SHA256_LEN 32
+
+typedef struct {
+	uint32_t state[8];
+	uint64_t total; /**< Bytes hashed so far */
+	uint8_t block[64];
+	uint32_t used; /**< Bytes waiting in block */
+} inky_spidev_sha256;
+
+void inky_spidev_sha256_init(inky_spidev_sha256 *ctx);
+
+void inky_spidev_sha256_update(inky_spidev_sha256 *ctx, const void *data,
+			       size_t len);
+
+void inky_spidev_sha256_final(inky_spidev_sha256 *ctx,
+			      uint8_t out[INKY_SPIDEV_SHA256_LEN]);
+
+#endif /* #ifndef INKY_SPIDEV_HASH_H */
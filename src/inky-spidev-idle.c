@@ -0,0 +1,283 @@
+#include <inky-spidev.h>
+
+#include "inky-spidev-bus-arb.h"
+#include "inky-spidev-cmd.h"
+#include "inky-spidev-idle.h"
+#include "inky-spidev-wire.h"
+
+#include <unistd.h>
+
+static void *idle_worker(void *arg);
+
+static inky_error_state idle_release(inky_spidev_intf *iptr);
+
+static inky_error_state idle_acquire(inky_spidev_intf *iptr);
+
+/*
+**********************************************************************
+******************* IDLE MANAGER IMPLEMENTATION **********************
+**********************************************************************
+*/
+
+int8_t inky_spidev_idle_enable(inky_spidev_intf *intf_ptr,
+			       uint32_t timeout_ms)
+{
+	inky_spidev_idle *idle;
+	pthread_condattr_t cattr;
+
+	if (!intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	idle = &intf_ptr->idle;
+
+	if (idle->enabled) {
+		pthread_mutex_lock(&intf_ptr->lock);
+		idle->timeout_ms = timeout_ms;
+		pthread_cond_broadcast(&idle->cond);
+		pthread_mutex_unlock(&intf_ptr->lock);
+
+		return INKY_OK;
+	}
+
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&idle->cond, &cattr);
+	pthread_condattr_destroy(&cattr);
+
+	idle->timeout_ms = timeout_ms;
+	idle->stop = false;
+	idle->asleep = false;
+	idle->ctrl_ready = false;
+	idle->active = 0;
+	clock_gettime(CLOCK_MONOTONIC, &idle->last_use);
+
+	if (pthread_create(&idle->thread, NULL, idle_worker, intf_ptr) != 0) {
+		pthread_cond_destroy(&idle->cond);
+		return INKY_E_FAILURE;
+	}
+
+	idle->enabled = true;
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_idle_disable(inky_spidev_intf *intf_ptr)
+{
+	inky_spidev_idle *idle;
+
+	if (!intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	idle = &intf_ptr->idle;
+
+	if (!idle->enabled) {
+		return INKY_OK;
+	}
+
+	pthread_mutex_lock(&intf_ptr->lock);
+	idle->stop = true;
+	pthread_cond_broadcast(&idle->cond);
+	pthread_mutex_unlock(&intf_ptr->lock);
+
+	pthread_join(idle->thread, NULL);
+
+	idle->enabled = false;
+	pthread_cond_destroy(&idle->cond);
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_idle_sleep_now(inky_spidev_intf *intf_ptr)
+{
+	inky_error_state rst = INKY_OK;
+	inky_spidev_idle *idle;
+
+	if (!intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	idle = &intf_ptr->idle;
+
+	if (!idle->enabled) {
+		return INKY_E_NOT_CONFIGURED;
+	}
+
+	pthread_mutex_lock(&intf_ptr->lock);
+
+	if (!idle->asleep) {
+		rst = idle_release(intf_ptr);
+	}
+
+	pthread_mutex_unlock(&intf_ptr->lock);
+
+	return rst;
+}
+
+inky_error_state inky_spidev_hw_begin(inky_spidev_intf *iptr)
+{
+	inky_error_state rst = INKY_OK;
+	inky_spidev_idle *idle = &iptr->idle;
+
+	pthread_mutex_lock(&iptr->lock);
+
+	rst = inky_spidev_bus_enter(iptr);
+	if (rst != INKY_OK) {
+		pthread_mutex_unlock(&iptr->lock);
+		return rst;
+	}
+
+	if (!idle->enabled) {
+		++iptr->hw_depth;
+		return INKY_OK;
+	}
+
+	if (idle->asleep) {
+		rst = idle_acquire(iptr);
+	}
+
+	if (rst != INKY_OK) {
+		inky_spidev_bus_leave(iptr);
+		pthread_mutex_unlock(&iptr->lock);
+		return rst;
+	}
+
+	++idle->active;
+	++iptr->hw_depth;
+
+	return INKY_OK;
+}
+
+inky_error_state inky_spidev_hw_end(inky_spidev_intf *iptr)
+{
+	inky_error_state rst = INKY_OK;
+	inky_spidev_idle *idle = &iptr->idle;
+
+	/* Words batched in 3-wire mode go out before the bus is let go */
+	if (--iptr->hw_depth == 0) {
+		rst = inky_spidev_wire_flush(iptr);
+	}
+
+	if (idle->enabled) {
+		clock_gettime(CLOCK_MONOTONIC, &idle->last_use);
+
+		if (idle->active > 0 && --idle->active == 0) {
+			pthread_cond_broadcast(&idle->cond);
+		}
+	}
+
+	inky_spidev_bus_leave(iptr);
+
+	pthread_mutex_unlock(&iptr->lock);
+
+	return rst;
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+static void *idle_worker(void *arg)
+{
+	inky_spidev_intf *iptr = (inky_spidev_intf*) arg;
+	inky_spidev_idle *idle = &iptr->idle;
+
+	pthread_mutex_lock(&iptr->lock);
+
+	while (!idle->stop) {
+		struct timespec now;
+		struct timespec deadline;
+
+		if (idle->asleep || idle->active > 0) {
+			pthread_cond_wait(&idle->cond, &iptr->lock);
+			continue;
+		}
+
+		deadline = idle->last_use;
+		deadline.tv_sec += idle->timeout_ms / 1000;
+		deadline.tv_nsec += (long) (idle->timeout_ms % 1000) * 1000000;
+
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec += 1;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		if (now.tv_sec > deadline.tv_sec
+		    || (now.tv_sec == deadline.tv_sec
+			&& now.tv_nsec >= deadline.tv_nsec)) {
+			idle_release(iptr);
+			continue;
+		}
+
+		pthread_cond_timedwait(&idle->cond, &iptr->lock, &deadline);
+	}
+
+	pthread_mutex_unlock(&iptr->lock);
+
+	return NULL;
+}
+
+/* Called with the interface lock held */
+static inky_error_state idle_release(inky_spidev_intf *iptr)
+{
+	inky_spidev_idle *idle = &iptr->idle;
+
+	/* Only a configured controller needs to be told to sleep; one
+	 * that was never set up is still in reset */
+	if (idle->ctrl_ready && iptr->fd > 0) {
+		inky_spidev_cmd_sleep(iptr);
+	}
+
+	if (iptr->fd > 0) {
+		close(iptr->fd);
+		iptr->fd = -1;
+	}
+
+	for (int i = 0; i < INKY_SPIDEV_PINS; ++i) {
+		if (iptr->pincfg[i].valid) {
+			gpiod_line_release(iptr->pincfg[i].line);
+		}
+	}
+
+	idle->asleep = true;
+	idle->ctrl_ready = false;
+
+	return INKY_OK;
+}
+
+/* Called with the interface lock held */
+static inky_error_state idle_acquire(inky_spidev_intf *iptr)
+{
+	inky_error_state rst;
+	inky_config *dev = &iptr->dev;
+
+	/* Clear first so the callbacks below don't recurse into here */
+	iptr->idle.asleep = false;
+
+	rst = dev->spi_setup_cb(dev->intf_ptr);
+	if (rst != INKY_OK) {
+		iptr->idle.asleep = true;
+		return rst;
+	}
+
+	for (int i = 0; i < INKY_SPIDEV_PINS; ++i) {
+		inky_spidev_pincfg cfg = iptr->pincfg[i];
+
+		if (!cfg.valid) {
+			continue;
+		}
+
+		rst = dev->gpio_setup_pin_cb(cfg.pin, cfg.dir, cfg.state,
+					     cfg.pull, dev->intf_ptr);
+		if (rst != INKY_OK) {
+			return rst;
+		}
+	}
+
+	return INKY_OK;
+}
@@ -0,0 +1,32 @@
+/**
+ * @file inky-spidev-idle.h
+ *
+ * Internal hooks between the hardware callbacks, the interface lock and
+ * the idle manager.
+ */
+
+#ifndef INKY_SPIDEV_IDLE_H
+#define INKY_SPIDEV_IDLE_H
+
+#include <inky-spidev.h>
+
+/* Reset pulse used when waking from deep sleep */
+#define INKY_SPIDEV_WAKE_RESET_US 10000
+
+/** @brief Start a hardware access
+ *
+ * Takes the interface lock and the shared bus, if one is attached,
+ * and, if the idle manager has put the controller to sleep, reclaims
+ * the file descriptor and lines. Both are only kept on success.
+ */
+inky_error_state inky_spidev_hw_begin(inky_spidev_intf *iptr);
+
+/** @brief End a hardware access, releasing the bus and the lock
+ *
+ * The outermost access sends anything batched in 3-wire mode.
+ *
+ *  @return Result of that send
+ */
+inky_error_state inky_spidev_hw_end(inky_spidev_intf *iptr);
+
+#endif /* #ifndef INKY_SPIDEV_IDLE_H */
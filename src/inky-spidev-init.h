@@ -0,0 +1,26 @@
+/**
+ * @file inky-spidev-init.h
+ *
+ * Interface setup shared by inky_spidev_init() and the test suite,
+ * which runs the callbacks over a stand-in transport without a GPIO
+ * chip.
+ */
+
+#ifndef INKY_SPIDEV_INIT_H
+#define INKY_SPIDEV_INIT_H
+
+#include <inky-spidev.h>
+
+/** @brief Set up everything in the interface except the GPIO lines
+ *
+ * The lock, the callbacks, the default panel and the state of every
+ * feature start the same as after inky_spidev_init(). The GPIO fields
+ * are left alone.
+ *
+ *  @param intf_ptr Interface to set up
+ *  @param spidev spidev special file
+ */
+void inky_spidev_init_common(inky_spidev_intf *intf_ptr,
+			     const char *spidev);
+
+#endif /* #ifndef INKY_SPIDEV_INIT_H */
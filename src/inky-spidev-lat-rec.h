@@ -0,0 +1,25 @@
+/**
+ * @file inky-spidev-lat-rec.h
+ *
+ * Internal hooks used by the present and buffering code to feed the
+ * latency tracker attached to an interface.
+ */
+
+#ifndef INKY_SPIDEV_LAT_REC_H
+#define INKY_SPIDEV_LAT_REC_H
+
+#include <inky-spidev-lat.h>
+
+/** @brief Record one present
+ *  @param stamp Stamp of the framebuffer presented
+ *  @param times Upload and glass times, the rest is taken from stamp
+ *  @param rst Result of the present
+ */
+void inky_spidev_lat_record(inky_spidev_lat *lat,
+			    const inky_spidev_stamp *stamp,
+			    const inky_spidev_lat_rec *times, int8_t rst);
+
+/** @brief Count a frame replaced before it was uploaded */
+void inky_spidev_lat_drop(inky_spidev_lat *lat);
+
+#endif /* #ifndef INKY_SPIDEV_LAT_REC_H */
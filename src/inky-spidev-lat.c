@@ -0,0 +1,273 @@
+#include <inky-spidev-lat.h>
+
+#include "inky-spidev-lat-rec.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint32_t collect(inky_spidev_lat *lat, inky_spidev_lat_stage stage,
+			uint64_t *vals);
+
+static uint64_t nearest_rank(const uint64_t *sorted, uint32_t n,
+			     double pct);
+
+static int cmp_u64(const void *a, const void *b);
+
+static uint64_t span(uint64_t from, uint64_t to);
+
+/*
+**********************************************************************
+******************** LATENCY TRACKER IMPLEMENTATION ******************
+**********************************************************************
+*/
+
+uint64_t inky_spidev_lat_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int8_t inky_spidev_lat_init(inky_spidev_lat *lat)
+{
+	if (!lat) {
+		return INKY_E_NULL_PTR;
+	}
+
+	memset(lat->recs, 0, sizeof(lat->recs));
+	lat->presented = 0;
+	lat->dropped = 0;
+
+	if (pthread_mutex_init(&lat->lock, NULL) != 0) {
+		return INKY_E_FAILURE;
+	}
+
+	return INKY_OK;
+}
+
+void inky_spidev_lat_deinit(inky_spidev_lat *lat)
+{
+	pthread_mutex_destroy(&lat->lock);
+}
+
+int8_t inky_spidev_lat_attach(inky_spidev_intf *intf_ptr,
+			      inky_spidev_lat *lat)
+{
+	if (!intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	inky_spidev_lock(intf_ptr);
+	intf_ptr->lat = lat;
+	inky_spidev_unlock(intf_ptr);
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_lat_find(inky_spidev_lat *lat, uint64_t id,
+			    inky_spidev_lat_rec *out)
+{
+	int8_t rst = INKY_E_OUT_OF_RANGE;
+	uint64_t n;
+
+	if (!lat || !out) {
+		return INKY_E_NULL_PTR;
+	}
+
+	pthread_mutex_lock(&lat->lock);
+
+	n = lat->presented < INKY_SPIDEV_LAT_LEN ?
+		lat->presented : INKY_SPIDEV_LAT_LEN;
+
+	/* Newest first, so a reused ID finds its latest frame */
+	for (uint64_t i = 1; i <= n; ++i) {
+		const inky_spidev_lat_rec *rec =
+			&lat->recs[(lat->presented - i) % INKY_SPIDEV_LAT_LEN];
+
+		if (rec->id == id) {
+			*out = *rec;
+			rst = INKY_OK;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&lat->lock);
+
+	return rst;
+}
+
+uint64_t inky_spidev_lat_stage_us(const inky_spidev_lat_rec *rec,
+				  inky_spidev_lat_stage stage)
+{
+	uint64_t ready = rec->converted_us ? rec->converted_us :
+		rec->queued_us;
+
+	switch (stage) {
+	case INKY_SPIDEV_LAT_QUEUE:
+		return span(rec->content_us, rec->queued_us);
+	case INKY_SPIDEV_LAT_CONVERT:
+		return rec->converted_us ?
+			span(rec->queued_us, rec->converted_us) : 0;
+	case INKY_SPIDEV_LAT_WAIT:
+		return span(ready, rec->upload_start_us);
+	case INKY_SPIDEV_LAT_UPLOAD:
+		return span(rec->upload_start_us, rec->upload_end_us);
+	case INKY_SPIDEV_LAT_REFRESH:
+		return span(rec->upload_end_us, rec->glass_us);
+	case INKY_SPIDEV_LAT_TOTAL:
+		return span(rec->content_us, rec->glass_us);
+	default:
+		return 0;
+	}
+}
+
+int8_t inky_spidev_lat_percentile(inky_spidev_lat *lat,
+				  inky_spidev_lat_stage stage, double pct,
+				  uint64_t *out_us)
+{
+	uint64_t vals[INKY_SPIDEV_LAT_LEN];
+	uint32_t n;
+
+	if (!lat || !out_us) {
+		return INKY_E_NULL_PTR;
+	}
+
+	if (stage >= INKY_SPIDEV_LAT_STAGES || !(pct >= 0.0 && pct <= 100.0)) {
+		return INKY_E_OUT_OF_RANGE;
+	}
+
+	n = collect(lat, stage, vals);
+
+	if (n == 0) {
+		return INKY_E_NOT_CONFIGURED;
+	}
+
+	*out_us = nearest_rank(vals, n, pct);
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_lat_summary(inky_spidev_lat *lat,
+			       inky_spidev_lat_stage stage,
+			       inky_spidev_lat_stats *out)
+{
+	uint64_t vals[INKY_SPIDEV_LAT_LEN];
+	uint64_t sum = 0;
+	uint32_t n;
+
+	if (!lat || !out) {
+		return INKY_E_NULL_PTR;
+	}
+
+	if (stage >= INKY_SPIDEV_LAT_STAGES) {
+		return INKY_E_OUT_OF_RANGE;
+	}
+
+	n = collect(lat, stage, vals);
+
+	if (n == 0) {
+		return INKY_E_NOT_CONFIGURED;
+	}
+
+	for (uint32_t i = 0; i < n; ++i) {
+		sum += vals[i];
+	}
+
+	out->frames = n;
+	out->min_us = vals[0];
+	out->p50_us = nearest_rank(vals, n, 50.0);
+	out->p90_us = nearest_rank(vals, n, 90.0);
+	out->p99_us = nearest_rank(vals, n, 99.0);
+	out->max_us = vals[n - 1];
+	out->mean_us = sum / n;
+
+	return INKY_OK;
+}
+
+void inky_spidev_lat_record(inky_spidev_lat *lat,
+			    const inky_spidev_stamp *stamp,
+			    const inky_spidev_lat_rec *times, int8_t rst)
+{
+	inky_spidev_lat_rec rec = *times;
+
+	/* Presented directly, a frame is handed over when the present
+	 * starts; without a stamp its content is only that new */
+	rec.id = stamp->id;
+	rec.queued_us = stamp->queued_us ? stamp->queued_us :
+		times->upload_start_us;
+	rec.content_us = stamp->content_us ? stamp->content_us :
+		rec.queued_us;
+	rec.converted_us = stamp->converted_us;
+	rec.rst = rst;
+
+	pthread_mutex_lock(&lat->lock);
+	lat->recs[lat->presented % INKY_SPIDEV_LAT_LEN] = rec;
+	++lat->presented;
+	pthread_mutex_unlock(&lat->lock);
+}
+
+void inky_spidev_lat_drop(inky_spidev_lat *lat)
+{
+	pthread_mutex_lock(&lat->lock);
+	++lat->dropped;
+	pthread_mutex_unlock(&lat->lock);
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+/* Sorted stage lengths of the remembered successful frames */
+static uint32_t collect(inky_spidev_lat *lat, inky_spidev_lat_stage stage,
+			uint64_t *vals)
+{
+	uint32_t n = 0;
+	uint64_t have;
+
+	pthread_mutex_lock(&lat->lock);
+
+	have = lat->presented < INKY_SPIDEV_LAT_LEN ?
+		lat->presented : INKY_SPIDEV_LAT_LEN;
+
+	for (uint64_t i = 0; i < have; ++i) {
+		if (lat->recs[i].rst == INKY_OK) {
+			vals[n++] = inky_spidev_lat_stage_us(&lat->recs[i],
+							     stage);
+		}
+	}
+
+	pthread_mutex_unlock(&lat->lock);
+
+	qsort(vals, n, sizeof(vals[0]), cmp_u64);
+
+	return n;
+}
+
+static uint64_t nearest_rank(const uint64_t *sorted, uint32_t n,
+			     double pct)
+{
+	uint32_t rank = (uint32_t) ceil(pct / 100.0 * n);
+
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*) a;
+	uint64_t y = *(const uint64_t*) b;
+
+	return (x > y) - (x < y);
+}
+
+/* Stamps come from the caller's clock reads, so don't trust their
+ * order to the microsecond */
+static uint64_t span(uint64_t from, uint64_t to)
+{
+	return to > from ? to - from : 0;
+}
@@ -0,0 +1,22 @@
+/**
+ * @file inky-spidev-model-rec.h
+ *
+ * Internal hook used by the present code to feed the refresh time
+ * model attached to an interface.
+ */
+
+#ifndef INKY_SPIDEV_MODEL_REC_H
+#define INKY_SPIDEV_MODEL_REC_H
+
+#include <inky-spidev-model.h>
+
+/** @brief Record one present, reading the temperature the controller
+ *  loaded for the refresh that just finished
+ *
+ * Called with the interface lock held and the controller awake.
+ */
+void inky_spidev_model_sample(inky_spidev_intf *iptr,
+			      const inky_spidev_fb *fb,
+			      uint32_t upload_us, uint32_t refresh_us);
+
+#endif /* #ifndef INKY_SPIDEV_MODEL_REC_H */
@@ -0,0 +1,412 @@
+#include <inky-spidev-model.h>
+
+#include "inky-spidev-cmd.h"
+#include "inky-spidev-idle.h"
+#include "inky-spidev-model-rec.h"
+#include "inky-spidev-seq-rec.h"
+#include "inky-spidev-temp.h"
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+/* Keeps the temperature slope solvable while every sample so far was
+ * taken at the same temperature; it then just stays near zero */
+#define MODEL_RIDGE 1e-3
+
+static void lsq_add(inky_spidev_lsq *lsq, const double *x, int k,
+		    double y);
+
+static bool lsq_solve(const inky_spidev_lsq *lsq, int k, double *beta,
+		      double *sigma);
+
+static inky_error_state read_internal(inky_spidev_intf *iptr,
+				      int16_t *temp);
+
+static bool temp_fresh(const inky_spidev_model *model);
+
+static uint64_t mono_us(const struct timespec *ts);
+
+/*
+**********************************************************************
+******************* REFRESH MODEL IMPLEMENTATION *********************
+**********************************************************************
+*/
+
+int8_t inky_spidev_model_init(inky_spidev_model *model)
+{
+	if (!model) {
+		return INKY_E_NULL_PTR;
+	}
+
+	memset(model, 0, sizeof(*model));
+	model->temp = INKY_SPIDEV_TEMP_UNKNOWN;
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_model_attach(inky_spidev_intf *intf_ptr,
+				inky_spidev_model *model)
+{
+	if (!intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	inky_spidev_lock(intf_ptr);
+	intf_ptr->model = model;
+	inky_spidev_unlock(intf_ptr);
+
+	return INKY_OK;
+}
+
+void inky_spidev_model_add(inky_spidev_model *model, int16_t temp,
+			   double color, uint32_t upload_us,
+			   uint32_t refresh_us)
+{
+	double x[3] = {1.0, color, temp / 10.0};
+
+	if (model->samples == 0) {
+		model->upload_us = upload_us;
+	} else {
+		model->upload_us += (upload_us - model->upload_us) / 4;
+	}
+
+	++model->samples;
+
+	lsq_add(&model->color_fit, x, 2, refresh_us);
+
+	if (temp != INKY_SPIDEV_TEMP_UNKNOWN) {
+		lsq_add(&model->temp_fit, x, 3, refresh_us);
+	}
+}
+
+uint32_t inky_spidev_model_predict(const inky_spidev_model *model,
+				   int16_t temp, double color,
+				   uint32_t *margin_us)
+{
+	const inky_spidev_lsq *mean = &model->color_fit;
+	double x[3] = {1.0, color, temp / 10.0};
+	double beta[3];
+	double sigma = 0.0;
+	double refresh;
+	double total;
+
+	if (temp != INKY_SPIDEV_TEMP_UNKNOWN
+	    && lsq_solve(&model->temp_fit, 3, beta, &sigma)) {
+		refresh = beta[0] + beta[1] * x[1] + beta[2] * x[2];
+	} else if (lsq_solve(&model->color_fit, 2, beta, &sigma)) {
+		refresh = beta[0] + beta[1] * x[1];
+	} else if (model->samples > 0) {
+		refresh = mean->xy[0] / mean->n;
+		sigma = sqrt(fmax(mean->yy / mean->n - refresh * refresh,
+				  0.0));
+	} else {
+		refresh = INKY_SPIDEV_MODEL_DEFAULT_US;
+	}
+
+	total = fmax(refresh, 0.0) + model->upload_us;
+
+	/* Two sigma covers nearly all refreshes the fit has seen */
+	if (margin_us) {
+		*margin_us = (uint32_t) fmin(2.0 * sigma
+					     + INKY_SPIDEV_MODEL_SLACK_US,
+					     UINT32_MAX);
+	}
+
+	return (uint32_t) fmin(total, UINT32_MAX);
+}
+
+double inky_spidev_fb_color_fraction(const inky_spidev_fb *fb)
+{
+	const uint8_t *plane = fb->planes[INKY_SPIDEV_PLANE_COLOR];
+	uint64_t set = 0;
+	uint32_t i = 0;
+	uint64_t word;
+
+	if (fb->width == 0 || fb->height == 0) {
+		return 0.0;
+	}
+
+	for (; i + 8 <= fb->plane_len; i += 8) {
+		memcpy(&word, plane + i, 8);
+		set += __builtin_popcountll(word);
+	}
+
+	for (; i < fb->plane_len; ++i) {
+		set += __builtin_popcount(plane[i]);
+	}
+
+	return fmin((double) set / ((uint32_t) fb->width * fb->height), 1.0);
+}
+
+int8_t inky_spidev_temperature(inky_spidev_intf *intf_ptr, int16_t *temp)
+{
+	inky_error_state rst;
+
+	if (!intf_ptr || !temp) {
+		return INKY_E_NULL_PTR;
+	}
+
+	inky_spidev_lock(intf_ptr);
+
+	/* An external source is what the waveform is picked by */
+	if (intf_ptr->temp.source == INKY_SPIDEV_TEMP_INTERNAL) {
+		rst = read_internal(intf_ptr, temp);
+	} else {
+		rst = inky_spidev_temp_read(intf_ptr, temp);
+	}
+
+	if (intf_ptr->model) {
+		/* Also stamp failures so a board without MISO isn't
+		 * probed before every scheduled present */
+		clock_gettime(CLOCK_MONOTONIC, &intf_ptr->model->temp_time);
+
+		if (rst == INKY_OK) {
+			intf_ptr->model->temp = *temp;
+		}
+	}
+
+	inky_spidev_unlock(intf_ptr);
+
+	return rst;
+}
+
+int8_t inky_spidev_present_by(inky_spidev_intf *intf_ptr,
+			      const inky_spidev_fb *fb,
+			      const struct timespec *deadline,
+			      int64_t *slack_us)
+{
+	int8_t rst;
+	inky_spidev_model *model;
+	struct timespec start = *deadline;
+	struct timespec now;
+	uint32_t expect = 0;
+	uint32_t margin = 0;
+	uint64_t lead;
+	int16_t temp;
+
+	if (!intf_ptr || !fb || !deadline) {
+		return INKY_E_NULL_PTR;
+	}
+
+	inky_spidev_lock(intf_ptr);
+
+	model = intf_ptr->model;
+
+	if (model && !temp_fresh(model)) {
+		inky_spidev_temperature(intf_ptr, &temp);
+	}
+
+	if (model) {
+		expect = inky_spidev_model_predict(model, model->temp,
+			inky_spidev_fb_color_fraction(fb), &margin);
+	}
+
+	inky_spidev_unlock(intf_ptr);
+
+	lead = (uint64_t) expect + margin;
+	start.tv_sec -= lead / 1000000;
+	start.tv_nsec -= (lead % 1000000) * 1000;
+
+	if (start.tv_nsec < 0) {
+		start.tv_sec -= 1;
+		start.tv_nsec += 1000000000;
+	}
+
+	/* Returns at once if the start time has already passed */
+	while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &start,
+			       NULL) == EINTR)
+		;
+
+	rst = inky_spidev_fb_present(intf_ptr, fb);
+
+	if (slack_us) {
+		clock_gettime(CLOCK_REALTIME, &now);
+		*slack_us = (int64_t) (deadline->tv_sec - now.tv_sec) * 1000000
+			+ (deadline->tv_nsec - now.tv_nsec) / 1000;
+	}
+
+	return rst;
+}
+
+void inky_spidev_model_sample(inky_spidev_intf *iptr,
+			      const inky_spidev_fb *fb,
+			      uint32_t upload_us, uint32_t refresh_us)
+{
+	inky_spidev_model *model = iptr->model;
+	int16_t temp;
+
+	/* Either the full update sequence loaded the sensor for this
+	 * refresh, or the waveform was picked from the external source */
+	if ((iptr->temp.source == INKY_SPIDEV_TEMP_INTERNAL ?
+	     inky_spidev_cmd_read_temp(iptr, &temp) :
+	     inky_spidev_temp_read(iptr, &temp)) == INKY_OK) {
+		model->temp = temp;
+		clock_gettime(CLOCK_MONOTONIC, &model->temp_time);
+	} else {
+		temp = INKY_SPIDEV_TEMP_UNKNOWN;
+	}
+
+	inky_spidev_model_add(model, temp, inky_spidev_fb_color_fraction(fb),
+			      upload_us, refresh_us);
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+static void lsq_add(inky_spidev_lsq *lsq, const double *x, int k,
+		    double y)
+{
+	const double d = INKY_SPIDEV_MODEL_DECAY;
+
+	lsq->n = lsq->n * d + 1.0;
+	lsq->yy = lsq->yy * d + y * y;
+
+	for (int i = 0; i < k; ++i) {
+		lsq->xy[i] = lsq->xy[i] * d + x[i] * y;
+
+		for (int j = 0; j < k; ++j) {
+			lsq->xx[i][j] = lsq->xx[i][j] * d + x[i] * x[j];
+		}
+	}
+
+	++lsq->count;
+}
+
+/* Solve the k x k normal equations by Gaussian elimination and report
+ * the residual spread of the fit */
+static bool lsq_solve(const inky_spidev_lsq *lsq, int k, double *beta,
+		      double *sigma)
+{
+	double a[3][4];
+	double sse;
+
+	if (lsq->count < INKY_SPIDEV_MODEL_MIN_SAMPLES) {
+		return false;
+	}
+
+	for (int i = 0; i < k; ++i) {
+		for (int j = 0; j < k; ++j) {
+			a[i][j] = lsq->xx[i][j];
+		}
+
+		a[i][i] += i > 0 ? MODEL_RIDGE * lsq->n : 0.0;
+		a[i][k] = lsq->xy[i];
+	}
+
+	for (int c = 0; c < k; ++c) {
+		int p = c;
+
+		for (int r = c + 1; r < k; ++r) {
+			if (fabs(a[r][c]) > fabs(a[p][c])) {
+				p = r;
+			}
+		}
+
+		if (fabs(a[p][c]) < 1e-12) {
+			return false;
+		}
+
+		for (int j = c; j <= k; ++j) {
+			double t = a[c][j];
+
+			a[c][j] = a[p][j];
+			a[p][j] = t;
+		}
+
+		for (int r = c + 1; r < k; ++r) {
+			double f = a[r][c] / a[c][c];
+
+			for (int j = c; j <= k; ++j) {
+				a[r][j] -= f * a[c][j];
+			}
+		}
+	}
+
+	for (int i = k - 1; i >= 0; --i) {
+		beta[i] = a[i][k];
+
+		for (int j = i + 1; j < k; ++j) {
+			beta[i] -= a[i][j] * beta[j];
+		}
+
+		beta[i] /= a[i][i];
+	}
+
+	/* SSE = y'y - 2 b'X'y + b'X'X b */
+	sse = lsq->yy;
+
+	for (int i = 0; i < k; ++i) {
+		sse -= 2.0 * beta[i] * lsq->xy[i];
+
+		for (int j = 0; j < k; ++j) {
+			sse += beta[i] * lsq->xx[i][j] * beta[j];
+		}
+	}
+
+	*sigma = lsq->n > k ? sqrt(fmax(sse, 0.0) / (lsq->n - k)) : 0.0;
+
+	return true;
+}
+
+static inky_error_state read_internal(inky_spidev_intf *iptr,
+				      int16_t *temp)
+{
+	inky_error_state rst;
+	inky_spidev_idle *idle = &iptr->idle;
+
+	rst = inky_spidev_hw_begin(iptr);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	/* Same wake path as a present; the sensor runs off the analog
+	 * block that setup configures */
+	if (!idle->enabled || !idle->ctrl_ready) {
+		rst = inky_spidev_seq_init_controller(iptr, iptr->width,
+						      iptr->height,
+						      idle->enabled ?
+						      INKY_SPIDEV_WAKE_RESET_US :
+						      INKY_CMD_RESET_US);
+		idle->ctrl_ready = rst == INKY_OK;
+	}
+
+	if (rst == INKY_OK) {
+		rst = inky_spidev_cmd_load_temp(iptr);
+	}
+
+	if (rst == INKY_OK) {
+		rst = inky_spidev_cmd_read_temp(iptr, temp);
+	}
+
+	if (!idle->enabled && idle->ctrl_ready) {
+		idle->ctrl_ready = false;
+		inky_spidev_cmd_sleep(iptr);
+	}
+
+	inky_spidev_hw_end(iptr);
+
+	return rst;
+}
+
+static bool temp_fresh(const inky_spidev_model *model)
+{
+	struct timespec now;
+
+	if (model->temp_time.tv_sec == 0 && model->temp_time.tv_nsec == 0) {
+		return false;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return mono_us(&now) - mono_us(&model->temp_time)
+		< (uint64_t) INKY_SPIDEV_MODEL_TEMP_AGE_S * 1000000;
+}
+
+static uint64_t mono_us(const struct timespec *ts)
+{
+	return (uint64_t) ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+}
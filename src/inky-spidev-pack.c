@@ -0,0 +1,232 @@
+#include <inky-spidev-pack.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PACK_BAND 8
+
+static void pack_row(const uint8_t *src, uint16_t width, bool reverse,
+		     const inky_spidev_pack_cfg *cfg, uint8_t *bw,
+		     uint8_t *col);
+
+static uint64_t transpose8(uint64_t x);
+
+static uint8_t reverse8(uint8_t b);
+
+static void put8(uint8_t *row, uint16_t stride, int bit, uint8_t v,
+		 uint8_t m);
+
+static void rotate_band(inky_spidev_fb *fb, uint8_t *const band[2],
+			uint16_t band_stride, uint16_t width, uint16_t height,
+			int y0, int rows, bool cw);
+
+/*
+**********************************************************************
+******************* PACK IMPLEMENTATION ******************************
+**********************************************************************
+*/
+
+int8_t inky_spidev_fb_pack(inky_spidev_fb *fb, const uint8_t *pixels,
+			   uint16_t width, uint16_t height, uint32_t stride,
+			   const inky_spidev_pack_cfg *cfg)
+{
+	bool quarter;
+	uint16_t band_stride;
+	uint8_t *buf;
+	uint8_t *band[2];
+
+	if (!fb || !pixels || !cfg) {
+		return INKY_E_NULL_PTR;
+	}
+
+	quarter = cfg->rotation == INKY_SPIDEV_ROTATE_90
+		|| cfg->rotation == INKY_SPIDEV_ROTATE_270;
+
+	if ((quarter && (fb->width != height || fb->height != width))
+	    || (!quarter && (fb->width != width || fb->height != height))) {
+		return INKY_E_OUT_OF_RANGE;
+	}
+
+	/* Upright and half turns keep rows intact, so pack straight into
+	 * the destination; a half turn is a mirrored, bottom up pack */
+	if (!quarter) {
+		bool flip = cfg->rotation == INKY_SPIDEV_ROTATE_180;
+
+		for (uint16_t y = 0; y < height; ++y) {
+			size_t off = (size_t) (flip ? height - 1 - y : y)
+				* fb->stride;
+
+			pack_row(pixels + (size_t) y * stride, width,
+				 cfg->mirror != flip, cfg,
+				 fb->planes[INKY_SPIDEV_PLANE_BW] + off,
+				 fb->planes[INKY_SPIDEV_PLANE_COLOR] + off);
+		}
+
+		return INKY_OK;
+	}
+
+	band_stride = (width + 7) / 8;
+	buf = calloc(2 * PACK_BAND, band_stride);
+
+	if (!buf) {
+		return INKY_E_FAILURE;
+	}
+
+	band[0] = buf;
+	band[1] = buf + PACK_BAND * band_stride;
+
+	for (int y0 = 0; y0 < height; y0 += PACK_BAND) {
+		int rows = height - y0 < PACK_BAND ? height - y0 : PACK_BAND;
+
+		for (int r = 0; r < rows; ++r) {
+			pack_row(pixels + (size_t) (y0 + r) * stride, width,
+				 cfg->mirror, cfg, band[0] + r * band_stride,
+				 band[1] + r * band_stride);
+		}
+
+		rotate_band(fb, band, band_stride, width, height, y0, rows,
+			    cfg->rotation == INKY_SPIDEV_ROTATE_90);
+	}
+
+	free(buf);
+
+	return INKY_OK;
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+/* Threshold one source row into packed BW and color bytes */
+static void pack_row(const uint8_t *src, uint16_t width, bool reverse,
+		     const inky_spidev_pack_cfg *cfg, uint8_t *bw,
+		     uint8_t *col)
+{
+	const int bpp = cfg->format == INKY_SPIDEV_PIX_RGB888 ? 3 : 1;
+	const unsigned int t = cfg->threshold;
+
+	for (uint16_t bx = 0; bx < (width + 7) / 8; ++bx) {
+		uint8_t b = 0;
+		uint8_t c = 0;
+
+		for (int i = 0; i < 8; ++i) {
+			int x = bx * 8 + i;
+			const uint8_t *p;
+			unsigned int luma;
+
+			if (x >= width) {
+				break;
+			}
+
+			p = src + (size_t) (reverse ? width - 1 - x : x) * bpp;
+
+			if (bpp == 1) {
+				luma = p[0];
+			} else {
+				/* Integer BT.601 weights */
+				luma = (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8;
+
+				if (cfg->color && p[0] >= t && p[2] < t) {
+					b |= 0x80 >> i;
+					c |= 0x80 >> i;
+					continue;
+				}
+			}
+
+			if (luma >= t) {
+				b |= 0x80 >> i;
+			}
+		}
+
+		bw[bx] = b;
+		col[bx] = c;
+	}
+}
+
+/* Transpose an 8x8 bit matrix held MSB first, row 0 in the top byte */
+static uint64_t transpose8(uint64_t x)
+{
+	uint64_t t;
+
+	t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+	x = x ^ t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+	x = x ^ t ^ (t << 14);
+	t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+	x = x ^ t ^ (t << 28);
+
+	return x;
+}
+
+static uint8_t reverse8(uint8_t b)
+{
+	b = (b & 0xf0) >> 4 | (b & 0x0f) << 4;
+	b = (b & 0xcc) >> 2 | (b & 0x33) << 2;
+	b = (b & 0xaa) >> 1 | (b & 0x55) << 1;
+
+	return b;
+}
+
+/* Store the bits of v selected by m at bit position bit of a row.
+ * Bits that land outside the row are dropped. */
+static void put8(uint8_t *row, uint16_t stride, int bit, uint8_t v,
+		 uint8_t m)
+{
+	int idx = bit >= 0 ? bit / 8 : -((7 - bit) / 8);
+	int s = bit - idx * 8;
+	uint16_t v16 = (uint16_t) ((v & m) << 8) >> s;
+	uint16_t m16 = (uint16_t) (m << 8) >> s;
+
+	if (idx >= 0 && idx < stride) {
+		row[idx] = (row[idx] & ~(m16 >> 8)) | (v16 >> 8);
+	}
+
+	if (s && idx + 1 >= 0 && idx + 1 < stride) {
+		row[idx + 1] = (row[idx + 1] & ~m16) | (v16 & 0xff);
+	}
+}
+
+/* Rotate a band of up to eight packed source rows starting at row y0
+ * into the destination. Source (x, y) lands at (height - 1 - y, x) for
+ * a clockwise turn and at (y, width - 1 - x) otherwise. */
+static void rotate_band(inky_spidev_fb *fb, uint8_t *const band[2],
+			uint16_t band_stride, uint16_t width, uint16_t height,
+			int y0, int rows, bool cw)
+{
+	/* Destination columns covered by the band, and which of the eight
+	 * bits hold real rows when the band is short */
+	const int dcol = cw ? height - y0 - PACK_BAND : y0;
+	const uint8_t valid = cw ? (uint8_t) (0xff >> (PACK_BAND - rows)) :
+		(uint8_t) (0xff << (PACK_BAND - rows));
+
+	for (int p = 0; p < INKY_SPIDEV_PLANES; ++p) {
+		for (uint16_t bx = 0; bx < band_stride; ++bx) {
+			uint64_t x = 0;
+
+			for (int r = 0; r < rows; ++r) {
+				x |= (uint64_t) band[p][r * band_stride + bx]
+					<< (56 - 8 * r);
+			}
+
+			x = transpose8(x);
+
+			for (int c = 0; c < PACK_BAND; ++c) {
+				int sx = bx * 8 + c;
+				int dy = cw ? sx : width - 1 - sx;
+				uint8_t v = x >> (56 - 8 * c);
+
+				if (sx >= width) {
+					break;
+				}
+
+				/* Clockwise, later source rows land further
+				 * left, so the byte is read in reverse */
+				put8(fb->planes[p] + (size_t) dy * fb->stride,
+				     fb->stride, dcol, cw ? reverse8(v) : v,
+				     valid);
+			}
+		}
+	}
+}
@@ -0,0 +1,321 @@
+#include <inky-spidev-pipe.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+static bool ring_push(inky_spidev_ring *ring, uint8_t v);
+
+static bool ring_pop(inky_spidev_ring *ring, uint8_t *v);
+
+static bool wait_fd(int fd);
+
+static void signal_fd(int fd);
+
+static void pipe_free(inky_spidev_pipe *pipe);
+
+static void *convert_worker(void *arg);
+
+/*
+**********************************************************************
+********************** PIPELINE IMPLEMENTATION ***********************
+**********************************************************************
+*/
+
+int8_t inky_spidev_pipe_init(inky_spidev_pipe *pipe,
+			     inky_spidev_intf *intf_ptr,
+			     uint16_t width, uint16_t height,
+			     const inky_spidev_pack_cfg *cfg, uint8_t depth)
+{
+	int8_t rst;
+	bool quarter;
+
+	if (!pipe || !intf_ptr || !cfg) {
+		return INKY_E_NULL_PTR;
+	}
+
+	if (depth < 2 || depth > INKY_SPIDEV_PIPE_MAX_DEPTH) {
+		return INKY_E_OUT_OF_RANGE;
+	}
+
+	memset(pipe, 0, sizeof(*pipe));
+	pipe->cfg = *cfg;
+	pipe->width = width;
+	pipe->height = height;
+	pipe->stride = (uint32_t) width
+		* (cfg->format == INKY_SPIDEV_PIX_RGB888 ? 3 : 1);
+	pipe->depth = depth;
+	pipe->cur = -1;
+	pipe->full_fd = eventfd(0, EFD_CLOEXEC);
+	pipe->empty_fd = eventfd(0, EFD_CLOEXEC);
+
+	atomic_init(&pipe->full.head, 0);
+	atomic_init(&pipe->full.tail, 0);
+	atomic_init(&pipe->empty.head, 0);
+	atomic_init(&pipe->empty.tail, 0);
+	atomic_init(&pipe->stop, false);
+	atomic_init(&pipe->last_rst, INKY_OK);
+	atomic_init(&pipe->rendered, 0);
+	atomic_init(&pipe->converted, 0);
+
+	rst = pipe->full_fd < 0 || pipe->empty_fd < 0 ?
+		INKY_E_FAILURE : INKY_OK;
+
+	for (uint8_t i = 0; i < depth && rst == INKY_OK; ++i) {
+		pipe->pixels[i] = calloc(height, pipe->stride);
+
+		if (!pipe->pixels[i]) {
+			rst = INKY_E_FAILURE;
+		}
+
+		ring_push(&pipe->empty, i);
+	}
+
+	if (rst != INKY_OK) {
+		pipe_free(pipe);
+		return rst;
+	}
+
+	quarter = cfg->rotation == INKY_SPIDEV_ROTATE_90
+		|| cfg->rotation == INKY_SPIDEV_ROTATE_270;
+
+	rst = inky_spidev_tbuf_init(&pipe->upload, intf_ptr,
+				    quarter ? height : width,
+				    quarter ? width : height);
+	if (rst != INKY_OK) {
+		pipe_free(pipe);
+		return rst;
+	}
+
+	if (pthread_create(&pipe->thread, NULL, convert_worker, pipe) != 0) {
+		inky_spidev_tbuf_deinit(&pipe->upload);
+		pipe_free(pipe);
+		return INKY_E_FAILURE;
+	}
+
+	return INKY_OK;
+}
+
+uint8_t *inky_spidev_pipe_acquire(inky_spidev_pipe *pipe)
+{
+	uint8_t slot;
+
+	if (pipe->cur >= 0) {
+		return pipe->pixels[pipe->cur];
+	}
+
+	/* Back-pressure: with every image queued or being converted,
+	 * wait for the convert stage to hand one back */
+	while (!ring_pop(&pipe->empty, &slot)) {
+		if (atomic_load(&pipe->stop) || !wait_fd(pipe->empty_fd)) {
+			return NULL;
+		}
+	}
+
+	pipe->cur = slot;
+	memset(&pipe->stamps[slot], 0, sizeof(pipe->stamps[slot]));
+
+	return pipe->pixels[slot];
+}
+
+int8_t inky_spidev_pipe_stamp(inky_spidev_pipe *pipe, uint64_t id,
+			      uint64_t content_us)
+{
+	inky_spidev_stamp *stamp;
+
+	if (pipe->cur < 0) {
+		return INKY_E_FAILURE;
+	}
+
+	stamp = &pipe->stamps[pipe->cur];
+	stamp->id = id;
+	stamp->content_us = content_us ? content_us :
+		inky_spidev_lat_now_us();
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_pipe_push(inky_spidev_pipe *pipe)
+{
+	int8_t rst;
+
+	if (pipe->cur < 0) {
+		return INKY_E_FAILURE;
+	}
+
+	pipe->stamps[pipe->cur].queued_us = inky_spidev_lat_now_us();
+
+	/* Can't fail: there are never more images than slots */
+	ring_push(&pipe->full, (uint8_t) pipe->cur);
+	pipe->cur = -1;
+
+	atomic_fetch_add_explicit(&pipe->rendered, 1, memory_order_relaxed);
+	signal_fd(pipe->full_fd);
+
+	rst = atomic_load_explicit(&pipe->last_rst, memory_order_relaxed);
+
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	return atomic_load_explicit(&pipe->upload.last_rst,
+				    memory_order_relaxed);
+}
+
+int8_t inky_spidev_pipe_deinit(inky_spidev_pipe *pipe)
+{
+	int8_t rst;
+	int8_t upload_rst;
+
+	atomic_store(&pipe->stop, true);
+	signal_fd(pipe->full_fd);
+	signal_fd(pipe->empty_fd);
+
+	pthread_join(pipe->thread, NULL);
+
+	upload_rst = inky_spidev_tbuf_deinit(&pipe->upload);
+	rst = atomic_load(&pipe->last_rst);
+
+	pipe_free(pipe);
+
+	return rst != INKY_OK ? rst : upload_rst;
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+static bool ring_push(inky_spidev_ring *ring, uint8_t v)
+{
+	unsigned int tail = atomic_load_explicit(&ring->tail,
+						 memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&ring->head,
+						 memory_order_acquire);
+
+	if (tail - head == INKY_SPIDEV_RING_LEN) {
+		return false;
+	}
+
+	ring->slots[tail % INKY_SPIDEV_RING_LEN] = v;
+
+	/* Release publishes the slot, and the image written before the
+	 * push, to the consumer */
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+	return true;
+}
+
+static bool ring_pop(inky_spidev_ring *ring, uint8_t *v)
+{
+	unsigned int head = atomic_load_explicit(&ring->head,
+						 memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&ring->tail,
+						 memory_order_acquire);
+
+	if (head == tail) {
+		return false;
+	}
+
+	*v = ring->slots[head % INKY_SPIDEV_RING_LEN];
+
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+	return true;
+}
+
+static bool wait_fd(int fd)
+{
+	uint64_t count;
+
+	while (read(fd, &count, sizeof(count)) != sizeof(count)) {
+		if (errno != EINTR) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void signal_fd(int fd)
+{
+	const uint64_t one = 1;
+
+	/* Counter semantics: signals sent while nobody waits coalesce
+	 * into one wakeup, which then finds the ring as it is now */
+	if (write(fd, &one, sizeof(one)) < 0) {
+		return;
+	}
+}
+
+static void pipe_free(inky_spidev_pipe *pipe)
+{
+	for (int i = 0; i < INKY_SPIDEV_PIPE_MAX_DEPTH; ++i) {
+		free(pipe->pixels[i]);
+		pipe->pixels[i] = NULL;
+	}
+
+	if (pipe->full_fd >= 0) {
+		close(pipe->full_fd);
+	}
+
+	if (pipe->empty_fd >= 0) {
+		close(pipe->empty_fd);
+	}
+
+	pipe->full_fd = -1;
+	pipe->empty_fd = -1;
+}
+
+static void *convert_worker(void *arg)
+{
+	inky_spidev_pipe *pipe = (inky_spidev_pipe*) arg;
+
+	for (;;) {
+		inky_spidev_fb *back;
+		uint8_t slot;
+		int8_t rst;
+		bool stopping;
+
+		/* Read stop first: everything pushed before it was set
+		 * is then visible to the pop, and gets converted */
+		stopping = atomic_load(&pipe->stop);
+
+		if (!ring_pop(&pipe->full, &slot)) {
+			if (stopping || !wait_fd(pipe->full_fd)) {
+				break;
+			}
+
+			continue;
+		}
+
+		back = inky_spidev_tbuf_back(&pipe->upload);
+		rst = inky_spidev_fb_pack(back, pipe->pixels[slot],
+					  pipe->width, pipe->height,
+					  pipe->stride, &pipe->cfg);
+
+		back->stamp = pipe->stamps[slot];
+		back->stamp.converted_us = inky_spidev_lat_now_us();
+
+		ring_push(&pipe->empty, slot);
+		signal_fd(pipe->empty_fd);
+
+		atomic_store_explicit(&pipe->last_rst, rst,
+				      memory_order_relaxed);
+
+		if (rst != INKY_OK) {
+			continue;
+		}
+
+		/* Latest wins: a frame still waiting for the uploader is
+		 * replaced, not queued behind */
+		inky_spidev_tbuf_submit(&pipe->upload);
+		atomic_fetch_add_explicit(&pipe->converted, 1,
+					  memory_order_relaxed);
+	}
+
+	return NULL;
+}
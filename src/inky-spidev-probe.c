@@ -0,0 +1,341 @@
+#include <inky-spidev-probe.h>
+
+#include "inky-spidev-cmd.h"
+#include "inky-spidev-idle.h"
+#include "inky-spidev-wire.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+/* Status bit read; low bits hold the chip ID on SSD16xx controllers */
+#define PROBE_CMD_STATUS 0x2f
+
+/* Hardware reset pulse, which also wakes the controller from deep
+ * sleep */
+#define PROBE_RESET_US 10000
+
+static int probe_cache_path(const inky_spidev_intf *iptr,
+			    const char *cache_dir, char *path, size_t len);
+
+static int8_t probe_cache_read(const char *path, inky_spidev_eeprom *out);
+
+static void probe_cache_write(const char *path,
+			      const inky_spidev_eeprom *ee);
+
+static int8_t probe_controller(inky_spidev_intf *iptr);
+
+static int8_t probe_setup(inky_spidev_intf *iptr);
+
+static void probe_teardown(inky_spidev_intf *iptr);
+
+static void probe_apply(inky_spidev_intf *iptr,
+			const inky_spidev_eeprom *ee);
+
+/*
+**********************************************************************
+******************* PROBE IMPLEMENTATION *****************************
+**********************************************************************
+*/
+
+int8_t inky_spidev_probe_eeprom(const char *i2cdev,
+				inky_spidev_eeprom *out)
+{
+	int fd;
+	int rst;
+	uint8_t addr[2] = {0x00, 0x00};
+	uint8_t raw[INKY_SPIDEV_EEPROM_LEN];
+	uint8_t wlen;
+
+	if (!i2cdev || !out) {
+		return INKY_E_NULL_PTR;
+	}
+
+	struct i2c_msg msgs[2] = {
+		{
+			.addr = INKY_SPIDEV_EEPROM_ADDR,
+			.flags = 0,
+			.len = sizeof(addr),
+			.buf = addr
+		},
+		{
+			.addr = INKY_SPIDEV_EEPROM_ADDR,
+			.flags = I2C_M_RD,
+			.len = sizeof(raw),
+			.buf = raw
+		}
+	};
+	struct i2c_rdwr_ioctl_data xfer = {
+		.msgs = msgs,
+		.nmsgs = 2
+	};
+
+	fd = open(i2cdev, O_RDWR);
+
+	if (fd < 0) {
+		return INKY_E_COMM_FAILURE;
+	}
+
+	rst = ioctl(fd, I2C_RDWR, &xfer);
+	close(fd);
+
+	if (rst < 0) {
+		return INKY_E_COMM_FAILURE;
+	}
+
+	/* Layout: width and height as little endian u16, color, pcb
+	 * variant, display variant, then a pascal string timestamp */
+	out->width = raw[0] | (raw[1] << 8);
+	out->height = raw[2] | (raw[3] << 8);
+	out->color = raw[4];
+	out->pcb_variant = raw[5];
+	out->display_variant = raw[6];
+
+	wlen = raw[7] < sizeof(out->write_time) - 1 ? raw[7] :
+		sizeof(out->write_time) - 1;
+	memcpy(out->write_time, raw + 8, wlen);
+	out->write_time[wlen] = '\0';
+
+	/* An erased or absent EEPROM reads back as all ones */
+	if (out->width == 0 || out->width == 0xffff
+	    || out->height == 0 || out->height == 0xffff) {
+		return INKY_E_NOT_CONFIGURED;
+	}
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_probe(inky_spidev_intf *intf_ptr, const char *i2cdev,
+			 const char *cache_dir)
+{
+	inky_spidev_eeprom ee;
+	char path[INKY_SPIDEV_PATH_LEN + INKY_SPIDEV_SPECIAL_LEN];
+	int cached;
+	int8_t rst;
+
+	if (!intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	cached = cache_dir && probe_cache_path(intf_ptr, cache_dir, path,
+					       sizeof(path)) == 0;
+
+	inky_spidev_lock(intf_ptr);
+
+	if (cached && probe_cache_read(path, &ee) == INKY_OK) {
+		probe_apply(intf_ptr, &ee);
+		inky_spidev_unlock(intf_ptr);
+		return INKY_OK;
+	}
+
+	rst = inky_spidev_probe_eeprom(i2cdev ? i2cdev :
+				       INKY_SPIDEV_I2C_DEFAULT, &ee);
+
+	if (rst == INKY_OK) {
+		probe_apply(intf_ptr, &ee);
+	} else {
+		/* Only says whether a panel is there, never what it is,
+		 * so the EEPROM is tried again next time */
+		rst = probe_controller(intf_ptr);
+	}
+
+	inky_spidev_unlock(intf_ptr);
+
+	if (rst == INKY_OK && cached) {
+		probe_cache_write(path, &ee);
+	}
+
+	return rst;
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+static int probe_cache_path(const inky_spidev_intf *iptr,
+			    const char *cache_dir, char *path, size_t len)
+{
+	char key[INKY_SPIDEV_SPECIAL_LEN];
+	size_t i;
+	int n;
+
+	/* Key on the spidev path with separators flattened */
+	for (i = 0; iptr->special[i] && i < sizeof(key) - 1; ++i) {
+		key[i] = iptr->special[i] == '/' ? '_' : iptr->special[i];
+	}
+
+	key[i] = '\0';
+
+	n = snprintf(path, len, "%s/probe%s", cache_dir, key);
+
+	return n > 0 && (size_t) n < len ? 0 : -1;
+}
+
+static int8_t probe_cache_read(const char *path, inky_spidev_eeprom *out)
+{
+	FILE *f;
+	unsigned int w, h, c, pcb, disp;
+	int n;
+
+	f = fopen(path, "r");
+
+	if (!f) {
+		return INKY_E_NOT_CONFIGURED;
+	}
+
+	n = fscanf(f, "%u %u %u %u %u", &w, &h, &c, &pcb, &disp);
+	fclose(f);
+
+	if (n != 5 || w == 0 || h == 0 || w > 0xffff || h > 0xffff) {
+		return INKY_E_FAILURE;
+	}
+
+	out->width = w;
+	out->height = h;
+	out->color = c;
+	out->pcb_variant = pcb;
+	out->display_variant = disp;
+	out->write_time[0] = '\0';
+
+	return INKY_OK;
+}
+
+static void probe_cache_write(const char *path,
+			      const inky_spidev_eeprom *ee)
+{
+	char tmp[INKY_SPIDEV_PATH_LEN + INKY_SPIDEV_SPECIAL_LEN + 8];
+	FILE *f;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	f = fopen(tmp, "w");
+
+	if (!f) {
+		return;
+	}
+
+	fprintf(f, "%u %u %u %u %u\n", ee->width, ee->height, ee->color,
+		ee->pcb_variant, ee->display_variant);
+
+	/* Rename so a concurrent reader never sees a partial file */
+	if (fclose(f) == 0) {
+		rename(tmp, path);
+	} else {
+		unlink(tmp);
+	}
+}
+
+static int8_t probe_controller(inky_spidev_intf *iptr)
+{
+	inky_error_state rst;
+	uint8_t status = 0;
+	bool borrowed = true;
+
+	/* Reading the status needs DC on its own line */
+	if (inky_spidev_wire_3(iptr)) {
+		return INKY_E_FAILURE;
+	}
+
+	for (int i = 0; i < INKY_SPIDEV_PINS; ++i) {
+		borrowed = borrowed && !iptr->pincfg[i].valid;
+	}
+
+	if (borrowed && probe_setup(iptr) != INKY_OK) {
+		probe_teardown(iptr);
+		return INKY_E_FAILURE;
+	}
+
+	rst = inky_spidev_hw_begin(iptr);
+
+	/* Going through the callbacks, the reset also clears what the
+	 * interface knows of the controller's RAM and LUT. A sleeping
+	 * controller doesn't answer on SPI, so it is reset first */
+	if (rst == INKY_OK) {
+		rst = inky_spidev_cmd_reset(iptr, PROBE_RESET_US);
+
+		if (rst == INKY_OK) {
+			rst = inky_spidev_cmd_read(iptr, PROBE_CMD_STATUS,
+						   &status, 1);
+		}
+
+		inky_spidev_hw_end(iptr);
+	}
+
+	if (borrowed) {
+		probe_teardown(iptr);
+	}
+
+	/* Without a MISO connection the bus floats to all zeros or
+	 * all ones, which tells us nothing */
+	if (rst != INKY_OK || status == 0x00 || status == 0xff) {
+		return INKY_E_COMM_FAILURE;
+	}
+
+	/* An SSD16xx controller answered, but its resolution and color
+	 * are not readable */
+	return INKY_E_NOT_CONFIGURED;
+}
+
+/* Set the interface up as inky_setup() does, for a probe before it */
+static int8_t probe_setup(inky_spidev_intf *iptr)
+{
+	inky_config *dev = &iptr->dev;
+	const struct {
+		inky_pin pin;
+		inky_gpio_direction dir;
+		inky_pin_state state;
+	} pins[] = {
+		{INKY_PIN_RESET, INKY_DIR_OUT, INKY_PINSTATE_HIGH},
+		{INKY_PIN_BUSY, INKY_DIR_IN, INKY_PINSTATE_LOW},
+		{INKY_PIN_DC, INKY_DIR_OUT, INKY_PINSTATE_LOW}
+	};
+	int8_t rst;
+
+	rst = dev->spi_setup_cb(dev->intf_ptr);
+
+	for (size_t i = 0; i < sizeof(pins) / sizeof(pins[0])
+	     && rst == INKY_OK; ++i) {
+		rst = dev->gpio_setup_pin_cb(pins[i].pin, pins[i].dir,
+					     pins[i].state, INKY_PINCFG_OFF,
+					     dev->intf_ptr);
+	}
+
+	return rst;
+}
+
+/* Undo probe_setup(), so inky_setup() finds the lines free */
+static void probe_teardown(inky_spidev_intf *iptr)
+{
+	for (int i = 0; i < INKY_SPIDEV_PINS; ++i) {
+		if (iptr->pincfg[i].valid) {
+			gpiod_line_release(iptr->pincfg[i].line);
+		}
+
+		iptr->pincfg[i].valid = false;
+	}
+
+	if (iptr->fd > 0) {
+		close(iptr->fd);
+	}
+
+	iptr->fd = 0;
+}
+
+static void probe_apply(inky_spidev_intf *iptr,
+			const inky_spidev_eeprom *ee)
+{
+	iptr->width = ee->width;
+	iptr->height = ee->height;
+	iptr->dev.pdt = ee->width >= 400 ? INKY_WHAT : INKY_PHAT;
+
+	iptr->color_cfg.white = 1;
+	iptr->color_cfg.black = 1;
+	iptr->color_cfg.red = ee->color == INKY_SPIDEV_EEPROM_RED;
+	iptr->color_cfg.yellow = ee->color == INKY_SPIDEV_EEPROM_YELLOW;
+}
@@ -0,0 +1,33 @@
+/**
+ * @file inky-spidev-seq-rec.h
+ *
+ * Internal hooks used by the hardware callbacks to feed a sequence
+ * being recorded, and the cached init path used by the present code.
+ */
+
+#ifndef INKY_SPIDEV_SEQ_REC_H
+#define INKY_SPIDEV_SEQ_REC_H
+
+#include <inky-spidev-seq.h>
+
+void inky_spidev_seq_rec_pin(inky_spidev_intf *iptr, inky_pin gpin,
+			     inky_pin_state gstate);
+
+void inky_spidev_seq_rec_data(inky_spidev_intf *iptr, const uint8_t *buf,
+			      uint32_t len);
+
+void inky_spidev_seq_rec_delay(inky_spidev_intf *iptr, uint32_t delay_us);
+
+void inky_spidev_seq_rec_busy(inky_spidev_intf *iptr, uint64_t timeout,
+			      uint32_t measured_us);
+
+/** @brief Reset and configure the controller, replaying the cached
+ *  init sequence when one is available for this panel
+ *  @param pulse_us Reset pulse for the non-cached path
+ */
+inky_error_state inky_spidev_seq_init_controller(inky_spidev_intf *iptr,
+						 uint16_t width,
+						 uint16_t height,
+						 uint32_t pulse_us);
+
+#endif /* #ifndef INKY_SPIDEV_SEQ_REC_H */
@@ -0,0 +1,576 @@
+#include <inky-spidev-seq.h>
+
+#include "inky-spidev-cmd.h"
+#include "inky-spidev-idle.h"
+#include "inky-spidev-seq-rec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define SEQ_HEADER_LEN 14
+#define SEQ_DATA_MAX 0xffff
+
+static inky_error_state replay(inky_spidev_intf *intf_ptr,
+			       const inky_spidev_seq *seq);
+
+static int seq_reserve(inky_spidev_seq *seq, uint32_t extra);
+
+static int seq_put(inky_spidev_seq *seq, const uint8_t *bytes,
+		   uint32_t len);
+
+static uint32_t seq_record_len(const uint8_t *rec, uint32_t avail);
+
+static void put_le16(uint8_t *p, uint16_t v);
+
+static void put_le32(uint8_t *p, uint32_t v);
+
+static uint16_t get_le16(const uint8_t *p);
+
+static uint32_t get_le32(const uint8_t *p);
+
+/*
+**********************************************************************
+******************* SEQUENCE IMPLEMENTATION **************************
+**********************************************************************
+*/
+
+int8_t inky_spidev_seq_record_begin(inky_spidev_intf *intf_ptr,
+				    inky_spidev_seq *seq)
+{
+	if (!intf_ptr || !seq) {
+		return INKY_E_NULL_PTR;
+	}
+
+	if (seq->cap == 0) {
+		seq->buf = NULL;
+	}
+
+	inky_spidev_lock(intf_ptr);
+
+	seq->len = 0;
+	seq->last_dc = -1;
+	seq->data_rec = 0;
+	intf_ptr->seq_rec = seq;
+
+	inky_spidev_unlock(intf_ptr);
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_seq_record_end(inky_spidev_intf *intf_ptr)
+{
+	if (!intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	inky_spidev_lock(intf_ptr);
+	intf_ptr->seq_rec = NULL;
+	inky_spidev_unlock(intf_ptr);
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_seq_replay(inky_spidev_intf *intf_ptr,
+			      const inky_spidev_seq *seq)
+{
+	int8_t rst;
+	int8_t end_rst;
+
+	if (!intf_ptr || !seq) {
+		return INKY_E_NULL_PTR;
+	}
+
+	/* Keep other threads' traffic out of the middle of the sequence,
+	 * and let short delays and 3-wire words batch across records */
+	rst = inky_spidev_hw_begin(intf_ptr);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	rst = replay(intf_ptr, seq);
+	end_rst = inky_spidev_hw_end(intf_ptr);
+
+	return rst != INKY_OK ? rst : end_rst;
+}
+
+int8_t inky_spidev_seq_save(const inky_spidev_seq *seq, const char *path)
+{
+	FILE *f;
+	uint8_t hdr[SEQ_HEADER_LEN];
+	int8_t rst = INKY_OK;
+
+	if (!seq || !path) {
+		return INKY_E_NULL_PTR;
+	}
+
+	if (seq->len > INKY_SPIDEV_SEQ_MAX_LEN) {
+		return INKY_E_OUT_OF_RANGE;
+	}
+
+	memcpy(hdr, INKY_SPIDEV_SEQ_MAGIC, 4);
+	hdr[4] = INKY_SPIDEV_SEQ_VERSION;
+	hdr[5] = 0;
+	put_le16(hdr + 6, seq->width);
+	put_le16(hdr + 8, seq->height);
+	put_le32(hdr + 10, seq->len);
+
+	f = fopen(path, "wb");
+
+	if (!f) {
+		return INKY_E_BAD_PERMISSIONS;
+	}
+
+	if (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr)
+	    || fwrite(seq->buf, 1, seq->len, f) != seq->len) {
+		rst = INKY_E_FAILURE;
+	}
+
+	if (fclose(f) != 0) {
+		rst = INKY_E_FAILURE;
+	}
+
+	return rst;
+}
+
+int8_t inky_spidev_seq_load(inky_spidev_seq *seq, const char *path)
+{
+	FILE *f;
+	struct stat st;
+	uint8_t hdr[SEQ_HEADER_LEN];
+	uint32_t len;
+
+	if (!seq || !path) {
+		return INKY_E_NULL_PTR;
+	}
+
+	f = fopen(path, "rb");
+
+	if (!f) {
+		return INKY_E_NOT_CONFIGURED;
+	}
+
+	if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr)
+	    || memcmp(hdr, INKY_SPIDEV_SEQ_MAGIC, 4) != 0
+	    || hdr[4] != INKY_SPIDEV_SEQ_VERSION) {
+		fclose(f);
+		return INKY_E_FAILURE;
+	}
+
+	len = get_le32(hdr + 10);
+	seq->len = 0;
+
+	/* The length is only trusted once the file agrees with it, so a
+	 * truncated or corrupt cache can't size the allocation */
+	if (len > INKY_SPIDEV_SEQ_MAX_LEN || fstat(fileno(f), &st) != 0
+	    || st.st_size != (off_t) SEQ_HEADER_LEN + len) {
+		fclose(f);
+		return INKY_E_FAILURE;
+	}
+
+	if (seq_reserve(seq, len) < 0 || fread(seq->buf, 1, len, f) != len) {
+		fclose(f);
+		return INKY_E_FAILURE;
+	}
+
+	fclose(f);
+
+	/* Walk the records so replay never runs off the end */
+	for (uint32_t pos = 0; pos < len;) {
+		uint32_t rlen = seq_record_len(seq->buf + pos, len - pos);
+
+		if (rlen == 0) {
+			return INKY_E_FAILURE;
+		}
+
+		pos += rlen;
+	}
+
+	seq->len = len;
+	seq->width = get_le16(hdr + 6);
+	seq->height = get_le16(hdr + 8);
+	seq->last_dc = -1;
+	seq->data_rec = 0;
+
+	return INKY_OK;
+}
+
+void inky_spidev_seq_free(inky_spidev_seq *seq)
+{
+	free(seq->buf);
+	seq->buf = NULL;
+	seq->len = 0;
+	seq->cap = 0;
+}
+
+int8_t inky_spidev_seq_cache_dir(inky_spidev_intf *intf_ptr,
+				 const char *dir)
+{
+	if (!intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	if (dir && strlen(dir) >= INKY_SPIDEV_PATH_LEN - 32) {
+		return INKY_E_OUT_OF_RANGE;
+	}
+
+	inky_spidev_lock(intf_ptr);
+
+	if (intf_ptr->init_seq) {
+		inky_spidev_seq_free(intf_ptr->init_seq);
+		free(intf_ptr->init_seq);
+		intf_ptr->init_seq = NULL;
+	}
+
+	if (dir) {
+		strcpy(intf_ptr->seq_dir, dir);
+	} else {
+		intf_ptr->seq_dir[0] = '\0';
+	}
+
+	inky_spidev_unlock(intf_ptr);
+
+	return INKY_OK;
+}
+
+/*
+**********************************************************************
+******************* RECORDING HOOKS **********************************
+**********************************************************************
+*/
+
+void inky_spidev_seq_rec_pin(inky_spidev_intf *iptr, inky_pin gpin,
+			     inky_pin_state gstate)
+{
+	inky_spidev_seq *seq = iptr->seq_rec;
+	uint8_t rec[2];
+
+	if (!seq || (gpin != INKY_PIN_DC && gpin != INKY_PIN_RESET)) {
+		return;
+	}
+
+	rec[1] = gstate == INKY_PINSTATE_HIGH;
+
+	if (gpin == INKY_PIN_DC) {
+		/* Only level changes matter on DC */
+		if (seq->last_dc == rec[1]) {
+			return;
+		}
+
+		seq->last_dc = rec[1];
+		rec[0] = INKY_SEQ_OP_DC;
+	} else {
+		rec[0] = INKY_SEQ_OP_RESET;
+	}
+
+	seq->data_rec = 0;
+	seq_put(seq, rec, sizeof(rec));
+}
+
+void inky_spidev_seq_rec_data(inky_spidev_intf *iptr, const uint8_t *buf,
+			      uint32_t len)
+{
+	inky_spidev_seq *seq = iptr->seq_rec;
+
+	if (!seq) {
+		return;
+	}
+
+	while (len > 0) {
+		uint32_t n;
+
+		/* Open a new data record unless the last one has room */
+		if (seq->data_rec
+		    && get_le16(seq->buf + seq->data_rec) == SEQ_DATA_MAX) {
+			seq->data_rec = 0;
+		}
+
+		if (!seq->data_rec) {
+			const uint8_t hdr[3] = {INKY_SEQ_OP_DATA, 0, 0};
+
+			if (seq_put(seq, hdr, sizeof(hdr)) < 0) {
+				return;
+			}
+
+			seq->data_rec = seq->len - 2;
+		}
+
+		n = SEQ_DATA_MAX - get_le16(seq->buf + seq->data_rec);
+
+		if (n > len) {
+			n = len;
+		}
+
+		if (seq_put(seq, buf, n) < 0) {
+			return;
+		}
+
+		put_le16(seq->buf + seq->data_rec,
+			 get_le16(seq->buf + seq->data_rec) + n);
+		buf += n;
+		len -= n;
+	}
+}
+
+void inky_spidev_seq_rec_delay(inky_spidev_intf *iptr, uint32_t delay_us)
+{
+	inky_spidev_seq *seq = iptr->seq_rec;
+	uint8_t rec[5] = {INKY_SEQ_OP_DELAY};
+
+	if (!seq) {
+		return;
+	}
+
+	put_le32(rec + 1, delay_us);
+	seq->data_rec = 0;
+	seq_put(seq, rec, sizeof(rec));
+}
+
+void inky_spidev_seq_rec_busy(inky_spidev_intf *iptr, uint64_t timeout,
+			      uint32_t measured_us)
+{
+	inky_spidev_seq *seq = iptr->seq_rec;
+	uint8_t rec[9] = {INKY_SEQ_OP_BUSY};
+
+	if (!seq) {
+		return;
+	}
+
+	put_le32(rec + 1, timeout > UINT32_MAX ? UINT32_MAX :
+		 (uint32_t) timeout);
+	put_le32(rec + 5, measured_us);
+	seq->data_rec = 0;
+	seq_put(seq, rec, sizeof(rec));
+}
+
+inky_error_state inky_spidev_seq_init_controller(inky_spidev_intf *iptr,
+						 uint16_t width,
+						 uint16_t height,
+						 uint32_t pulse_us)
+{
+	inky_error_state rst;
+	inky_spidev_seq *seq = iptr->init_seq;
+	char path[INKY_SPIDEV_PATH_LEN + 64];
+
+	if (!iptr->seq_dir[0]) {
+		rst = inky_spidev_cmd_reset(iptr, pulse_us);
+		if (rst != INKY_OK) {
+			return rst;
+		}
+
+		return inky_spidev_cmd_setup(iptr, width, height);
+	}
+
+	if (seq && seq->width == width && seq->height == height) {
+		return inky_spidev_seq_replay(iptr, seq);
+	}
+
+	if (!seq) {
+		seq = calloc(1, sizeof(*seq));
+		if (!seq) {
+			return INKY_E_FAILURE;
+		}
+
+		iptr->init_seq = seq;
+	}
+
+	snprintf(path, sizeof(path), "%s/init-%d-%d%d-%ux%u.seq",
+		 iptr->seq_dir, (int) iptr->dev.pdt, iptr->color_cfg.red,
+		 iptr->color_cfg.yellow, width, height);
+
+	if (inky_spidev_seq_load(seq, path) == INKY_OK
+	    && seq->width == width && seq->height == height) {
+		return inky_spidev_seq_replay(iptr, seq);
+	}
+
+	/* Nothing cached yet: run the sequence live and capture it */
+	inky_spidev_seq_record_begin(iptr, seq);
+
+	rst = inky_spidev_cmd_reset(iptr, pulse_us);
+	if (rst == INKY_OK) {
+		rst = inky_spidev_cmd_setup(iptr, width, height);
+	}
+
+	inky_spidev_seq_record_end(iptr);
+
+	if (rst != INKY_OK) {
+		seq->len = 0;
+		return rst;
+	}
+
+	seq->width = width;
+	seq->height = height;
+
+	/* A read-only cache directory only costs the replay speedup */
+	inky_spidev_seq_save(seq, path);
+
+	return INKY_OK;
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+static inky_error_state replay(inky_spidev_intf *intf_ptr,
+			       const inky_spidev_seq *seq)
+{
+	inky_config *dev = &intf_ptr->dev;
+	uint32_t pos = 0;
+	uint8_t prev_op = 0;
+
+	/* Called inside a hardware access, so short delays ride in front
+	 * of the next message and, in 3-wire mode, writes and DC levels
+	 * are queued into as few messages as inky_spidev_wire_flush() can
+	 * make. In 4-wire mode DC is a separate line that has to change
+	 * between two messages, so each data run, already merged while
+	 * recording, stays one transfer */
+	while (pos < seq->len) {
+		inky_error_state rst = INKY_OK;
+		const uint8_t *rec = seq->buf + pos;
+		uint32_t rlen = seq_record_len(rec, seq->len - pos);
+		inky_pin_state level;
+		uint32_t delay;
+
+		if (rlen == 0) {
+			return INKY_E_FAILURE;
+		}
+
+		switch (rec[0]) {
+		case INKY_SEQ_OP_DC:
+		case INKY_SEQ_OP_RESET:
+			level = rec[1] ? INKY_PINSTATE_HIGH : INKY_PINSTATE_LOW;
+			rst = dev->gpio_output_cb(rec[0] == INKY_SEQ_OP_DC ?
+						  INKY_PIN_DC : INKY_PIN_RESET,
+						  level, dev->intf_ptr);
+			break;
+
+		case INKY_SEQ_OP_DATA:
+			rst = dev->spi_write_cb(rec + 3, get_le16(rec + 1),
+						dev->intf_ptr);
+			break;
+
+		case INKY_SEQ_OP_DELAY:
+			delay = get_le32(rec + 1);
+
+			/* A delay before a BUSY wait stays, BUSY may only
+			 * rise some time after the command */
+			if (prev_op == INKY_SEQ_OP_RESET
+			    && delay > INKY_SPIDEV_SEQ_RESET_US) {
+				delay = INKY_SPIDEV_SEQ_RESET_US;
+			}
+
+			rst = dev->delay_us_cb(delay, dev->intf_ptr);
+			break;
+
+		case INKY_SEQ_OP_BUSY:
+			/* A fresh process has no BUSY history yet; start
+			 * from the wait measured while recording */
+			inky_spidev_busy_hint(intf_ptr, intf_ptr->busy.key,
+					      get_le32(rec + 5));
+			rst = dev->gpio_poll_cb(INKY_PIN_BUSY, get_le32(rec + 1),
+						dev->intf_ptr);
+			break;
+		}
+
+		if (rst != INKY_OK) {
+			return rst;
+		}
+
+		prev_op = rec[0];
+		pos += rlen;
+	}
+
+	return INKY_OK;
+}
+
+static int seq_reserve(inky_spidev_seq *seq, uint32_t extra)
+{
+	uint8_t *nbuf;
+	uint32_t ncap;
+
+	if (seq->len + extra <= seq->cap) {
+		return 0;
+	}
+
+	ncap = seq->cap ? seq->cap : 256;
+
+	while (ncap < seq->len + extra) {
+		ncap *= 2;
+	}
+
+	nbuf = realloc(seq->buf, ncap);
+
+	if (!nbuf) {
+		return -1;
+	}
+
+	seq->buf = nbuf;
+	seq->cap = ncap;
+
+	return 0;
+}
+
+static int seq_put(inky_spidev_seq *seq, const uint8_t *bytes,
+		   uint32_t len)
+{
+	if (seq_reserve(seq, len) < 0) {
+		return -1;
+	}
+
+	memcpy(seq->buf + seq->len, bytes, len);
+	seq->len += len;
+
+	return 0;
+}
+
+/* Length of the record at rec, or 0 if it is malformed */
+static uint32_t seq_record_len(const uint8_t *rec, uint32_t avail)
+{
+	uint32_t len;
+
+	switch (rec[0]) {
+	case INKY_SEQ_OP_DC:
+	case INKY_SEQ_OP_RESET:
+		len = 2;
+		break;
+	case INKY_SEQ_OP_DATA:
+		len = avail >= 3 ? 3 + get_le16(rec + 1) : 0;
+		break;
+	case INKY_SEQ_OP_DELAY:
+		len = 5;
+		break;
+	case INKY_SEQ_OP_BUSY:
+		len = 9;
+		break;
+	default:
+		len = 0;
+		break;
+	}
+
+	return len <= avail ? len : 0;
+}
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	put_le16(p, v & 0xffff);
+	put_le16(p + 2, v >> 16);
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+	return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return get_le16(p) | ((uint32_t) get_le16(p + 2) << 16);
+}
@@ -0,0 +1,186 @@
+#include <inky-spidev.h>
+
+#include "inky-spidev-cmd.h"
+#include "inky-spidev-temp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int16_t band_center(int16_t temp, uint16_t band);
+
+/*
+**********************************************************************
+*************** TEMPERATURE COMPENSATION IMPLEMENTATION **************
+**********************************************************************
+*/
+
+int8_t inky_spidev_temp_config(inky_spidev_intf *intf_ptr,
+			       inky_spidev_temp_source source,
+			       const char *path, uint16_t band)
+{
+	inky_spidev_temp *tc;
+
+	if (!intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	if (!path) {
+		path = INKY_SPIDEV_THERMAL_DEFAULT;
+	}
+
+	if (strlen(path) >= INKY_SPIDEV_PATH_LEN) {
+		return INKY_E_OUT_OF_RANGE;
+	}
+
+	inky_spidev_lock(intf_ptr);
+
+	tc = &intf_ptr->temp;
+	tc->source = source;
+	tc->band = band ? band : INKY_SPIDEV_TEMP_BAND;
+	tc->lut_ready = false;
+
+	if (source == INKY_SPIDEV_TEMP_THERMAL) {
+		strcpy(tc->path, path);
+	}
+
+	inky_spidev_unlock(intf_ptr);
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_temp_set(inky_spidev_intf *intf_ptr, int16_t temp)
+{
+	if (!intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	inky_spidev_lock(intf_ptr);
+	intf_ptr->temp.source = INKY_SPIDEV_TEMP_MANUAL;
+	intf_ptr->temp.manual = temp;
+	inky_spidev_unlock(intf_ptr);
+
+	return INKY_OK;
+}
+
+inky_error_state inky_spidev_temp_read(inky_spidev_intf *iptr,
+				       int16_t *temp)
+{
+	inky_spidev_temp *tc = &iptr->temp;
+	char line[32];
+	char *end;
+	long milli;
+	FILE *f;
+
+	switch (tc->source) {
+	case INKY_SPIDEV_TEMP_MANUAL:
+		*temp = tc->manual;
+		return INKY_OK;
+
+	case INKY_SPIDEV_TEMP_THERMAL:
+		break;
+
+	default:
+		return INKY_E_NOT_CONFIGURED;
+	}
+
+	f = fopen(tc->path, "re");
+
+	if (!f) {
+		return INKY_E_COMM_FAILURE;
+	}
+
+	end = fgets(line, sizeof(line), f);
+	fclose(f);
+
+	if (!end) {
+		return INKY_E_COMM_FAILURE;
+	}
+
+	milli = strtol(line, &end, 10);
+
+	/* Beyond what the controller's register can hold */
+	if (end == line || milli < -127000 || milli > 127000) {
+		return INKY_E_OUT_OF_RANGE;
+	}
+
+	*temp = (int16_t) (milli / 100);
+
+	return INKY_OK;
+}
+
+inky_error_state inky_spidev_temp_prepare(inky_spidev_intf *iptr,
+					  uint8_t *seq,
+					  uint32_t *timeout_us)
+{
+	inky_error_state rst;
+	inky_spidev_temp *tc = &iptr->temp;
+	int16_t temp;
+	int16_t center;
+
+	*seq = INKY_UPDATE_SEQ_FULL;
+	*timeout_us = INKY_CMD_REFRESH_TIMEOUT_US;
+
+	/* A full refresh reloads the LUT for the internal sensor's band,
+	 * so the next reading in the old band has to load it again */
+	if (inky_spidev_temp_read(iptr, &temp) != INKY_OK) {
+		if (tc->loaded != INKY_SPIDEV_TEMP_UNKNOWN) {
+			inky_spidev_busy_forget(iptr,
+						INKY_CMD_MASTER_ACTIVATE << 8
+						| INKY_UPDATE_SEQ_DISPLAY);
+		}
+
+		tc->loaded = INKY_SPIDEV_TEMP_UNKNOWN;
+		tc->lut_ready = false;
+
+		return INKY_OK;
+	}
+
+	center = band_center(temp, tc->band);
+
+	if (!tc->lut_ready || tc->loaded != center) {
+		rst = inky_spidev_cmd_load_lut(iptr, center);
+		if (rst != INKY_OK) {
+			return rst;
+		}
+
+		/* The last band's refresh time says little about this one */
+		if (tc->loaded != INKY_SPIDEV_TEMP_UNKNOWN
+		    && tc->loaded != center) {
+			inky_spidev_busy_forget(iptr,
+						INKY_CMD_MASTER_ACTIVATE << 8
+						| INKY_UPDATE_SEQ_DISPLAY);
+		}
+
+		tc->loaded = center;
+		tc->lut_ready = true;
+	}
+
+	*seq = INKY_UPDATE_SEQ_DISPLAY;
+
+	if (center < INKY_SPIDEV_TEMP_COLD) {
+		*timeout_us *= 2;
+	}
+
+	return INKY_OK;
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+static int16_t band_center(int16_t temp, uint16_t band)
+{
+	int32_t lo;
+
+	if (band == 0) {
+		band = INKY_SPIDEV_TEMP_BAND;
+	}
+
+	lo = temp >= 0 ? temp / band * band
+		: -((-temp + band - 1) / band * band);
+
+	return (int16_t) (lo + band / 2);
+}
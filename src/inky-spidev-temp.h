@@ -0,0 +1,31 @@
+/**
+ * @file inky-spidev-temp.h
+ *
+ * Internal hooks between the present code and temperature
+ * compensation. Called with the interface lock held.
+ */
+
+#ifndef INKY_SPIDEV_TEMP_H
+#define INKY_SPIDEV_TEMP_H
+
+#include <inky-spidev.h>
+
+/** @brief Read the configured external temperature source
+ *  @return INKY_E_NOT_CONFIGURED for INKY_SPIDEV_TEMP_INTERNAL
+ */
+inky_error_state inky_spidev_temp_read(inky_spidev_intf *iptr,
+				       int16_t *temp);
+
+/** @brief Load the LUT for the current temperature band if needed
+ *
+ * Falls back to the controller's own sensor when the source can't be
+ * read, so a missing sensor never blocks an update.
+ *
+ *  @param seq Set to the update sequence the refresh should use
+ *  @param timeout_us Set to the refresh timeout for the band
+ */
+inky_error_state inky_spidev_temp_prepare(inky_spidev_intf *iptr,
+					  uint8_t *seq,
+					  uint32_t *timeout_us);
+
+#endif /* #ifndef INKY_SPIDEV_TEMP_H */
@@ -0,0 +1,726 @@
+#include <inky-spidev-text.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PSF1_MAGIC0 0x36
+#define PSF1_MAGIC1 0x04
+#define PSF1_MODE512 0x01
+#define PSF1_MODEHASTAB 0x02
+#define PSF1_SEPARATOR 0xffff
+#define PSF1_STARTSEQ 0xfffe
+
+#define PSF2_MAGIC 0x864ab572
+#define PSF2_HAS_UNICODE_TABLE 0x01
+#define PSF2_SEPARATOR 0xff
+#define PSF2_STARTSEQ 0xfe
+
+#define BDF_LINE_LEN 256
+
+/** Growable glyph list used while loading */
+typedef struct {
+	inky_spidev_font *font;
+	uint32_t cap;
+	uint32_t atlas_cap;
+} font_builder;
+
+static void font_reset(inky_spidev_font *font);
+
+static int builder_add(font_builder *b, const inky_spidev_glyph *g);
+
+static int builder_atlas(font_builder *b, const uint8_t *bits,
+			 uint32_t len, uint32_t *offset);
+
+static int8_t builder_finish(font_builder *b);
+
+static int glyph_cmp(const void *a, const void *b);
+
+static int kern_cmp(const void *a, const void *b);
+
+static int16_t kern_lookup(const inky_spidev_font *font, uint32_t left,
+			   uint32_t right);
+
+static uint32_t utf8_next(const char **s, const char *end);
+
+static void blit_row(inky_spidev_fb *fb, const uint8_t *src,
+		     uint16_t width, int x, int y, inky_color c);
+
+static uint32_t psf_read_le32(const uint8_t *p);
+
+/*
+**********************************************************************
+******************* FONT LOADING *************************************
+**********************************************************************
+*/
+
+int8_t inky_spidev_font_load_psf(inky_spidev_font *font, const char *path)
+{
+	FILE *f;
+	uint8_t *data;
+	long size;
+	uint32_t nglyphs;
+	uint32_t glyph_len;
+	uint32_t width;
+	uint32_t height;
+	uint32_t hdr_len;
+	uint64_t table;
+	int unicode;
+	int psf2;
+	font_builder b = {font, 0, 0};
+
+	if (!font || !path) {
+		return INKY_E_NULL_PTR;
+	}
+
+	f = fopen(path, "rb");
+
+	if (!f) {
+		return INKY_E_NOT_CONFIGURED;
+	}
+
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	data = size > 4 ? malloc(size) : NULL;
+
+	if (!data || fread(data, 1, size, f) != (size_t) size) {
+		free(data);
+		fclose(f);
+		return INKY_E_FAILURE;
+	}
+
+	fclose(f);
+
+	psf2 = psf_read_le32(data) == PSF2_MAGIC;
+
+	if (psf2 && size >= 32) {
+		hdr_len = psf_read_le32(data + 8);
+		unicode = psf_read_le32(data + 12) & PSF2_HAS_UNICODE_TABLE;
+		nglyphs = psf_read_le32(data + 16);
+		glyph_len = psf_read_le32(data + 20);
+		height = psf_read_le32(data + 24);
+		width = psf_read_le32(data + 28);
+	} else if (data[0] == PSF1_MAGIC0 && data[1] == PSF1_MAGIC1) {
+		psf2 = 0;
+		hdr_len = 4;
+		unicode = data[2] & PSF1_MODEHASTAB;
+		nglyphs = data[2] & PSF1_MODE512 ? 512 : 256;
+		glyph_len = data[3];
+		height = data[3];
+		width = 8;
+	} else {
+		free(data);
+		return INKY_E_FAILURE;
+	}
+
+	/* Sizes come from the file, so they're checked in 64 bits */
+	table = hdr_len + (uint64_t) nglyphs * glyph_len;
+
+	if (width == 0 || height == 0 || width > 0xffff || height > 0xffff
+	    || glyph_len == 0 || hdr_len > (uint64_t) size
+	    || glyph_len < height * ((width + 7) / 8)
+	    || table > (uint64_t) size) {
+		free(data);
+		return INKY_E_FAILURE;
+	}
+
+	font_reset(font);
+	font->ascent = height;
+	font->line_height = height;
+
+	for (uint32_t i = 0; i < nglyphs; ++i) {
+		inky_spidev_glyph g = {
+			.codepoint = i,
+			.width = width,
+			.height = height,
+			.left = 0,
+			.top = -(int16_t) height,
+			.advance = width,
+			.stride = (width + 7) / 8
+		};
+
+		if (builder_atlas(&b, data + hdr_len + (uint64_t) i * glyph_len,
+				  g.stride * height, &g.offset) < 0) {
+			goto fail;
+		}
+
+		if (!unicode) {
+			if (builder_add(&b, &g) < 0) {
+				goto fail;
+			}
+
+			continue;
+		}
+
+		/* Add an entry for every code point mapped to the glyph;
+		 * combining sequences after a start marker are skipped */
+		if (psf2) {
+			int in_seq = 0;
+
+			while (table < (uint64_t) size
+			       && data[table] != PSF2_SEPARATOR) {
+				const char *p = (const char*) data + table;
+
+				if (data[table] == PSF2_STARTSEQ) {
+					in_seq = 1;
+					++table;
+					continue;
+				}
+
+				g.codepoint = utf8_next(&p, (const char*) data
+							+ size);
+				table = (const uint8_t*) p - data;
+
+				if (!in_seq && builder_add(&b, &g) < 0) {
+					goto fail;
+				}
+			}
+		} else {
+			int in_seq = 0;
+
+			while (table + 1 < (uint64_t) size) {
+				uint16_t u = data[table] | (data[table + 1] << 8);
+
+				if (u == PSF1_SEPARATOR) {
+					break;
+				}
+
+				table += 2;
+
+				if (u == PSF1_STARTSEQ) {
+					in_seq = 1;
+				} else if (!in_seq) {
+					g.codepoint = u;
+
+					if (builder_add(&b, &g) < 0) {
+						goto fail;
+					}
+				}
+			}
+		}
+
+		table += psf2 ? 1 : 2;
+	}
+
+	free(data);
+
+	return builder_finish(&b);
+
+fail:
+	free(data);
+	inky_spidev_font_free(font);
+
+	return INKY_E_FAILURE;
+}
+
+int8_t inky_spidev_font_load_bdf(inky_spidev_font *font, const char *path)
+{
+	FILE *f;
+	char line[BDF_LINE_LEN];
+	font_builder b = {font, 0, 0};
+	inky_spidev_glyph g;
+	uint8_t *bits = NULL;
+	size_t bits_len = 0;
+	int encoding = -1;
+	int descent = 0;
+	int rows = -1; /* Bitmap rows left to read, -1 outside BITMAP */
+	int row = 0;
+
+	if (!font || !path) {
+		return INKY_E_NULL_PTR;
+	}
+
+	f = fopen(path, "r");
+
+	if (!f) {
+		return INKY_E_NOT_CONFIGURED;
+	}
+
+	font_reset(font);
+	memset(&g, 0, sizeof(g));
+
+	while (fgets(line, sizeof(line), f)) {
+		int a, bb, c, d;
+
+		if (rows > 0) {
+			uint8_t *dst = bits + row * g.stride;
+
+			for (int i = 0; i < g.stride; ++i) {
+				unsigned int byte = 0;
+
+				if (sscanf(line + 2 * i, "%2x", &byte) != 1) {
+					break;
+				}
+
+				dst[i] = byte;
+			}
+
+			++row;
+			--rows;
+			continue;
+		}
+
+		if (sscanf(line, "FONT_ASCENT %d", &a) == 1) {
+			font->ascent = a;
+		} else if (sscanf(line, "FONT_DESCENT %d", &a) == 1) {
+			descent = a;
+		} else if (sscanf(line, "ENCODING %d", &a) == 1) {
+			encoding = a;
+		} else if (sscanf(line, "DWIDTH %d", &a) == 1) {
+			g.advance = a;
+		} else if (sscanf(line, "BBX %d %d %d %d", &a, &bb, &c, &d) == 4) {
+			if (a < 0 || bb < 0 || a > 0xffff || bb > 0xffff) {
+				goto fail;
+			}
+
+			g.width = a;
+			g.height = bb;
+			g.left = c;
+			/* BDF measures up from the baseline to the bottom */
+			g.top = -(d + bb);
+			g.stride = (a + 7) / 8;
+		} else if (strncmp(line, "BITMAP", 6) == 0) {
+			free(bits);
+			bits_len = (size_t) g.stride * g.height;
+			bits = calloc(1, bits_len + 1);
+
+			if (!bits) {
+				goto fail;
+			}
+
+			rows = g.height;
+			row = 0;
+		} else if (strncmp(line, "ENDCHAR", 7) == 0) {
+			/* Unencoded glyphs are unreachable by code point */
+			if (encoding >= 0 && bits) {
+				g.codepoint = encoding;
+
+				/* A BBX after BITMAP doesn't match the rows */
+				if ((size_t) g.stride * g.height != bits_len) {
+					goto fail;
+				}
+
+				if (builder_atlas(&b, bits, bits_len,
+						  &g.offset) < 0
+				    || builder_add(&b, &g) < 0) {
+					goto fail;
+				}
+			}
+
+			encoding = -1;
+			rows = -1;
+		}
+	}
+
+	fclose(f);
+	free(bits);
+
+	font->line_height = font->ascent + descent;
+
+	return builder_finish(&b);
+
+fail:
+	fclose(f);
+	free(bits);
+	inky_spidev_font_free(font);
+
+	return INKY_E_FAILURE;
+}
+
+void inky_spidev_font_free(inky_spidev_font *font)
+{
+	free(font->glyphs);
+	free(font->atlas);
+	free(font->kerns);
+	font_reset(font);
+}
+
+int8_t inky_spidev_font_set_kerning(inky_spidev_font *font,
+				    const inky_spidev_kern *kerns,
+				    uint32_t n)
+{
+	inky_spidev_kern *copy = NULL;
+
+	if (!font || (n > 0 && !kerns)) {
+		return INKY_E_NULL_PTR;
+	}
+
+	if (n > 0) {
+		copy = malloc(n * sizeof(*copy));
+
+		if (!copy) {
+			return INKY_E_FAILURE;
+		}
+
+		memcpy(copy, kerns, n * sizeof(*copy));
+		qsort(copy, n, sizeof(*copy), kern_cmp);
+	}
+
+	free(font->kerns);
+	font->kerns = copy;
+	font->nkerns = n;
+
+	return INKY_OK;
+}
+
+const inky_spidev_glyph *inky_spidev_font_glyph(const inky_spidev_font *font,
+						uint32_t codepoint)
+{
+	uint32_t lo = 0;
+	uint32_t hi = font->nglyphs;
+
+	if (codepoint < 256) {
+		int32_t i = font->latin1[codepoint];
+
+		return i < 0 ? NULL : &font->glyphs[i];
+	}
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+
+		if (font->glyphs[mid].codepoint < codepoint) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (lo < font->nglyphs && font->glyphs[lo].codepoint == codepoint) {
+		return &font->glyphs[lo];
+	}
+
+	return NULL;
+}
+
+/*
+**********************************************************************
+******************* TEXT RENDERING ***********************************
+**********************************************************************
+*/
+
+int inky_spidev_text_draw(inky_spidev_fb *fb, const inky_spidev_font *font,
+			  int x, int y, const char *text, inky_color c)
+{
+	uint32_t prev = 0;
+	int baseline = y + font->ascent;
+
+	while (*text) {
+		uint32_t cp = utf8_next(&text, NULL);
+		const inky_spidev_glyph *g = inky_spidev_font_glyph(font, cp);
+		int gx;
+		int gy;
+
+		if (!g) {
+			g = inky_spidev_font_glyph(font, '?');
+		}
+
+		if (!g) {
+			continue;
+		}
+
+		if (prev) {
+			x += kern_lookup(font, prev, cp);
+		}
+
+		gx = x + g->left;
+		gy = baseline + g->top;
+
+		/* Skip glyphs entirely outside the framebuffer */
+		if (gx < fb->width && gx + g->width > 0
+		    && gy < fb->height && gy + g->height > 0) {
+			const uint8_t *src = font->atlas + g->offset;
+
+			for (int r = 0; r < g->height; ++r) {
+				if (gy + r >= 0 && gy + r < fb->height) {
+					blit_row(fb, src, g->width, gx,
+						 gy + r, c);
+				}
+
+				src += g->stride;
+			}
+		}
+
+		x += g->advance;
+		prev = cp;
+	}
+
+	return x;
+}
+
+int inky_spidev_text_width(const inky_spidev_font *font, const char *text)
+{
+	uint32_t prev = 0;
+	int x = 0;
+
+	while (*text) {
+		uint32_t cp = utf8_next(&text, NULL);
+		const inky_spidev_glyph *g = inky_spidev_font_glyph(font, cp);
+
+		if (!g) {
+			g = inky_spidev_font_glyph(font, '?');
+		}
+
+		if (!g) {
+			continue;
+		}
+
+		if (prev) {
+			x += kern_lookup(font, prev, cp);
+		}
+
+		x += g->advance;
+		prev = cp;
+	}
+
+	return x;
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+static void font_reset(inky_spidev_font *font)
+{
+	font->glyphs = NULL;
+	font->nglyphs = 0;
+	font->atlas = NULL;
+	font->atlas_len = 0;
+	font->ascent = 0;
+	font->line_height = 0;
+	font->kerns = NULL;
+	font->nkerns = 0;
+
+	for (int i = 0; i < 256; ++i) {
+		font->latin1[i] = -1;
+	}
+}
+
+static int builder_add(font_builder *b, const inky_spidev_glyph *g)
+{
+	inky_spidev_font *font = b->font;
+
+	if (font->nglyphs == b->cap) {
+		uint32_t ncap = b->cap ? b->cap * 2 : 256;
+		inky_spidev_glyph *n = realloc(font->glyphs,
+					       ncap * sizeof(*n));
+
+		if (!n) {
+			return -1;
+		}
+
+		font->glyphs = n;
+		b->cap = ncap;
+	}
+
+	font->glyphs[font->nglyphs++] = *g;
+
+	return 0;
+}
+
+static int builder_atlas(font_builder *b, const uint8_t *bits,
+			 uint32_t len, uint32_t *offset)
+{
+	inky_spidev_font *font = b->font;
+
+	if (font->atlas_len + len > b->atlas_cap) {
+		uint32_t ncap = b->atlas_cap ? b->atlas_cap : 4096;
+		uint8_t *n;
+
+		while (ncap < font->atlas_len + len) {
+			ncap *= 2;
+		}
+
+		n = realloc(font->atlas, ncap);
+
+		if (!n) {
+			return -1;
+		}
+
+		font->atlas = n;
+		b->atlas_cap = ncap;
+	}
+
+	memcpy(font->atlas + font->atlas_len, bits, len);
+	*offset = font->atlas_len;
+	font->atlas_len += len;
+
+	return 0;
+}
+
+static int8_t builder_finish(font_builder *b)
+{
+	inky_spidev_font *font = b->font;
+	uint32_t out = 0;
+
+	if (font->nglyphs == 0) {
+		inky_spidev_font_free(font);
+		return INKY_E_FAILURE;
+	}
+
+	/* Stable order, then keep the first glyph for each code point */
+	qsort(font->glyphs, font->nglyphs, sizeof(*font->glyphs), glyph_cmp);
+
+	for (uint32_t i = 0; i < font->nglyphs; ++i) {
+		if (out > 0 && font->glyphs[out - 1].codepoint
+		    == font->glyphs[i].codepoint) {
+			continue;
+		}
+
+		font->glyphs[out++] = font->glyphs[i];
+	}
+
+	font->nglyphs = out;
+
+	for (uint32_t i = 0; i < font->nglyphs; ++i) {
+		if (font->glyphs[i].codepoint < 256) {
+			font->latin1[font->glyphs[i].codepoint] = i;
+		}
+	}
+
+	return INKY_OK;
+}
+
+static int glyph_cmp(const void *a, const void *b)
+{
+	const inky_spidev_glyph *ga = a;
+	const inky_spidev_glyph *gb = b;
+
+	if (ga->codepoint != gb->codepoint) {
+		return ga->codepoint < gb->codepoint ? -1 : 1;
+	}
+
+	/* Earlier atlas entries win for duplicate code points */
+	return ga->offset < gb->offset ? -1 : ga->offset > gb->offset;
+}
+
+static int kern_cmp(const void *a, const void *b)
+{
+	const inky_spidev_kern *ka = a;
+	const inky_spidev_kern *kb = b;
+
+	if (ka->left != kb->left) {
+		return ka->left < kb->left ? -1 : 1;
+	}
+
+	return ka->right < kb->right ? -1 : ka->right > kb->right;
+}
+
+static int16_t kern_lookup(const inky_spidev_font *font, uint32_t left,
+			   uint32_t right)
+{
+	inky_spidev_kern key = {left, right, 0};
+	const inky_spidev_kern *k;
+
+	if (font->nkerns == 0) {
+		return 0;
+	}
+
+	k = bsearch(&key, font->kerns, font->nkerns, sizeof(key), kern_cmp);
+
+	return k ? k->adjust : 0;
+}
+
+/* end is one past the last byte, or NULL for a NUL terminated string,
+ * where the NUL stops a sequence like any other non-continuation byte */
+static uint32_t utf8_next(const char **s, const char *end)
+{
+	const uint8_t *p = (const uint8_t*) *s;
+	uint32_t cp;
+	int extra;
+
+	if (p[0] < 0x80) {
+		cp = p[0];
+		extra = 0;
+	} else if ((p[0] & 0xe0) == 0xc0) {
+		cp = p[0] & 0x1f;
+		extra = 1;
+	} else if ((p[0] & 0xf0) == 0xe0) {
+		cp = p[0] & 0x0f;
+		extra = 2;
+	} else if ((p[0] & 0xf8) == 0xf0) {
+		cp = p[0] & 0x07;
+		extra = 3;
+	} else {
+		*s += 1;
+		return 0xfffd;
+	}
+
+	for (int i = 1; i <= extra; ++i) {
+		if ((end && (const char*) p + i >= end)
+		    || (p[i] & 0xc0) != 0x80) {
+			*s += i;
+			return 0xfffd;
+		}
+
+		cp = (cp << 6) | (p[i] & 0x3f);
+	}
+
+	*s += extra + 1;
+
+	return cp;
+}
+
+/* Draw one glyph row of width pixels with its first pixel at (x, y).
+ * The row is handled 32 pixels at a time: the source bits are shifted
+ * into a 64-bit word aligned to the destination bytes, and each of the
+ * five bytes it covers is merged with a single mask operation. */
+static void blit_row(inky_spidev_fb *fb, const uint8_t *src,
+		     uint16_t width, int x, int y, inky_color c)
+{
+	uint8_t *bw = fb->planes[INKY_SPIDEV_PLANE_BW] + (size_t) y * fb->stride;
+	uint8_t *col = fb->planes[INKY_SPIDEV_PLANE_COLOR]
+		+ (size_t) y * fb->stride;
+	const int black = c == INKY_COLOR_BLACK;
+	const int colored = c == INKY_COLOR_RED || c == INKY_COLOR_YELLOW;
+
+	for (int done = 0; done < width; done += 32) {
+		int n = width - done < 32 ? width - done : 32;
+		int bit = x + done;
+		int byte = bit >= 0 ? bit / 8 : -((7 - bit) / 8);
+		int shift = bit - byte * 8;
+		uint32_t bits = 0;
+		uint64_t word;
+
+		for (int i = 0; i < (n + 7) / 8; ++i) {
+			bits |= (uint32_t) src[done / 8 + i] << (24 - 8 * i);
+		}
+
+		/* Drop padding bits past the glyph width */
+		bits &= n == 32 ? 0xffffffffu : ~(0xffffffffu >> n);
+
+		if (!bits) {
+			continue;
+		}
+
+		word = ((uint64_t) bits << 32) >> shift;
+
+		for (int k = 0; k < 5; ++k, ++byte) {
+			uint8_t m = (word >> (56 - 8 * k)) & 0xff;
+
+			if (!m || byte < 0) {
+				continue;
+			}
+
+			if (byte >= fb->stride) {
+				break;
+			}
+
+			/* Clip the last byte to the visible width */
+			if (byte == fb->stride - 1 && fb->width % 8) {
+				m &= 0xff << (8 - fb->width % 8);
+			}
+
+			bw[byte] = black ? bw[byte] & ~m : bw[byte] | m;
+			col[byte] = colored ? col[byte] | m : col[byte] & ~m;
+		}
+	}
+}
+
+static uint32_t psf_read_le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
@@ -0,0 +1,66 @@
+/**
+ * @file inky-spidev-trace.h
+ *
+ * USDT probes on the hardware facing paths, for perf, bpftrace and
+ * SystemTap. Each probe is a single nop until a tracer attaches, and
+ * the arguments are only evaluated into registers, so they stay in
+ * release builds. Without sys/sdt.h, or with INKY_SPIDEV_TRACE unset,
+ * they compile to nothing.
+ *
+ * Every probe is in the inky_spidev provider and takes the interface
+ * pointer first, to tell panels apart. Entry and return probes come
+ * in pairs so a tracer can time the call. The entry probe fires before
+ * the controller is woken, so the pair includes any wake up, and a
+ * call that fails to wake it still fires its return probe:
+ *
+ * | Probe                    | Further arguments                   |
+ * |--------------------------|-------------------------------------|
+ * | init, deinit             | spidev path (init only)             |
+ * | spi_write_entry/return   | bytes; result on return             |
+ * | spi_write16_entry/return | words; result on return             |
+ * | wire_flush               | words, 3-wire mode                  |
+ * | gpio_output_entry/return | pin, level; result on return        |
+ * | gpio_poll_entry/return   | pin, timeout us; result, waited us  |
+ * | delay_entry/return       | us; result on return                |
+ * | fb_present_entry/return  | width, height; result on return     |
+ * | plane_upload_entry       | plane, bytes, fill value or -1      |
+ * | plane_upload_return      | plane, result                       |
+ * | plane_skip               | plane                               |
+ *
+ * For example, the time spent per BUSY wait:
+ *
+ *     bpftrace -e 'usdt:libinkyuserspace.so:inky_spidev:gpio_poll_return
+ *         { @busy_us = hist(arg3); }'
+ */
+
+#ifndef INKY_SPIDEV_TRACE_H
+#define INKY_SPIDEV_TRACE_H
+
+#if defined(INKY_SPIDEV_TRACE) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define INKY_SPIDEV_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef INKY_SPIDEV_HAVE_PROBES
+
+#define INKY_TRACE1(name, a) \
+	DTRACE_PROBE1(inky_spidev, name, a)
+#define INKY_TRACE2(name, a, b) \
+	DTRACE_PROBE2(inky_spidev, name, a, b)
+#define INKY_TRACE3(name, a, b, c) \
+	DTRACE_PROBE3(inky_spidev, name, a, b, c)
+#define INKY_TRACE4(name, a, b, c, d) \
+	DTRACE_PROBE4(inky_spidev, name, a, b, c, d)
+
+#else
+
+#define INKY_TRACE1(name, a) do { } while (0)
+#define INKY_TRACE2(name, a, b) do { } while (0)
+#define INKY_TRACE3(name, a, b, c) do { } while (0)
+#define INKY_TRACE4(name, a, b, c, d) do { } while (0)
+
+#endif /* #ifdef INKY_SPIDEV_HAVE_PROBES */
+
+#endif /* #ifndef INKY_SPIDEV_TRACE_H */
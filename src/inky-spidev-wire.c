@@ -0,0 +1,243 @@
+#include <inky-spidev.h>
+
+#include "inky-spidev-trace.h"
+#include "inky-spidev-wire.h"
+
+/* Largest packed batch: 8 words to 9 bytes, plus a padded last byte */
+#define WIRE_PACKED_LEN (INKY_SPIDEV_WIRE_BATCH / 8 * 9 + 1)
+
+static uint32_t max_transfer(const inky_spidev_intf *iptr);
+
+static inky_error_state send_words(inky_spidev_intf *iptr, uint32_t *sent);
+
+static inky_error_state send_packed(inky_spidev_intf *iptr);
+
+static uint32_t pack_words(const uint16_t *words, uint32_t n, uint8_t *out);
+
+/*
+**********************************************************************
+********************* 3-WIRE SPI IMPLEMENTATION **********************
+**********************************************************************
+*/
+
+int8_t inky_spidev_wire_config(inky_spidev_intf *intf_ptr,
+			       inky_spidev_wire_mode mode)
+{
+	inky_error_state rst;
+
+	if (!intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	if (mode != INKY_SPIDEV_WIRE_4 && mode != INKY_SPIDEV_WIRE_3
+	    && mode != INKY_SPIDEV_WIRE_3_PACKED) {
+		return INKY_E_OUT_OF_RANGE;
+	}
+
+	inky_spidev_lock(intf_ptr);
+
+	/* Words queued by a caller holding the lock go out the old way */
+	rst = inky_spidev_wire_flush(intf_ptr);
+
+	intf_ptr->wire.mode = mode;
+	intf_ptr->wire.data = true;
+
+	inky_spidev_unlock(intf_ptr);
+
+	return rst;
+}
+
+inky_error_state inky_spidev_wire_queue(inky_spidev_intf *iptr,
+					const uint8_t *buf, uint32_t len)
+{
+	inky_error_state rst;
+	inky_spidev_wire *wire = &iptr->wire;
+	uint16_t dc = wire->data ? 0x100 : 0;
+
+	for (uint32_t i = 0; i < len; ++i) {
+		if (wire->len == INKY_SPIDEV_WIRE_BATCH) {
+			rst = inky_spidev_wire_flush(iptr);
+			if (rst != INKY_OK) {
+				return rst;
+			}
+		}
+
+		wire->pending[wire->len++] = dc | buf[i];
+	}
+
+	return INKY_OK;
+}
+
+inky_error_state inky_spidev_wire_flush(inky_spidev_intf *iptr)
+{
+	inky_error_state rst;
+	inky_spidev_wire *wire = &iptr->wire;
+	uint32_t sent;
+
+	if (wire->len == 0) {
+		return wire->delay_us > 0 ?
+			inky_spidev_wire_transfer(iptr, NULL) : INKY_OK;
+	}
+
+	INKY_TRACE3(wire_flush, iptr, wire->len, wire->mode);
+
+	if (wire->mode == INKY_SPIDEV_WIRE_3) {
+		rst = send_words(iptr, &sent);
+
+		/* A controller without 9 bit words rejects the first
+		 * transfer before clocking anything out. Other errors are
+		 * returned and 9 bit words are tried again next time */
+		if (rst != INKY_E_OUT_OF_RANGE || sent > 0) {
+			wire->len = 0;
+			return rst;
+		}
+
+		wire->mode = INKY_SPIDEV_WIRE_3_PACKED;
+	}
+
+	rst = send_packed(iptr);
+	wire->len = 0;
+
+	return rst;
+}
+
+inky_error_state inky_spidev_wire_transfer(inky_spidev_intf *iptr,
+					   const struct spi_ioc_transfer *tr)
+{
+	inky_error_state rst;
+	inky_spidev_wire *wire = &iptr->wire;
+	struct spi_ioc_transfer xfers[2];
+	uint32_t n = 0;
+
+	if (wire->delay_us > 0) {
+		xfers[n++] = (struct spi_ioc_transfer) {
+			.tx_buf = 0,
+			.rx_buf = 0,
+			.len = 0,
+			.delay_usecs = wire->delay_us,
+			.speed_hz = INKY_SPI_SPEED_HZ_MAX,
+			.bits_per_word = 8
+		};
+	}
+
+	if (tr) {
+		xfers[n++] = *tr;
+	}
+
+	if (n == 0) {
+		return INKY_OK;
+	}
+
+	rst = iptr->transport->spi_transfer(iptr, xfers, n);
+
+	if (rst == INKY_OK) {
+		wire->delay_us = 0;
+	}
+
+	return rst;
+}
+
+/*
+**********************************************************************
+********************** INTERNAL API FUNCTIONS ************************
+**********************************************************************
+*/
+
+static uint32_t max_transfer(const inky_spidev_intf *iptr)
+{
+	return iptr->bufsiz ? iptr->bufsiz : INKY_SPIDEV_BUFSIZ_DEFAULT;
+}
+
+static inky_error_state send_words(inky_spidev_intf *iptr, uint32_t *sent)
+{
+	inky_error_state rst;
+	inky_spidev_wire *wire = &iptr->wire;
+	uint32_t chunk = max_transfer(iptr) / sizeof(uint16_t);
+	uint32_t n;
+
+	/* spidev carries 9 bit words in host order 16 bit containers */
+	for (*sent = 0; *sent < wire->len; *sent += n) {
+		n = wire->len - *sent < chunk ? wire->len - *sent : chunk;
+
+		struct spi_ioc_transfer tr = {
+			.tx_buf = (unsigned long) (wire->pending + *sent),
+			.rx_buf = 0,
+			.len = n * sizeof(uint16_t),
+			.delay_usecs = 0,
+			.speed_hz = INKY_SPI_SPEED_HZ_MAX,
+			.bits_per_word = 9
+		};
+
+		rst = inky_spidev_wire_transfer(iptr, &tr);
+		if (rst != INKY_OK) {
+			return rst;
+		}
+
+		++wire->transfers;
+	}
+
+	return INKY_OK;
+}
+
+static inky_error_state send_packed(inky_spidev_intf *iptr)
+{
+	inky_error_state rst;
+	inky_spidev_wire *wire = &iptr->wire;
+	uint8_t out[WIRE_PACKED_LEN];
+	uint32_t len;
+	uint32_t chunk;
+
+	len = pack_words(wire->pending, wire->len, out);
+
+	/* Whole groups of 8 words, so no word straddles chip select */
+	chunk = max_transfer(iptr) / 9 * 9;
+	if (chunk == 0) {
+		chunk = 9;
+	}
+
+	for (uint32_t off = 0; off < len; off += chunk) {
+		struct spi_ioc_transfer tr = {
+			.tx_buf = (unsigned long) (out + off),
+			.rx_buf = 0,
+			.len = len - off < chunk ? len - off : chunk,
+			.delay_usecs = 0,
+			.speed_hz = INKY_SPI_SPEED_HZ_MAX,
+			.bits_per_word = 8
+		};
+
+		rst = inky_spidev_wire_transfer(iptr, &tr);
+		if (rst != INKY_OK) {
+			return rst;
+		}
+
+		++wire->transfers;
+	}
+
+	return INKY_OK;
+}
+
+static uint32_t pack_words(const uint16_t *words, uint32_t n, uint8_t *out)
+{
+	uint32_t acc = 0;
+	unsigned int bits = 0;
+	uint32_t len = 0;
+
+	/* MSB first, the D/C bit leading each word */
+	for (uint32_t i = 0; i < n; ++i) {
+		acc = acc << 9 | (words[i] & 0x1ff);
+		bits += 9;
+
+		while (bits >= 8) {
+			bits -= 8;
+			out[len++] = acc >> bits;
+		}
+
+		acc &= (1u << bits) - 1;
+	}
+
+	if (bits > 0) {
+		out[len++] = acc << (8 - bits);
+	}
+
+	return len;
+}
@@ -0,0 +1,49 @@
+/**
+ * @file inky-spidev-wire.h
+ *
+ * Internal hooks between the hardware callbacks and the SPI messages
+ * they turn into: 3-wire batching and settle delays. Called with the
+ * interface lock held.
+ */
+
+#ifndef INKY_SPIDEV_WIRE_H
+#define INKY_SPIDEV_WIRE_H
+
+#include <inky-spidev.h>
+
+#include <stdbool.h>
+#include <linux/types.h>
+#include <linux/spi/spidev.h>
+
+/** @brief True if D/C travels with the data instead of on a GPIO */
+static inline bool inky_spidev_wire_3(const inky_spidev_intf *iptr)
+{
+	return iptr->wire.mode != INKY_SPIDEV_WIRE_4;
+}
+
+/** @brief Queue bytes at the current D/C level
+ *
+ * Flushes whenever the batch fills up.
+ */
+inky_error_state inky_spidev_wire_queue(inky_spidev_intf *iptr,
+					const uint8_t *buf, uint32_t len);
+
+/** @brief Send every queued word and any pending settle delay
+ *
+ * Needs the hardware to be held, which it always is while words or a
+ * delay are pending.
+ */
+inky_error_state inky_spidev_wire_flush(inky_spidev_intf *iptr);
+
+/** @brief Send one transfer, preceded by any pending settle delay
+ *
+ * The delay is a zero length transfer in the same SPI_IOC_MESSAGE, so
+ * the kernel times it and no extra system call is made. It stays
+ * pending if the message fails.
+ *
+ *  @param tr Transfer to send, NULL for just the delay
+ */
+inky_error_state inky_spidev_wire_transfer(inky_spidev_intf *iptr,
+					   const struct spi_ioc_transfer *tr);
+
+#endif /* #ifndef INKY_SPIDEV_WIRE_H */
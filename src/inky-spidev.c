@@ -1,5 +1,15 @@
 #include <inky-spidev.h>
 
+#include "inky-spidev-bus-arb.h"
+#include "inky-spidev-cmd.h"
+#include "inky-spidev-idle.h"
+#include "inky-spidev-init.h"
+#include "inky-spidev-seq-rec.h"
+#include "inky-spidev-trace.h"
+#include "inky-spidev-wire.h"
+
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -11,6 +21,65 @@
 static struct gpiod_line *get_line_struct(inky_spidev_intf *intf_ptr,
 				   inky_pin gpin);
 
+static inky_spidev_pincfg *get_pincfg(inky_spidev_intf *intf_ptr,
+				       inky_pin gpin);
+
+static uint32_t read_spidev_bufsiz(void);
+
+static inky_error_state spi_setup(void *intf_ptr);
+
+static inky_error_state gpio_output_state(inky_pin gpin,
+					  inky_pin_state gstate,
+					  void *intf_ptr);
+
+static inky_error_state gpio_input_state(inky_pin gpin,
+					 inky_pin_state* out,
+					 void *intf_ptr);
+
+static inky_error_state gpio_poll_pin(inky_pin gpin, uint64_t timeout,
+				      void *intf_ptr);
+
+static inky_error_state spi_write(const uint8_t* buf, uint32_t len,
+				  void *intf_ptr);
+
+static inky_error_state spi_write16(const uint16_t* buf, uint32_t len,
+				    void *intf_ptr);
+
+static inky_error_state spi_write16_bytes(const uint16_t* buf,
+					  uint32_t len, void *intf_ptr);
+
+static void busy_track(inky_spidev_busy *busy, const uint8_t *buf,
+		       uint32_t len);
+
+static void ram_track(inky_spidev_intf *iptr, const uint8_t *buf,
+		      uint32_t len);
+
+static inky_spidev_busy_hist *busy_hist(inky_spidev_intf *iptr,
+				       uint16_t key, bool add);
+
+static void busy_learn(inky_spidev_intf *iptr, uint16_t key,
+		       uint32_t waited_us);
+
+static uint64_t now_us(void);
+
+static void sleep_until_us(uint64_t when);
+
+static inky_error_state ioctl_spi_transfer(void *intf_ptr,
+					   struct spi_ioc_transfer *xfers,
+					   uint32_t n);
+
+static inky_error_state gpiod_set(void *intf_ptr, inky_pin gpin, int value);
+
+static inky_error_state gpiod_get(void *intf_ptr, inky_pin gpin,
+				  int *value);
+
+const inky_spidev_transport inky_spidev_transport_ioctl = {
+	.name = "ioctl",
+	.spi_transfer = ioctl_spi_transfer,
+	.gpio_set = gpiod_set,
+	.gpio_get = gpiod_get
+};
+
 /*
 **********************************************************************
 ******************* USER API IMPLEMENTATION **************************
@@ -88,13 +157,34 @@ inky_error_state inky_spidev_gpio_setup_pin(inky_pin gpin,
 		pinstate = 0;
 	}
 
+	inky_spidev_lock(iptr);
+
+	/* In 3-wire mode D/C goes with the data, the line is unused */
+	if (gpin == INKY_PIN_DC && inky_spidev_wire_3(iptr)) {
+		inky_spidev_unlock(iptr);
+		return INKY_OK;
+	}
+
 	/* Send request for the line, failing if less than 0 returned */
 	rst = gpiod_line_request(this_line, &cfg, pinstate);
 
 	if (rst < 0) {
+		inky_spidev_unlock(iptr);
 		return INKY_E_NOT_CONFIGURED;
 	}
 
+	/* Keep the request so the idle manager can repeat it */
+	*get_pincfg(iptr, gpin) = (inky_spidev_pincfg) {
+		.valid = true,
+		.pin = gpin,
+		.line = this_line,
+		.dir = gdir,
+		.state = gstate,
+		.pull = gcfg
+	};
+
+	inky_spidev_unlock(iptr);
+
 	return INKY_OK;
 }
 
@@ -102,192 +192,307 @@ inky_error_state inky_spidev_gpio_output_state(inky_pin gpin,
 					       inky_pin_state gstate,
 					       void *intf_ptr)
 {
-	int rst;
-	struct gpiod_line *this_line;
-	int pinstate;
+	inky_error_state rst;
+	inky_spidev_pincfg *cfg;
 	inky_spidev_intf *iptr = (inky_spidev_intf*) intf_ptr;
-	
-	this_line = get_line_struct(iptr, gpin);
 
-	if (gstate == INKY_PINSTATE_HIGH) {
-		pinstate = 1;
+	INKY_TRACE3(gpio_output_entry, iptr, gpin, gstate);
+
+	rst = inky_spidev_hw_begin(iptr);
+	if (rst != INKY_OK) {
+		INKY_TRACE3(gpio_output_return, iptr, gpin, rst);
+		return rst;
+	}
+
+	if (gpin == INKY_PIN_DC && inky_spidev_wire_3(iptr)) {
+		iptr->wire.data = gstate == INKY_PINSTATE_HIGH;
+	} else if (gpin == INKY_PIN_DC) {
+		/* DC is only sampled while clocking, so it may change
+		 * during a settle delay still waiting to be sent */
+		rst = gpio_output_state(gpin, gstate, intf_ptr);
 	} else {
-		pinstate = 0;
+		/* Queued 3-wire words and delays must reach the panel
+		 * first */
+		rst = inky_spidev_wire_flush(iptr);
+
+		if (rst == INKY_OK) {
+			rst = gpio_output_state(gpin, gstate, intf_ptr);
+		}
 	}
 
-	rst = gpiod_line_set_value(this_line, pinstate);
+	/* Remember the level so it survives an idle release */
+	cfg = get_pincfg(iptr, gpin);
+	if (rst == INKY_OK && cfg) {
+		cfg->state = gstate;
+	}
 
-	if (rst < 0) {
-		return INKY_E_FAILURE;
+	if (rst == INKY_OK) {
+		inky_spidev_seq_rec_pin(iptr, gpin, gstate);
 	}
 
-	return INKY_OK;
+	if (rst == INKY_OK && gpin == INKY_PIN_DC) {
+		iptr->busy.cmd_mode = gstate == INKY_PINSTATE_LOW;
+	}
+
+	/* A reset clears the loaded LUT along with everything else */
+	if (rst == INKY_OK && gpin == INKY_PIN_RESET) {
+		iptr->busy.have_arg = false;
+		iptr->busy.arg = 0;
+		iptr->temp.lut_ready = false;
+		iptr->ram.valid[0] = false;
+		iptr->ram.valid[1] = false;
+	}
+
+	if (gpin == INKY_PIN_RESET && gstate == INKY_PINSTATE_LOW) {
+		iptr->idle.ctrl_ready = false;
+	}
+
+	inky_spidev_hw_end(iptr);
+
+	INKY_TRACE3(gpio_output_return, iptr, gpin, rst);
+
+	return rst;
 }
 
 inky_error_state inky_spidev_gpio_input_state(inky_pin gpin,
 					      inky_pin_state* out,
 					      void *intf_ptr)
 {
-	int rst;
-	struct gpiod_line *this_line;
+	inky_error_state rst;
 	inky_spidev_intf *iptr = (inky_spidev_intf*) intf_ptr;
 
-	if (!out) {
-		return INKY_E_NULL_PTR;
+	rst = inky_spidev_hw_begin(iptr);
+	if (rst != INKY_OK) {
+		return rst;
 	}
 
-	this_line = get_line_struct(iptr, gpin);
-
-	rst = gpiod_line_get_value(this_line);
+	rst = inky_spidev_wire_flush(iptr);
 
-	if (rst < 0) {
-		return INKY_E_FAILURE;
+	if (rst == INKY_OK) {
+		rst = gpio_input_state(gpin, out, intf_ptr);
 	}
 
-	/* These might flip if active low is flagged in */
-	if (rst == 1) {
-		*out = INKY_PINSTATE_HIGH;
-	} else {
-		*out = INKY_PINSTATE_LOW;
-	}
+	inky_spidev_hw_end(iptr);
 
-	return INKY_OK;
+	return rst;
 }
 
 inky_error_state inky_spidev_gpio_poll_pin(inky_pin gpin,
 					   uint64_t timeout,
 					   void *intf_ptr)
 {
-	int rst = 0;
-	inky_pin_state pinstate;
-	struct gpiod_line *this_line;
+	inky_error_state rst;
+	inky_error_state bus_rst;
 	inky_spidev_intf *iptr = (inky_spidev_intf*) intf_ptr;
-	struct timespec tm_start;
+	uint64_t start;
+	uint32_t waited;
+	uint16_t key;
+	bool yielded;
+
+	INKY_TRACE3(gpio_poll_entry, iptr, gpin, timeout);
+
+	/* Hold the controller awake for the whole wait */
+	rst = inky_spidev_hw_begin(iptr);
+	if (rst != INKY_OK) {
+		INKY_TRACE4(gpio_poll_return, iptr, gpin, rst, 0);
+		return rst;
+	}
 
-	timespec_get(&tm_start , TIME_UTC);
+	/* The command being waited on may still be queued */
+	rst = inky_spidev_wire_flush(iptr);
+	if (rst != INKY_OK) {
+		inky_spidev_hw_end(iptr);
+		INKY_TRACE4(gpio_poll_return, iptr, gpin, rst, 0);
+		return rst;
+	}
 
-	do {
-		struct timespec tm_now;
+	/* BUSY is this panel's own line, so panels sharing the bus can
+	 * upload while it refreshes */
+	yielded = inky_spidev_bus_yield(iptr);
 
-		rst = iptr->dev.gpio_input_cb(gpin, &pinstate, intf_ptr);
+	key = iptr->busy.key;
+	start = now_us();
 
-		if (rst < 0) {
-			return INKY_E_FAILURE;
-		}
+	rst = gpio_poll_pin(gpin, timeout, intf_ptr);
 
-		/* Get new time for timeout */
-		timespec_get(&tm_now, TIME_UTC);
+	waited = now_us() - start;
 
-		/* Return early if timeout */
-		if (tm_now.tv_sec * 1000000 + tm_now.tv_nsec / 1000
-		    > tm_start.tv_sec * 1000000 + tm_start.tv_nsec / 1000 + timeout) {
-			return INKY_E_TIMEOUT;
-		}
+	bus_rst = inky_spidev_bus_resume(iptr, yielded);
 
-		iptr->dev.delay_us_cb(5000, intf_ptr);
-	} while (pinstate != INKY_PINSTATE_LOW);
+	/* A timeout says nothing about how long the command takes */
+	if (rst == INKY_OK && gpin == INKY_PIN_BUSY) {
+		busy_learn(iptr, key, waited);
+	}
 
-	return INKY_OK;
+	if (rst == INKY_OK) {
+		rst = bus_rst;
+	}
+
+	if (rst == INKY_OK) {
+		inky_spidev_seq_rec_busy(iptr, timeout, waited);
+	}
+
+	inky_spidev_hw_end(iptr);
+
+	INKY_TRACE4(gpio_poll_return, iptr, gpin, rst, waited);
+
+	return rst;
 }
 
 inky_error_state inky_spidev_spi_setup(void *intf_ptr)
 {
-	int err;
-	uint8_t mode = SPI_MODE_0;
-	uint8_t bits = INKY_SPI_BITS_DEFAULT;
-	uint32_t speed = INKY_SPI_SPEED_HZ_MAX;
+	inky_error_state rst;
 	inky_spidev_intf *iptr = (inky_spidev_intf*) intf_ptr;
 
-	iptr->fd = open(iptr->special, O_RDWR);
+	inky_spidev_lock(iptr);
+	rst = spi_setup(intf_ptr);
+	inky_spidev_unlock(iptr);
 
-	if (iptr->fd < 0) {
-		return errno == EACCES ? INKY_E_BAD_PERMISSIONS :
-			INKY_E_COMM_FAILURE;
-	}
+	return rst;
+}
 
-	err = ioctl(iptr->fd, SPI_IOC_WR_MODE, &mode);
-	if (err == -1) {
-		return INKY_E_COMM_FAILURE;
-	}
+inky_error_state inky_spidev_delay(uint32_t delay_us, void *intf_ptr)
+{
+	int rst;
+	inky_spidev_intf *iptr = (inky_spidev_intf*) intf_ptr;
+	bool yielded = false;
 
-	err = ioctl(iptr->fd, SPI_IOC_WR_BITS_PER_WORD, &bits);
-	if (err == -1) {
-		return INKY_E_COMM_FAILURE;
+	INKY_TRACE2(delay_entry, iptr, delay_us);
+
+	inky_spidev_seq_rec_delay(iptr, delay_us);
+
+	inky_spidev_lock(iptr);
+
+	/* During a hardware access, a settle time too short to lend the
+	 * bus out goes in front of the next SPI message. The kernel times
+	 * it there, without the scheduler slack that turns a usleep() of
+	 * 10 us into a few hundred. Words queued before it go first */
+	if (iptr->hw_depth > 0
+	    && iptr->wire.delay_us + delay_us < INKY_SPIDEV_BUS_YIELD_US) {
+		rst = iptr->wire.len > 0 ? inky_spidev_wire_flush(iptr) :
+			INKY_OK;
+
+		if (rst == INKY_OK) {
+			iptr->wire.delay_us += delay_us;
+		}
+
+		inky_spidev_unlock(iptr);
+
+		rst = rst == INKY_OK ? INKY_OK : INKY_E_FAILURE;
+		INKY_TRACE3(delay_return, iptr, delay_us, rst);
+
+		return rst;
 	}
 
-	err = ioctl(iptr->fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
-	if (err == -1) {
-		return INKY_E_COMM_FAILURE;
+	/* The delay times something sent before it, so send that now */
+	if (inky_spidev_wire_flush(iptr) != INKY_OK) {
+		inky_spidev_unlock(iptr);
+		INKY_TRACE3(delay_return, iptr, delay_us, INKY_E_FAILURE);
+		return INKY_E_FAILURE;
 	}
 
-	return INKY_OK;
-}
+	/* Reset pulses and settle times don't use the bus either */
+	if (delay_us >= INKY_SPIDEV_BUS_YIELD_US) {
+		yielded = inky_spidev_bus_yield(iptr);
+	}
 
-inky_error_state inky_spidev_delay(uint32_t delay_us, void *intf_ptr)
-{
-	int rst;
+	inky_spidev_unlock(iptr);
 
 	rst = usleep(delay_us);
 
-	if (rst < 0) {
-		return INKY_E_FAILURE;
+	if (yielded) {
+		inky_spidev_lock(iptr);
+
+		if (inky_spidev_bus_resume(iptr, yielded) != INKY_OK) {
+			rst = -1;
+		}
+
+		inky_spidev_unlock(iptr);
 	}
 
-	return INKY_OK;
+	rst = rst < 0 ? INKY_E_FAILURE : INKY_OK;
+	INKY_TRACE3(delay_return, iptr, delay_us, rst);
+
+	return rst;
 }
 
 inky_error_state inky_spidev_spi_write(const uint8_t* buf, uint32_t len,
 				     void *intf_ptr)
 {
-	int rst;
+	inky_error_state rst;
+	inky_error_state end_rst;
 	inky_spidev_intf *iptr = (inky_spidev_intf*) intf_ptr;
 
-	struct spi_ioc_transfer tr = {
-		.tx_buf = (unsigned long) buf,
-		.rx_buf = 0,
-		.len = len,
-		.delay_usecs = 0,
-		.speed_hz = INKY_SPI_SPEED_HZ_MAX,
-		.bits_per_word = 8
-	};
+	INKY_TRACE2(spi_write_entry, iptr, len);
 
-	rst = ioctl(iptr->fd, SPI_IOC_MESSAGE(1), &tr);
+	rst = inky_spidev_hw_begin(iptr);
+	if (rst != INKY_OK) {
+		INKY_TRACE3(spi_write_return, iptr, len, rst);
+		return rst;
+	}
 
-	if (rst < 0)
-		return INKY_E_FAILURE;
+	if (inky_spidev_wire_3(iptr)) {
+		rst = inky_spidev_wire_queue(iptr, buf, len);
+	} else {
+		rst = spi_write(buf, len, intf_ptr);
+	}
 
-	return INKY_OK;
+	if (rst == INKY_OK) {
+		inky_spidev_seq_rec_data(iptr, buf, len);
+	}
+
+	/* Remember which command a following BUSY wait belongs to */
+	if (rst == INKY_OK && len > 0) {
+		busy_track(&iptr->busy, buf, len);
+		ram_track(iptr, buf, len);
+	}
+
+	end_rst = inky_spidev_hw_end(iptr);
+	rst = rst != INKY_OK ? rst : end_rst;
+
+	INKY_TRACE3(spi_write_return, iptr, len, rst);
+
+	return rst;
 }
 
 inky_error_state inky_spidev_spi_write16(const uint16_t* buf, uint32_t len,
 					 void *intf_ptr)
 {
-	int rst;
+	inky_error_state rst;
+	inky_error_state end_rst;
 	inky_spidev_intf *iptr = (inky_spidev_intf*) intf_ptr;
 
-	struct spi_ioc_transfer tr = {
-		.tx_buf = (unsigned long) buf,
-		.rx_buf = 0,
-		.len = len,
-		.delay_usecs = 5,
-		.speed_hz = INKY_SPI_SPEED_HZ_MAX,
-		.bits_per_word = 16
-	};
+	INKY_TRACE2(spi_write16_entry, iptr, len);
 
-	rst = ioctl(iptr->fd, SPI_IOC_MESSAGE(1), &tr);
+	rst = inky_spidev_hw_begin(iptr);
+	if (rst != INKY_OK) {
+		INKY_TRACE3(spi_write16_return, iptr, len, rst);
+		return rst;
+	}
 
-	if (rst < 0)
-		return INKY_E_FAILURE;
+	if (inky_spidev_wire_3(iptr)) {
+		/* The controller takes bytes, most significant first */
+		for (uint32_t i = 0; i < len && rst == INKY_OK; ++i) {
+			const uint8_t be[2] = { buf[i] >> 8, buf[i] & 0xff };
 
-	return INKY_OK;
+			rst = inky_spidev_wire_queue(iptr, be, 2);
+		}
+	} else {
+		rst = spi_write16(buf, len, intf_ptr);
+	}
+
+	end_rst = inky_spidev_hw_end(iptr);
+	rst = rst != INKY_OK ? rst : end_rst;
+
+	INKY_TRACE3(spi_write16_return, iptr, len, rst);
+
+	return rst;
 }
 
 int8_t inky_spidev_init(inky_spidev_intf *intf_ptr, const char* spidev,
 			const char* gpiochip, unsigned int reset_offset,
 			unsigned int busy_offset, unsigned int dc_offset)
 {
-	inky_config *dev = &intf_ptr->dev;
-
 	/* Point the gpio pins to the correct pointers */
 	intf_ptr->gpio_chip = gpiod_chip_open_lookup(gpiochip);
 	intf_ptr->gpio_reset = gpiod_chip_get_line(intf_ptr->gpio_chip,
@@ -302,9 +507,53 @@ int8_t inky_spidev_init(inky_spidev_intf *intf_ptr, const char* spidev,
 		return -1;
 	}
 
+	inky_spidev_init_common(intf_ptr, spidev);
+
+	INKY_TRACE2(init, intf_ptr, intf_ptr->special);
+
+	return 0;
+}
+
+void inky_spidev_init_common(inky_spidev_intf *intf_ptr,
+			     const char *spidev)
+{
+	inky_config *dev = &intf_ptr->dev;
+	pthread_mutexattr_t mattr;
+
+	/* Callbacks nest (present -> cmd -> spi_write), so the lock
+	 * must be recursive */
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_settype(&mattr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&intf_ptr->lock, &mattr);
+	pthread_mutexattr_destroy(&mattr);
+
 	/* assign the provided spi device */
 	strncpy(intf_ptr->special, spidev, INKY_SPIDEV_SPECIAL_LEN - 1);
 	intf_ptr->fd = 0;
+	intf_ptr->bufsiz = INKY_SPIDEV_BUFSIZ_DEFAULT;
+	intf_ptr->transport = &inky_spidev_transport_ioctl;
+	memset(intf_ptr->pincfg, 0, sizeof(intf_ptr->pincfg));
+	memset(&intf_ptr->idle, 0, sizeof(intf_ptr->idle));
+	intf_ptr->seq_rec = NULL;
+	intf_ptr->init_seq = NULL;
+	intf_ptr->seq_dir[0] = '\0';
+	intf_ptr->bus = NULL;
+	intf_ptr->bus_depth = 0;
+	intf_ptr->bus_yielded = false;
+	intf_ptr->model = NULL;
+	intf_ptr->lat = NULL;
+	memset(&intf_ptr->busy, 0, sizeof(intf_ptr->busy));
+	intf_ptr->busy.mode = INKY_SPIDEV_BUSY_ADAPTIVE;
+	intf_ptr->busy.min_us = INKY_SPIDEV_BUSY_MIN_US;
+	intf_ptr->busy.max_us = INKY_SPIDEV_BUSY_MAX_US;
+	memset(&intf_ptr->temp, 0, sizeof(intf_ptr->temp));
+	memset(&intf_ptr->ram, 0, sizeof(intf_ptr->ram));
+	memset(&intf_ptr->wire, 0, sizeof(intf_ptr->wire));
+	intf_ptr->wire.mode = INKY_SPIDEV_WIRE_4;
+	intf_ptr->hw_depth = 0;
+	intf_ptr->temp.source = INKY_SPIDEV_TEMP_INTERNAL;
+	intf_ptr->temp.band = INKY_SPIDEV_TEMP_BAND;
+	intf_ptr->temp.loaded = INKY_SPIDEV_TEMP_UNKNOWN;
 
 	/* Fill out the inky device structure callbacks */
 	dev->gpio_init_cb = inky_spidev_gpio_initialize;
@@ -324,6 +573,8 @@ int8_t inky_spidev_init(inky_spidev_intf *intf_ptr, const char* spidev,
 
 	/* Set up Inky What Red settings */
 	dev->pdt = INKY_WHAT;
+	intf_ptr->width = 400;
+	intf_ptr->height = 300;
 	dev->fb = NULL;
 	dev->active_fb = NULL;
 	dev->exclude_flags = 0;
@@ -332,15 +583,168 @@ int8_t inky_spidev_init(inky_spidev_intf *intf_ptr, const char* spidev,
 	intf_ptr->color_cfg.red = 1;
 	intf_ptr->color_cfg.yellow = 0;
 	dev->color = &intf_ptr->color_cfg;
+}
 
-	return 0;
+int8_t inky_spidev_set_transport(inky_spidev_intf *intf_ptr,
+				 const inky_spidev_transport *transport)
+{
+	if (!intf_ptr || !transport) {
+		return INKY_E_NULL_PTR;
+	}
+
+	inky_spidev_lock(intf_ptr);
+	intf_ptr->transport = transport;
+	inky_spidev_unlock(intf_ptr);
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_busy_config(inky_spidev_intf *intf_ptr,
+			       inky_spidev_busy_mode mode,
+			       uint32_t min_us, uint32_t max_us)
+{
+	if (!intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	if (max_us == 0
+	    || (mode == INKY_SPIDEV_BUSY_ADAPTIVE
+		&& (min_us == 0 || min_us > max_us))) {
+		return INKY_E_OUT_OF_RANGE;
+	}
+
+	inky_spidev_lock(intf_ptr);
+	intf_ptr->busy.mode = mode;
+	intf_ptr->busy.min_us = min_us;
+	intf_ptr->busy.max_us = max_us;
+	inky_spidev_unlock(intf_ptr);
+
+	return INKY_OK;
+}
+
+uint32_t inky_spidev_busy_expected(inky_spidev_intf *intf_ptr,
+				   uint16_t key)
+{
+	inky_spidev_busy_hist *hist;
+	uint32_t expected;
+
+	if (!intf_ptr) {
+		return 0;
+	}
+
+	inky_spidev_lock(intf_ptr);
+	hist = busy_hist(intf_ptr, key, false);
+	expected = hist ? hist->expected_us : 0;
+	inky_spidev_unlock(intf_ptr);
+
+	return expected;
+}
+
+int8_t inky_spidev_busy_forget(inky_spidev_intf *intf_ptr, uint16_t key)
+{
+	inky_spidev_busy_hist *hist;
+
+	if (!intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	inky_spidev_lock(intf_ptr);
+
+	hist = busy_hist(intf_ptr, key, false);
+
+	if (hist) {
+		hist->samples = 0;
+		hist->expected_us = 0;
+	}
+
+	inky_spidev_unlock(intf_ptr);
+
+	return INKY_OK;
+}
+
+int8_t inky_spidev_busy_hint(inky_spidev_intf *intf_ptr, uint16_t key,
+			     uint32_t expected_us)
+{
+	inky_spidev_busy_hist *hist;
+
+	if (!intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	if (expected_us == 0) {
+		return INKY_OK;
+	}
+
+	inky_spidev_lock(intf_ptr);
+
+	hist = busy_hist(intf_ptr, key, true);
+
+	/* No samples, so the first measured wait replaces the hint */
+	if (hist->samples == 0) {
+		hist->expected_us = expected_us;
+	}
+
+	inky_spidev_unlock(intf_ptr);
+
+	return INKY_OK;
+}
+
+void inky_spidev_lock(inky_spidev_intf *intf_ptr)
+{
+	pthread_mutex_lock(&intf_ptr->lock);
+}
+
+void inky_spidev_unlock(inky_spidev_intf *intf_ptr)
+{
+	pthread_mutex_unlock(&intf_ptr->lock);
+}
+
+int8_t inky_spidev_update(inky_spidev_intf *intf_ptr)
+{
+	int8_t rst;
+	int8_t end_rst;
+
+	if (!intf_ptr) {
+		return INKY_E_NULL_PTR;
+	}
+
+	rst = inky_spidev_hw_begin(intf_ptr);
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	rst = inky_update(&intf_ptr->dev);
+
+	end_rst = inky_spidev_hw_end(intf_ptr);
+
+	return rst != INKY_OK ? rst : end_rst;
 }
 
 int8_t inky_spidev_deinit(inky_spidev_intf *intf_ptr)
 {
-	close(intf_ptr->fd);
+	INKY_TRACE1(deinit, intf_ptr);
+
+	inky_spidev_idle_disable(intf_ptr);
+	inky_spidev_bus_detach(intf_ptr);
+
+	if (intf_ptr->init_seq) {
+		inky_spidev_seq_free(intf_ptr->init_seq);
+		free(intf_ptr->init_seq);
+	}
+
+	if (intf_ptr->fd > 0) {
+		close(intf_ptr->fd);
+	}
+
+	for (int p = 0; p < 2; ++p) {
+		free(intf_ptr->ram.copy[p]);
+		intf_ptr->ram.copy[p] = NULL;
+	}
+
 	gpiod_chip_close(intf_ptr->gpio_chip);
 
+	pthread_mutex_destroy(&intf_ptr->lock);
+
 	return 0;
 }
 /*
@@ -372,3 +776,473 @@ static struct gpiod_line *get_line_struct(inky_spidev_intf *intf_ptr,
 
 	return this_line;
 }
+
+static uint32_t read_spidev_bufsiz(void)
+{
+	FILE *f;
+	unsigned long val;
+
+	f = fopen(INKY_SPIDEV_BUFSIZ_PARAM, "r");
+
+	if (!f) {
+		return INKY_SPIDEV_BUFSIZ_DEFAULT;
+	}
+
+	if (fscanf(f, "%lu", &val) != 1 || val == 0) {
+		val = INKY_SPIDEV_BUFSIZ_DEFAULT;
+	}
+
+	fclose(f);
+
+	return (uint32_t) val;
+}
+
+static inky_spidev_pincfg *get_pincfg(inky_spidev_intf *intf_ptr,
+				       inky_pin gpin)
+{
+	switch (gpin) {
+	case INKY_PIN_RESET:
+		return &intf_ptr->pincfg[0];
+	case INKY_PIN_BUSY:
+		return &intf_ptr->pincfg[1];
+	case INKY_PIN_DC:
+		return &intf_ptr->pincfg[2];
+	default:
+		return NULL;
+	}
+}
+
+static inky_error_state spi_setup(void *intf_ptr)
+{
+	int err;
+	uint8_t mode = SPI_MODE_0;
+	uint8_t bits = INKY_SPI_BITS_DEFAULT;
+	uint32_t speed = INKY_SPI_SPEED_HZ_MAX;
+	inky_spidev_intf *iptr = (inky_spidev_intf*) intf_ptr;
+
+	iptr->fd = open(iptr->special, O_RDWR);
+
+	if (iptr->fd < 0) {
+		return errno == EACCES ? INKY_E_BAD_PERMISSIONS :
+			INKY_E_COMM_FAILURE;
+	}
+
+	err = ioctl(iptr->fd, SPI_IOC_WR_MODE, &mode);
+	if (err == -1) {
+		return INKY_E_COMM_FAILURE;
+	}
+
+	err = ioctl(iptr->fd, SPI_IOC_WR_BITS_PER_WORD, &bits);
+	if (err == -1) {
+		return INKY_E_COMM_FAILURE;
+	}
+
+	err = ioctl(iptr->fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
+	if (err == -1) {
+		return INKY_E_COMM_FAILURE;
+	}
+
+	iptr->bufsiz = read_spidev_bufsiz();
+
+	return INKY_OK;
+}
+
+static inky_error_state gpio_output_state(inky_pin gpin,
+					  inky_pin_state gstate,
+					  void *intf_ptr)
+{
+	int pinstate;
+	inky_spidev_intf *iptr = (inky_spidev_intf*) intf_ptr;
+
+	if (gstate == INKY_PINSTATE_HIGH) {
+		pinstate = 1;
+	} else {
+		pinstate = 0;
+	}
+
+	return iptr->transport->gpio_set(intf_ptr, gpin, pinstate);
+}
+
+static inky_error_state gpio_input_state(inky_pin gpin,
+					 inky_pin_state* out,
+					 void *intf_ptr)
+{
+	inky_error_state rst;
+	int value;
+	inky_spidev_intf *iptr = (inky_spidev_intf*) intf_ptr;
+
+	if (!out) {
+		return INKY_E_NULL_PTR;
+	}
+
+	rst = iptr->transport->gpio_get(intf_ptr, gpin, &value);
+
+	if (rst != INKY_OK) {
+		return rst;
+	}
+
+	/* These might flip if active low is flagged in */
+	if (value == 1) {
+		*out = INKY_PINSTATE_HIGH;
+	} else {
+		*out = INKY_PINSTATE_LOW;
+	}
+
+	return INKY_OK;
+}
+
+static inky_error_state gpio_poll_pin(inky_pin gpin,
+				      uint64_t timeout,
+				      void *intf_ptr)
+{
+	inky_pin_state pinstate;
+	inky_spidev_intf *iptr = (inky_spidev_intf*) intf_ptr;
+	inky_spidev_busy *busy = &iptr->busy;
+	inky_spidev_busy_hist *hist;
+	uint64_t start = now_us();
+	uint64_t deadline = start + timeout;
+	uint64_t skip_to = start;
+	uint32_t interval = busy->max_us;
+	uint32_t cap = busy->max_us;
+
+	if (busy->mode == INKY_SPIDEV_BUSY_ADAPTIVE) {
+		interval = busy->min_us;
+		hist = gpin == INKY_PIN_BUSY ?
+			busy_hist(iptr, busy->key, false) : NULL;
+
+		/* Sleep through most of a wait seen before, then poll
+		 * finely enough to catch the end within an eighth of it */
+		if (hist && hist->expected_us > 0) {
+			skip_to = start + hist->expected_us
+				- hist->expected_us / 8;
+
+			if (hist->expected_us / 8 < cap) {
+				cap = hist->expected_us / 8;
+			}
+
+			if (cap < interval) {
+				cap = interval;
+			}
+		}
+	}
+
+	for (;;) {
+		uint64_t now;
+		uint64_t wake;
+
+		if (iptr->dev.gpio_input_cb(gpin, &pinstate, intf_ptr) < 0) {
+			return INKY_E_FAILURE;
+		}
+
+		if (pinstate == INKY_PINSTATE_LOW) {
+			return INKY_OK;
+		}
+
+		now = now_us();
+
+		if (now >= deadline) {
+			return INKY_E_TIMEOUT;
+		}
+
+		if (now < skip_to) {
+			wake = skip_to;
+		} else {
+			wake = now + interval;
+
+			if (busy->mode == INKY_SPIDEV_BUSY_ADAPTIVE) {
+				interval = interval > cap / 2 ?
+					cap : interval * 2;
+			}
+		}
+
+		/* Wake at the deadline for one last read */
+		sleep_until_us(wake < deadline ? wake : deadline);
+	}
+}
+
+static inky_error_state spi_write(const uint8_t* buf, uint32_t len,
+				  void *intf_ptr)
+{
+	inky_error_state rst;
+	inky_spidev_intf *iptr = (inky_spidev_intf*) intf_ptr;
+	uint32_t chunk = iptr->bufsiz;
+
+	if (chunk == 0) {
+		chunk = INKY_SPIDEV_BUFSIZ_DEFAULT;
+	}
+
+	/* spidev rejects messages longer than its bufsiz */
+	for (uint32_t off = 0; off < len; off += chunk) {
+		struct spi_ioc_transfer tr = {
+			.tx_buf = (unsigned long) (buf + off),
+			.rx_buf = 0,
+			.len = len - off < chunk ? len - off : chunk,
+			.delay_usecs = 0,
+			.speed_hz = INKY_SPI_SPEED_HZ_MAX,
+			.bits_per_word = 8
+		};
+
+		rst = inky_spidev_wire_transfer(iptr, &tr);
+
+		if (rst != INKY_OK)
+			return rst;
+	}
+
+	return INKY_OK;
+}
+
+static inky_error_state spi_write16(const uint16_t* buf, uint32_t len,
+				    void *intf_ptr)
+{
+	inky_error_state rst;
+	inky_spidev_intf *iptr = (inky_spidev_intf*) intf_ptr;
+	uint32_t chunk = iptr->bufsiz;
+	uint32_t n;
+
+	if (chunk == 0) {
+		chunk = INKY_SPIDEV_BUFSIZ_DEFAULT;
+	}
+
+	chunk /= sizeof(uint16_t);
+
+	if (iptr->wire.swap16) {
+		return spi_write16_bytes(buf, len, intf_ptr);
+	}
+
+	/* spidev shifts 16 bit words out most significant bit first from
+	 * host order, so the words go out as they are on any host */
+	for (uint32_t off = 0; off < len; off += n) {
+		n = len - off < chunk ? len - off : chunk;
+
+		struct spi_ioc_transfer tr = {
+			.tx_buf = (unsigned long) (buf + off),
+			.rx_buf = 0,
+			.len = n * sizeof(uint16_t),
+			.delay_usecs = 0,
+			.speed_hz = INKY_SPI_SPEED_HZ_MAX,
+			.bits_per_word = 16
+		};
+
+		rst = inky_spidev_wire_transfer(iptr, &tr);
+
+		/* A controller without 16 bit words rejects the first
+		 * transfer before clocking anything out, as with 9 bit
+		 * words in inky_spidev_wire_flush(). Any other error is a
+		 * real failure and is returned */
+		if (rst == INKY_E_OUT_OF_RANGE && off == 0) {
+			iptr->wire.swap16 = true;
+			return spi_write16_bytes(buf, len, intf_ptr);
+		}
+
+		if (rst != INKY_OK) {
+			return rst;
+		}
+	}
+
+	return INKY_OK;
+}
+
+static inky_error_state spi_write16_bytes(const uint16_t* buf,
+					  uint32_t len, void *intf_ptr)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	/* Memory order already is wire order */
+	return spi_write((const uint8_t*) buf, len * sizeof(uint16_t),
+			 intf_ptr);
+#else
+	inky_error_state rst;
+	inky_spidev_intf *iptr = (inky_spidev_intf*) intf_ptr;
+	uint8_t be[INKY_SPIDEV_BUFSIZ_DEFAULT];
+	uint32_t chunk = iptr->bufsiz;
+	uint32_t n;
+
+	if (chunk == 0 || chunk > sizeof(be)) {
+		chunk = sizeof(be);
+	}
+
+	chunk /= sizeof(uint16_t);
+
+	for (uint32_t off = 0; off < len; off += n) {
+		n = len - off < chunk ? len - off : chunk;
+
+		for (uint32_t i = 0; i < n; ++i) {
+			be[2 * i] = buf[off + i] >> 8;
+			be[2 * i + 1] = buf[off + i] & 0xff;
+		}
+
+		struct spi_ioc_transfer tr = {
+			.tx_buf = (unsigned long) be,
+			.rx_buf = 0,
+			.len = n * sizeof(uint16_t),
+			.delay_usecs = 0,
+			.speed_hz = INKY_SPI_SPEED_HZ_MAX,
+			.bits_per_word = 8
+		};
+
+		rst = inky_spidev_wire_transfer(iptr, &tr);
+
+		if (rst != INKY_OK) {
+			return rst;
+		}
+	}
+
+	return INKY_OK;
+#endif
+}
+
+/* Commands are keyed with the first data byte of the command before
+ * them, so 0x20 after 0x22 0xf7 (refresh) and after 0x22 0xb1 (load
+ * temperature) are learned apart */
+static void busy_track(inky_spidev_busy *busy, const uint8_t *buf,
+		       uint32_t len)
+{
+	if (busy->cmd_mode) {
+		busy->key = (uint16_t) buf[len - 1] << 8
+			| (busy->have_arg ? busy->arg : 0);
+		busy->have_arg = false;
+	} else if (!busy->have_arg) {
+		busy->arg = buf[0];
+		busy->have_arg = true;
+	}
+}
+
+static void ram_track(inky_spidev_intf *iptr, const uint8_t *buf,
+		      uint32_t len)
+{
+	uint8_t cmd = buf[len - 1];
+
+	/* RAM written by anything but a present, such as the Inky
+	 * driver, no longer matches the copies a present kept */
+	if (!iptr->busy.cmd_mode || iptr->ram.writing) {
+		return;
+	}
+
+	if (cmd == INKY_CMD_WRITE_RAM_BW || cmd == INKY_CMD_FILL_RAM_BW) {
+		iptr->ram.valid[0] = false;
+	} else if (cmd == INKY_CMD_WRITE_RAM_COLOR
+		   || cmd == INKY_CMD_FILL_RAM_COLOR) {
+		iptr->ram.valid[1] = false;
+	}
+}
+
+static inky_spidev_busy_hist *busy_hist(inky_spidev_intf *iptr,
+				       uint16_t key, bool add)
+{
+	inky_spidev_busy *busy = &iptr->busy;
+	inky_spidev_busy_hist *victim;
+
+	for (unsigned int i = 0; i < busy->nhist; ++i) {
+		if (busy->hist[i].key == key) {
+			return &busy->hist[i];
+		}
+	}
+
+	if (!add) {
+		return NULL;
+	}
+
+	if (busy->nhist < INKY_SPIDEV_BUSY_OPS) {
+		victim = &busy->hist[busy->nhist++];
+	} else {
+		/* Forget the command we know least about */
+		victim = &busy->hist[0];
+
+		for (unsigned int i = 1; i < busy->nhist; ++i) {
+			if (busy->hist[i].samples < victim->samples) {
+				victim = &busy->hist[i];
+			}
+		}
+	}
+
+	victim->key = key;
+	victim->samples = 0;
+	victim->expected_us = 0;
+
+	return victim;
+}
+
+static void busy_learn(inky_spidev_intf *iptr, uint16_t key,
+		       uint32_t waited_us)
+{
+	inky_spidev_busy_hist *hist = busy_hist(iptr, key, true);
+	int64_t diff = (int64_t) waited_us - hist->expected_us;
+
+	/* Weight 1/4 follows temperature drift within a few refreshes */
+	if (hist->samples == 0) {
+		hist->expected_us = waited_us;
+	} else {
+		hist->expected_us += diff / 4;
+	}
+
+	if (hist->samples < UINT32_MAX) {
+		++hist->samples;
+	}
+}
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_us(uint64_t when)
+{
+	struct timespec ts = {
+		.tv_sec = when / 1000000,
+		.tv_nsec = (when % 1000000) * 1000
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+			       NULL) == EINTR)
+		;
+}
+
+static inky_error_state ioctl_spi_transfer(void *intf_ptr,
+					   struct spi_ioc_transfer *xfers,
+					   uint32_t n)
+{
+	int rst;
+	inky_spidev_intf *iptr = (inky_spidev_intf*) intf_ptr;
+
+	rst = ioctl(iptr->fd, SPI_IOC_MESSAGE(n), xfers);
+
+	/* spidev checks bits_per_word against the controller up front */
+	if (rst < 0) {
+		return errno == EINVAL ? INKY_E_OUT_OF_RANGE :
+			INKY_E_FAILURE;
+	}
+
+	return INKY_OK;
+}
+
+static inky_error_state gpiod_set(void *intf_ptr, inky_pin gpin, int value)
+{
+	struct gpiod_line *this_line;
+
+	this_line = get_line_struct((inky_spidev_intf*) intf_ptr, gpin);
+
+	if (gpiod_line_set_value(this_line, value) < 0) {
+		return INKY_E_FAILURE;
+	}
+
+	return INKY_OK;
+}
+
+static inky_error_state gpiod_get(void *intf_ptr, inky_pin gpin,
+				  int *value)
+{
+	struct gpiod_line *this_line;
+
+	this_line = get_line_struct((inky_spidev_intf*) intf_ptr, gpin);
+
+	*value = gpiod_line_get_value(this_line);
+
+	if (*value < 0) {
+		return INKY_E_FAILURE;
+	}
+
+	return INKY_OK;
+}
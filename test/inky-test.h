@@ -0,0 +1,66 @@
+#ifndef INKY_TEST_H
+#define INKY_TEST_H
+
+#include <inky-spidev.h>
+
+#include "inky-spidev-init.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Exit code CTest treats as a skipped test */
+#define INKY_TEST_SKIP 77
+
+static int inky_test_failures;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", \
+				__FILE__, __LINE__, #cond); \
+			++inky_test_failures; \
+		} \
+	} while (0)
+
+#define CHECK_EQ(a, b) \
+	do { \
+		long long va_ = (long long) (a); \
+		long long vb_ = (long long) (b); \
+		if (va_ != vb_) { \
+			fprintf(stderr, "%s:%d: %s == %s: %lld != %lld\n", \
+				__FILE__, __LINE__, #a, #b, va_, vb_); \
+			++inky_test_failures; \
+		} \
+	} while (0)
+
+#define RUN(test) \
+	do { \
+		int before_ = inky_test_failures; \
+		test(); \
+		fprintf(stderr, "%s %s\n", \
+			inky_test_failures == before_ ? "PASS" : "FAIL", \
+			#test); \
+	} while (0)
+
+#define TEST_RESULT() (inky_test_failures ? EXIT_FAILURE : EXIT_SUCCESS)
+
+static inline uint64_t test_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Set up an interface as inky_spidev_init() does, minus the GPIO
+ * chip lookup, so callbacks can run without hardware */
+static inline void test_intf_init(inky_spidev_intf *intf, const char *dev)
+{
+	memset(intf, 0, sizeof(*intf));
+	inky_spidev_init_common(intf, dev);
+}
+
+#endif /* #ifndef INKY_TEST_H */
@@ -0,0 +1,278 @@
+#define _GNU_SOURCE
+
+#include "ioctl-shim.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+
+#define BUFSIZ_PARAM "/sys/module/spidev/parameters/bufsiz"
+
+static inky_shim_stats stats;
+static int shim_fd = -1;
+static int fail_after = -1;
+static uint8_t max_bits = 32;
+
+static int is_shim_path(const char *path);
+
+static FILE *bufsiz_file(const char *path, const char *mode,
+			 FILE *(*real)(const char*, const char*));
+
+static int spi_message(const struct spi_ioc_transfer *xfers, uint32_t n);
+
+/*
+**********************************************************************
+******************* SHIM CONTROL *************************************
+**********************************************************************
+*/
+
+const inky_shim_stats *inky_shim_stats_get(void)
+{
+	return &stats;
+}
+
+void inky_shim_reset(void)
+{
+	memset(&stats, 0, sizeof(stats));
+	stats.hash = INKY_SHIM_HASH_INIT;
+	fail_after = -1;
+	max_bits = 32;
+}
+
+void inky_shim_fail_after(int n)
+{
+	fail_after = n;
+}
+
+void inky_shim_max_bits(uint8_t bits)
+{
+	max_bits = bits;
+}
+
+uint64_t inky_shim_hash(uint64_t h, const uint8_t *buf, uint32_t len)
+{
+	for (uint32_t i = 0; i < len; ++i) {
+		h = (h ^ buf[i]) * 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+/*
+**********************************************************************
+******************* INTERPOSED LIBC CALLS ****************************
+**********************************************************************
+*/
+
+int open(const char *path, int flags, ...)
+{
+	static int (*real)(const char*, int, ...);
+	mode_t mode = 0;
+	va_list ap;
+
+	if (!real) {
+		real = dlsym(RTLD_NEXT, "open");
+	}
+
+	va_start(ap, flags);
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		mode = va_arg(ap, mode_t);
+	}
+	va_end(ap);
+
+	if (is_shim_path(path)) {
+		shim_fd = real("/dev/null", O_RDWR);
+		++stats.opens;
+		return shim_fd;
+	}
+
+	return real(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+
+	va_start(ap, flags);
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		mode = va_arg(ap, mode_t);
+	}
+	va_end(ap);
+
+	return open(path, flags, mode);
+}
+
+int close(int fd)
+{
+	static int (*real)(int);
+
+	if (!real) {
+		real = dlsym(RTLD_NEXT, "close");
+	}
+
+	if (fd >= 0 && fd == shim_fd) {
+		++stats.closes;
+		shim_fd = -1;
+	}
+
+	return real(fd);
+}
+
+FILE *fopen(const char *path, const char *mode)
+{
+	static FILE *(*real)(const char*, const char*);
+
+	if (!real) {
+		real = dlsym(RTLD_NEXT, "fopen");
+	}
+
+	return bufsiz_file(path, mode, real);
+}
+
+FILE *fopen64(const char *path, const char *mode)
+{
+	static FILE *(*real)(const char*, const char*);
+
+	if (!real) {
+		real = dlsym(RTLD_NEXT, "fopen64");
+	}
+
+	return bufsiz_file(path, mode, real);
+}
+
+int ioctl(int fd, unsigned long req, ...)
+{
+	static int (*real)(int, unsigned long, ...);
+	void *arg;
+	va_list ap;
+
+	if (!real) {
+		real = dlsym(RTLD_NEXT, "ioctl");
+	}
+
+	va_start(ap, req);
+	arg = va_arg(ap, void*);
+	va_end(ap);
+
+	if (fd < 0 || fd != shim_fd) {
+		return real(fd, req, arg);
+	}
+
+	++stats.ioctls;
+
+	switch (req) {
+	case SPI_IOC_WR_MODE:
+		stats.mode = *(uint8_t*) arg;
+		return 0;
+	case SPI_IOC_WR_BITS_PER_WORD:
+		stats.bits = *(uint8_t*) arg;
+		return 0;
+	case SPI_IOC_WR_MAX_SPEED_HZ:
+		stats.speed = *(uint32_t*) arg;
+		return 0;
+	default:
+		break;
+	}
+
+	/* SPI_IOC_MESSAGE(n) encodes n in the argument size */
+	if (_IOC_TYPE(req) == SPI_IOC_MAGIC && _IOC_NR(req) == 0
+	    && _IOC_DIR(req) == _IOC_WRITE) {
+		return spi_message(arg, _IOC_SIZE(req)
+				   / sizeof(struct spi_ioc_transfer));
+	}
+
+	errno = ENOTTY;
+
+	return -1;
+}
+
+/*
+**********************************************************************
+********************** INTERNAL FUNCTIONS ****************************
+**********************************************************************
+*/
+
+static int is_shim_path(const char *path)
+{
+	const char *dev = getenv("INKY_SHIM_DEV");
+
+	return dev && path && strcmp(path, dev) == 0;
+}
+
+static FILE *bufsiz_file(const char *path, const char *mode,
+			 FILE *(*real)(const char*, const char*))
+{
+	static char text[32];
+	const char *val = getenv("INKY_SHIM_BUFSIZ");
+
+	if (!path || strcmp(path, BUFSIZ_PARAM) != 0 || !val) {
+		return real(path, mode);
+	}
+
+	if (strcmp(val, "none") == 0) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	snprintf(text, sizeof(text), "%s\n", val);
+
+	return fmemopen(text, strlen(text), "r");
+}
+
+static int spi_message(const struct spi_ioc_transfer *xfers, uint32_t n)
+{
+	int total = 0;
+
+	if (fail_after == 0) {
+		errno = EIO;
+		return -1;
+	}
+
+	if (fail_after > 0) {
+		--fail_after;
+	}
+
+	/* The kernel validates the whole message before sending any of it */
+	for (uint32_t i = 0; i < n; ++i) {
+		if (xfers[i].bits_per_word > max_bits) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	for (uint32_t i = 0; i < n; ++i) {
+		const struct spi_ioc_transfer *x = &xfers[i];
+
+		if (stats.nxfers < INKY_SHIM_MAX_XFERS) {
+			stats.xfers[stats.nxfers++] = (inky_shim_xfer) {
+				.msg = stats.messages,
+				.len = x->len,
+				.delay_usecs = x->delay_usecs,
+				.bits_per_word = x->bits_per_word,
+				.speed_hz = x->speed_hz,
+				.tx_buf = x->tx_buf
+			};
+		}
+
+		if (x->tx_buf) {
+			stats.hash = inky_shim_hash(stats.hash,
+						    (const uint8_t*) (uintptr_t)
+						    x->tx_buf, x->len);
+		}
+
+		stats.bytes += x->len;
+		total += x->len;
+	}
+
+	++stats.messages;
+
+	return total;
+}
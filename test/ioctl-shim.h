@@ -0,0 +1,59 @@
+#ifndef INKY_IOCTL_SHIM_H
+#define INKY_IOCTL_SHIM_H
+
+#include <stdint.h>
+
+/*
+ * LD_PRELOAD shim that stands in for a spidev character device.
+ *
+ * Opening the path in the INKY_SHIM_DEV environment variable returns
+ * a descriptor for /dev/null and every ioctl on it is recorded instead
+ * of reaching a driver. Reads of the spidev bufsiz module parameter
+ * return INKY_SHIM_BUFSIZ, or fail when it is set to "none".
+ */
+
+#define INKY_SHIM_MAX_XFERS 4096
+
+/** One spi_ioc_transfer seen by the shim */
+typedef struct {
+	uint32_t msg; /**< Index of the SPI_IOC_MESSAGE it belonged to */
+	uint32_t len;
+	uint16_t delay_usecs;
+	uint8_t bits_per_word;
+	uint32_t speed_hz;
+	uint64_t tx_buf;
+} inky_shim_xfer;
+
+typedef struct {
+	uint32_t opens;
+	uint32_t closes;
+	uint32_t ioctls; /**< All ioctls on the shim descriptor */
+	uint32_t messages; /**< SPI_IOC_MESSAGE calls */
+	uint32_t nxfers;
+	uint64_t bytes;
+	uint64_t hash; /**< FNV-1a over all transmitted bytes in order */
+	uint8_t mode;
+	uint8_t bits;
+	uint32_t speed;
+	inky_shim_xfer xfers[INKY_SHIM_MAX_XFERS];
+} inky_shim_stats;
+
+/** Counters since the last reset */
+const inky_shim_stats *inky_shim_stats_get(void);
+
+/** Zero all counters */
+void inky_shim_reset(void);
+
+/** Fail SPI_IOC_MESSAGE calls with EIO after n more succeed, -1 never */
+void inky_shim_fail_after(int n);
+
+/** Fail SPI_IOC_MESSAGE calls with EINVAL if a transfer uses wider
+ *  words, like a controller's bits_per_word_mask. 32 by default */
+void inky_shim_max_bits(uint8_t bits);
+
+/** FNV-1a hash matching inky_shim_stats::hash */
+uint64_t inky_shim_hash(uint64_t h, const uint8_t *buf, uint32_t len);
+
+#define INKY_SHIM_HASH_INIT 0xcbf29ce484222325ULL
+
+#endif /* #ifndef INKY_IOCTL_SHIM_H */
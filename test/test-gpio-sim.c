@@ -0,0 +1,224 @@
+/*
+ * GPIO callbacks against the kernel's gpio-sim module. Needs configfs
+ * and permission to create simulated chips; skipped otherwise.
+ */
+
+#include "inky-test.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define SIM_ROOT "/sys/kernel/config/gpio-sim"
+#define SIM_LINES 3
+
+#define LINE_RESET 0
+#define LINE_BUSY 1
+#define LINE_DC 2
+
+static char sim_dir[128];
+static char chip_name[32];
+static char dev_name[32];
+
+static int write_attr(const char *dir, const char *attr, const char *val)
+{
+	char path[256];
+	FILE *f;
+	int rst;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	f = fopen(path, "w");
+
+	if (!f) {
+		return -1;
+	}
+
+	rst = fputs(val, f) < 0 ? -1 : 0;
+
+	return fclose(f) == 0 ? rst : -1;
+}
+
+static int read_attr(const char *dir, const char *attr, char *out,
+		     size_t len)
+{
+	char path[256];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	f = fopen(path, "r");
+
+	if (!f) {
+		return -1;
+	}
+
+	if (!fgets(out, len, f)) {
+		fclose(f);
+		return -1;
+	}
+
+	fclose(f);
+	out[strcspn(out, "\n")] = '\0';
+
+	return 0;
+}
+
+static int line_attr_dir(int line, char *out, size_t len)
+{
+	return snprintf(out, len, "/sys/devices/platform/%s/%s/sim_gpio%d",
+			dev_name, chip_name, line) < (int) len ? 0 : -1;
+}
+
+static int line_value(int line)
+{
+	char dir[256];
+	char val[8];
+
+	if (line_attr_dir(line, dir, sizeof(dir)) < 0
+	    || read_attr(dir, "value", val, sizeof(val)) < 0) {
+		return -1;
+	}
+
+	return atoi(val);
+}
+
+static int line_pull(int line, int up)
+{
+	char dir[256];
+
+	if (line_attr_dir(line, dir, sizeof(dir)) < 0) {
+		return -1;
+	}
+
+	return write_attr(dir, "pull", up ? "pull-up" : "pull-down");
+}
+
+static void sim_destroy(void)
+{
+	char bank[160];
+
+	snprintf(bank, sizeof(bank), "%s/bank0", sim_dir);
+
+	write_attr(sim_dir, "live", "0");
+	rmdir(bank);
+	rmdir(sim_dir);
+}
+
+static int sim_create(void)
+{
+	char bank[160];
+	char lines[8];
+
+	snprintf(sim_dir, sizeof(sim_dir), "%s/inky-test-%d", SIM_ROOT,
+		 (int) getpid());
+	snprintf(bank, sizeof(bank), "%s/bank0", sim_dir);
+	snprintf(lines, sizeof(lines), "%d", SIM_LINES);
+
+	if (mkdir(sim_dir, 0755) < 0) {
+		return -1;
+	}
+
+	if (mkdir(bank, 0755) < 0
+	    || write_attr(bank, "num_lines", lines) < 0
+	    || write_attr(sim_dir, "live", "1") < 0
+	    || read_attr(bank, "chip_name", chip_name,
+			 sizeof(chip_name)) < 0
+	    || read_attr(sim_dir, "dev_name", dev_name,
+			 sizeof(dev_name)) < 0) {
+		sim_destroy();
+		return -1;
+	}
+
+	return 0;
+}
+
+static inky_spidev_intf intf;
+
+static void test_output_mapping(void)
+{
+	CHECK_EQ(inky_spidev_gpio_output_state(INKY_PIN_DC,
+					       INKY_PINSTATE_HIGH, &intf),
+		 INKY_OK);
+	CHECK_EQ(line_value(LINE_DC), 1);
+	CHECK_EQ(line_value(LINE_RESET), 1);
+
+	CHECK_EQ(inky_spidev_gpio_output_state(INKY_PIN_RESET,
+					       INKY_PINSTATE_LOW, &intf),
+		 INKY_OK);
+	CHECK_EQ(line_value(LINE_RESET), 0);
+	CHECK_EQ(line_value(LINE_DC), 1);
+
+	CHECK_EQ(inky_spidev_gpio_output_state(INKY_PIN_DC,
+					       INKY_PINSTATE_LOW, &intf),
+		 INKY_OK);
+	CHECK_EQ(line_value(LINE_DC), 0);
+}
+
+static void test_input_mapping(void)
+{
+	inky_pin_state st;
+
+	CHECK_EQ(line_pull(LINE_BUSY, 1), 0);
+	CHECK_EQ(inky_spidev_gpio_input_state(INKY_PIN_BUSY, &st, &intf),
+		 INKY_OK);
+	CHECK_EQ(st, INKY_PINSTATE_HIGH);
+
+	CHECK_EQ(line_pull(LINE_BUSY, 0), 0);
+	CHECK_EQ(inky_spidev_gpio_input_state(INKY_PIN_BUSY, &st, &intf),
+		 INKY_OK);
+	CHECK_EQ(st, INKY_PINSTATE_LOW);
+}
+
+static void test_poll(void)
+{
+	uint64_t t0;
+	uint64_t dt;
+
+	CHECK_EQ(line_pull(LINE_BUSY, 1), 0);
+	t0 = test_now_us();
+	CHECK_EQ(inky_spidev_gpio_poll_pin(INKY_PIN_BUSY, 20000, &intf),
+		 INKY_E_TIMEOUT);
+	dt = test_now_us() - t0;
+	CHECK(dt >= 20000);
+	CHECK(dt < 50000);
+
+	CHECK_EQ(line_pull(LINE_BUSY, 0), 0);
+	CHECK_EQ(inky_spidev_gpio_poll_pin(INKY_PIN_BUSY, 20000, &intf),
+		 INKY_OK);
+}
+
+int main(void)
+{
+	if (sim_create() < 0) {
+		fprintf(stderr, "gpio-sim unavailable: %s\n", strerror(errno));
+		return INKY_TEST_SKIP;
+	}
+
+	if (inky_spidev_init(&intf, "/dev/null", chip_name, LINE_RESET,
+			     LINE_BUSY, LINE_DC) != 0) {
+		fprintf(stderr, "cannot open %s\n", chip_name);
+		sim_destroy();
+		return EXIT_FAILURE;
+	}
+
+	CHECK_EQ(inky_spidev_gpio_setup_pin(INKY_PIN_RESET, INKY_DIR_OUT,
+					    INKY_PINSTATE_HIGH,
+					    INKY_PINCFG_OFF, &intf),
+		 INKY_OK);
+	CHECK_EQ(inky_spidev_gpio_setup_pin(INKY_PIN_BUSY, INKY_DIR_IN,
+					    INKY_PINSTATE_LOW,
+					    INKY_PINCFG_OFF, &intf),
+		 INKY_OK);
+	CHECK_EQ(inky_spidev_gpio_setup_pin(INKY_PIN_DC, INKY_DIR_OUT,
+					    INKY_PINSTATE_LOW,
+					    INKY_PINCFG_OFF, &intf),
+		 INKY_OK);
+
+	RUN(test_output_mapping);
+	RUN(test_input_mapping);
+	RUN(test_poll);
+
+	inky_spidev_deinit(&intf);
+	sim_destroy();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,291 @@
+/*
+ * Latency tracker: stage lengths, percentiles, the record ring and
+ * frames dropped by the triple buffer.
+ */
+
+#include "inky-test.h"
+#include "inky-spidev-lat-rec.h"
+
+#include <inky-spidev-fb.h>
+#include <inky-spidev-lat.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+/* Upper bound on waiting for the uploader thread */
+#define WAIT_US 5000000
+
+static inky_spidev_intf intf;
+static pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static bool gate_closed;
+static bool gate_entered;
+
+/* Holds the uploader in its first transfer while the gate is closed */
+static inky_error_state fake_spi(void *intf_ptr,
+				 struct spi_ioc_transfer *xfers, uint32_t n)
+{
+	pthread_mutex_lock(&gate_lock);
+	gate_entered = true;
+	pthread_cond_broadcast(&gate_cond);
+
+	while (gate_closed) {
+		pthread_cond_wait(&gate_cond, &gate_lock);
+	}
+
+	pthread_mutex_unlock(&gate_lock);
+
+	return INKY_OK;
+}
+
+static inky_error_state fake_set(void *intf_ptr, inky_pin gpin, int value)
+{
+	return INKY_OK;
+}
+
+static inky_error_state fake_get(void *intf_ptr, inky_pin gpin, int *value)
+{
+	*value = 0;
+
+	return INKY_OK;
+}
+
+static const inky_spidev_transport fake = {
+	.name = "gated",
+	.spi_transfer = fake_spi,
+	.gpio_set = fake_set,
+	.gpio_get = fake_get
+};
+
+/* Record a frame whose total latency is total_us */
+static void record(inky_spidev_lat *lat, uint64_t id, uint64_t total_us,
+		   int8_t rst)
+{
+	const uint64_t base = 1000000;
+	inky_spidev_stamp stamp = {
+		.id = id,
+		.content_us = base,
+		.queued_us = base
+	};
+	inky_spidev_lat_rec times = {
+		.upload_start_us = base,
+		.upload_end_us = base,
+		.glass_us = base + total_us
+	};
+
+	inky_spidev_lat_record(lat, &stamp, &times, rst);
+}
+
+static uint64_t presented(inky_spidev_lat *lat)
+{
+	uint64_t n;
+
+	pthread_mutex_lock(&lat->lock);
+	n = lat->presented;
+	pthread_mutex_unlock(&lat->lock);
+
+	return n;
+}
+
+static void test_stage_us(void)
+{
+	inky_spidev_lat_rec rec = {
+		.content_us = 100,
+		.queued_us = 150,
+		.converted_us = 400,
+		.upload_start_us = 1000,
+		.upload_end_us = 3000,
+		.glass_us = 10000
+	};
+
+	CHECK_EQ(inky_spidev_lat_stage_us(&rec, INKY_SPIDEV_LAT_QUEUE), 50);
+	CHECK_EQ(inky_spidev_lat_stage_us(&rec, INKY_SPIDEV_LAT_CONVERT), 250);
+	CHECK_EQ(inky_spidev_lat_stage_us(&rec, INKY_SPIDEV_LAT_WAIT), 600);
+	CHECK_EQ(inky_spidev_lat_stage_us(&rec, INKY_SPIDEV_LAT_UPLOAD), 2000);
+	CHECK_EQ(inky_spidev_lat_stage_us(&rec, INKY_SPIDEV_LAT_REFRESH),
+		 7000);
+	CHECK_EQ(inky_spidev_lat_stage_us(&rec, INKY_SPIDEV_LAT_TOTAL), 9900);
+
+	/* Unconverted frames wait from their handover */
+	rec.converted_us = 0;
+	CHECK_EQ(inky_spidev_lat_stage_us(&rec, INKY_SPIDEV_LAT_CONVERT), 0);
+	CHECK_EQ(inky_spidev_lat_stage_us(&rec, INKY_SPIDEV_LAT_WAIT), 850);
+
+	/* Out of order stamps clamp to 0 rather than wrapping */
+	rec.queued_us = 50;
+	CHECK_EQ(inky_spidev_lat_stage_us(&rec, INKY_SPIDEV_LAT_QUEUE), 0);
+	CHECK_EQ(inky_spidev_lat_stage_us(&rec, INKY_SPIDEV_LAT_STAGES), 0);
+}
+
+static void test_percentiles(void)
+{
+	inky_spidev_lat lat;
+	inky_spidev_lat_stats st;
+	uint64_t us;
+
+	CHECK_EQ(inky_spidev_lat_init(&lat), INKY_OK);
+
+	CHECK_EQ(inky_spidev_lat_percentile(&lat, INKY_SPIDEV_LAT_TOTAL,
+					    50.0, &us),
+		 INKY_E_NOT_CONFIGURED);
+	CHECK_EQ(inky_spidev_lat_summary(&lat, INKY_SPIDEV_LAT_TOTAL, &st),
+		 INKY_E_NOT_CONFIGURED);
+
+	/* Recorded out of order, with a failed frame that isn't counted */
+	for (uint64_t i = 10; i >= 1; --i) {
+		record(&lat, i, i * 10, INKY_OK);
+	}
+
+	record(&lat, 99, 5, INKY_E_TIMEOUT);
+
+	/* Nearest rank: ceil(pct / 100 * n), always a measured value */
+	const struct {
+		double pct;
+		uint64_t us;
+	} ranks[] = {
+		{0.0, 10}, {10.0, 10}, {15.0, 20}, {50.0, 50},
+		{90.0, 90}, {91.0, 100}, {100.0, 100}
+	};
+
+	for (size_t i = 0; i < sizeof(ranks) / sizeof(ranks[0]); ++i) {
+		CHECK_EQ(inky_spidev_lat_percentile(&lat,
+						    INKY_SPIDEV_LAT_TOTAL,
+						    ranks[i].pct, &us),
+			 INKY_OK);
+		CHECK_EQ(us, ranks[i].us);
+	}
+
+	CHECK_EQ(inky_spidev_lat_percentile(&lat, INKY_SPIDEV_LAT_TOTAL,
+					    100.5, &us),
+		 INKY_E_OUT_OF_RANGE);
+	CHECK_EQ(inky_spidev_lat_percentile(&lat, INKY_SPIDEV_LAT_STAGES,
+					    50.0, &us),
+		 INKY_E_OUT_OF_RANGE);
+
+	CHECK_EQ(inky_spidev_lat_summary(&lat, INKY_SPIDEV_LAT_TOTAL, &st),
+		 INKY_OK);
+	CHECK_EQ(st.frames, 10);
+	CHECK_EQ(st.min_us, 10);
+	CHECK_EQ(st.p50_us, 50);
+	CHECK_EQ(st.p90_us, 90);
+	CHECK_EQ(st.p99_us, 100);
+	CHECK_EQ(st.max_us, 100);
+	CHECK_EQ(st.mean_us, 55);
+	CHECK_EQ(lat.presented, 11);
+
+	inky_spidev_lat_deinit(&lat);
+}
+
+static void test_ring_wraparound(void)
+{
+	const uint64_t total = INKY_SPIDEV_LAT_LEN + 44;
+	const uint64_t oldest = total - INKY_SPIDEV_LAT_LEN;
+	inky_spidev_lat lat;
+	inky_spidev_lat_stats st;
+	inky_spidev_lat_rec rec;
+
+	CHECK_EQ(inky_spidev_lat_init(&lat), INKY_OK);
+
+	for (uint64_t i = 0; i < total; ++i) {
+		record(&lat, i, i, INKY_OK);
+	}
+
+	/* Only the last INKY_SPIDEV_LAT_LEN frames are remembered */
+	CHECK_EQ(inky_spidev_lat_find(&lat, oldest - 1, &rec),
+		 INKY_E_OUT_OF_RANGE);
+	CHECK_EQ(inky_spidev_lat_find(&lat, oldest, &rec), INKY_OK);
+	CHECK_EQ(rec.id, oldest);
+	CHECK_EQ(inky_spidev_lat_find(&lat, total - 1, &rec), INKY_OK);
+	CHECK_EQ(inky_spidev_lat_stage_us(&rec, INKY_SPIDEV_LAT_TOTAL),
+		 total - 1);
+
+	CHECK_EQ(inky_spidev_lat_summary(&lat, INKY_SPIDEV_LAT_TOTAL, &st),
+		 INKY_OK);
+	CHECK_EQ(st.frames, INKY_SPIDEV_LAT_LEN);
+	CHECK_EQ(st.min_us, oldest);
+	CHECK_EQ(st.max_us, total - 1);
+
+	/* A reused ID finds its newest frame, across the wrap */
+	record(&lat, oldest, 7, INKY_OK);
+	CHECK_EQ(inky_spidev_lat_find(&lat, oldest, &rec), INKY_OK);
+	CHECK_EQ(inky_spidev_lat_stage_us(&rec, INKY_SPIDEV_LAT_TOTAL), 7);
+
+	inky_spidev_lat_deinit(&lat);
+}
+
+static void test_tbuf_drops(void)
+{
+	inky_spidev_lat lat;
+	inky_spidev_lat_rec rec;
+	inky_spidev_tbuf tbuf;
+	uint64_t t0;
+
+	test_intf_init(&intf, "/dev/null");
+	inky_spidev_set_transport(&intf, &fake);
+	CHECK_EQ(inky_spidev_lat_init(&lat), INKY_OK);
+	CHECK_EQ(inky_spidev_lat_attach(&intf, &lat), INKY_OK);
+	CHECK_EQ(inky_spidev_tbuf_init(&tbuf, &intf, 400, 300), INKY_OK);
+
+	gate_closed = true;
+	gate_entered = false;
+
+	inky_spidev_fb_stamp(inky_spidev_tbuf_back(&tbuf), 1, 0);
+	inky_spidev_tbuf_submit(&tbuf);
+
+	/* Frame 1 is being uploaded */
+	pthread_mutex_lock(&gate_lock);
+	t0 = test_now_us();
+
+	while (!gate_entered && test_now_us() - t0 < WAIT_US) {
+		pthread_mutex_unlock(&gate_lock);
+		usleep(1000);
+		pthread_mutex_lock(&gate_lock);
+	}
+
+	CHECK(gate_entered);
+	pthread_mutex_unlock(&gate_lock);
+
+	/* Frame 2 waits for the uploader, frame 3 replaces it */
+	inky_spidev_fb_stamp(inky_spidev_tbuf_back(&tbuf), 2, 0);
+	inky_spidev_tbuf_submit(&tbuf);
+	CHECK_EQ(lat.dropped, 0);
+
+	inky_spidev_fb_stamp(inky_spidev_tbuf_back(&tbuf), 3, 0);
+	inky_spidev_tbuf_submit(&tbuf);
+	CHECK_EQ(lat.dropped, 1);
+
+	pthread_mutex_lock(&gate_lock);
+	gate_closed = false;
+	pthread_cond_broadcast(&gate_cond);
+	pthread_mutex_unlock(&gate_lock);
+
+	t0 = test_now_us();
+
+	while (presented(&lat) < 2 && test_now_us() - t0 < WAIT_US) {
+		usleep(1000);
+	}
+
+	CHECK_EQ(inky_spidev_tbuf_deinit(&tbuf), INKY_OK);
+	CHECK_EQ(lat.presented, 2);
+	CHECK_EQ(lat.dropped, 1);
+
+	CHECK_EQ(inky_spidev_lat_find(&lat, 1, &rec), INKY_OK);
+	CHECK_EQ(inky_spidev_lat_find(&lat, 2, &rec), INKY_E_OUT_OF_RANGE);
+	CHECK_EQ(inky_spidev_lat_find(&lat, 3, &rec), INKY_OK);
+	CHECK(rec.content_us <= rec.queued_us);
+	CHECK(rec.queued_us <= rec.upload_start_us);
+	CHECK(rec.upload_end_us <= rec.glass_us);
+
+	inky_spidev_lat_attach(&intf, NULL);
+	inky_spidev_lat_deinit(&lat);
+}
+
+int main(void)
+{
+	RUN(test_stage_us);
+	RUN(test_percentiles);
+	RUN(test_ring_wraparound);
+	RUN(test_tbuf_drops);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,259 @@
+/*
+ * BUSY polling timeout accuracy, using a scripted GPIO transport.
+ */
+
+#include "inky-test.h"
+
+#include <inky-spidev-seq.h>
+
+/* Allowed scheduling overshoot on top of one poll interval */
+#define SLACK_US 20000
+#define POLL_US INKY_SPIDEV_BUSY_MAX_US
+#define MIN_US INKY_SPIDEV_BUSY_MIN_US
+
+/* Reads spent backing off from MIN_US to POLL_US */
+#define BACKOFF_READS 8
+
+static inky_spidev_intf intf;
+static uint64_t busy_until; /* BUSY reads high before this time */
+static unsigned int reads;
+static int fail_reads;
+
+static inky_error_state fake_spi(void *intf_ptr,
+				 struct spi_ioc_transfer *xfers, uint32_t n)
+{
+	return INKY_OK;
+}
+
+static inky_error_state fake_set(void *intf_ptr, inky_pin gpin, int value)
+{
+	return INKY_OK;
+}
+
+static inky_error_state fake_get(void *intf_ptr, inky_pin gpin, int *value)
+{
+	++reads;
+
+	if (fail_reads) {
+		return INKY_E_FAILURE;
+	}
+
+	*value = gpin == INKY_PIN_BUSY && test_now_us() < busy_until;
+
+	return INKY_OK;
+}
+
+static const inky_spidev_transport fake = {
+	.name = "scripted",
+	.spi_transfer = fake_spi,
+	.gpio_set = fake_set,
+	.gpio_get = fake_get
+};
+
+static void setup(uint64_t busy_us)
+{
+	test_intf_init(&intf, "/dev/null");
+	inky_spidev_set_transport(&intf, &fake);
+	busy_until = test_now_us() + busy_us;
+	reads = 0;
+	fail_reads = 0;
+}
+
+static void test_idle_returns_fast(void)
+{
+	uint64_t t0;
+	uint64_t dt;
+
+	setup(0);
+	t0 = test_now_us();
+
+	CHECK_EQ(inky_spidev_gpio_poll_pin(INKY_PIN_BUSY, 1000000, &intf),
+		 INKY_OK);
+
+	dt = test_now_us() - t0;
+	CHECK(dt < SLACK_US);
+	CHECK_EQ(reads, 1);
+}
+
+static void test_timeout_accuracy(void)
+{
+	const uint64_t timeout = 50000;
+	uint64_t t0;
+	uint64_t dt;
+
+	setup(10000000);
+	t0 = test_now_us();
+
+	CHECK_EQ(inky_spidev_gpio_poll_pin(INKY_PIN_BUSY, timeout, &intf),
+		 INKY_E_TIMEOUT);
+
+	dt = test_now_us() - t0;
+	CHECK(dt >= timeout);
+	CHECK(dt < timeout + POLL_US + SLACK_US);
+
+	/* No busy spinning: a short backoff, then one read per interval */
+	CHECK(reads <= BACKOFF_READS + timeout / POLL_US + 2);
+}
+
+static void test_fixed_interval(void)
+{
+	const uint64_t timeout = 50000;
+
+	setup(10000000);
+	CHECK_EQ(inky_spidev_busy_config(&intf, INKY_SPIDEV_BUSY_FIXED, 0,
+					 POLL_US), INKY_OK);
+
+	CHECK_EQ(inky_spidev_gpio_poll_pin(INKY_PIN_BUSY, timeout, &intf),
+		 INKY_E_TIMEOUT);
+	CHECK(reads <= timeout / POLL_US + 2);
+
+	CHECK_EQ(inky_spidev_busy_config(&intf, INKY_SPIDEV_BUSY_ADAPTIVE,
+					 0, POLL_US), INKY_E_OUT_OF_RANGE);
+	CHECK_EQ(inky_spidev_busy_config(&intf, INKY_SPIDEV_BUSY_ADAPTIVE,
+					 POLL_US, MIN_US), INKY_E_OUT_OF_RANGE);
+}
+
+static void test_short_wait_fast(void)
+{
+	const uint64_t busy = 1000;
+	uint64_t t0;
+	uint64_t dt;
+
+	/* A post-reset settle shouldn't wait for a whole interval */
+	setup(busy);
+	t0 = test_now_us();
+
+	CHECK_EQ(inky_spidev_gpio_poll_pin(INKY_PIN_BUSY, 1000000, &intf),
+		 INKY_OK);
+
+	dt = test_now_us() - t0;
+	CHECK(dt >= busy);
+	CHECK(dt < busy + busy + SLACK_US / 4);
+}
+
+static void test_learned_wait(void)
+{
+	const uint64_t busy = 80000;
+	unsigned int first;
+
+	setup(busy);
+	CHECK_EQ(inky_spidev_gpio_poll_pin(INKY_PIN_BUSY, 1000000, &intf),
+		 INKY_OK);
+	first = reads;
+	CHECK(inky_spidev_busy_expected(&intf, 0) >= busy);
+
+	/* The same operation again sleeps through most of it and then
+	 * polls finely around the expected end */
+	reads = 0;
+	busy_until = test_now_us() + busy;
+	CHECK_EQ(inky_spidev_gpio_poll_pin(INKY_PIN_BUSY, 1000000, &intf),
+		 INKY_OK);
+	CHECK(reads < first);
+	CHECK(test_now_us() < busy_until + busy / 8 + SLACK_US);
+
+	CHECK_EQ(inky_spidev_busy_expected(&intf, 0x20), 0);
+}
+
+static void send_cmd(uint8_t cmd, const uint8_t *data, uint32_t len)
+{
+	CHECK_EQ(inky_spidev_gpio_output_state(INKY_PIN_DC, INKY_PINSTATE_LOW,
+					       &intf), INKY_OK);
+	CHECK_EQ(inky_spidev_spi_write(&cmd, 1, &intf), INKY_OK);
+	CHECK_EQ(inky_spidev_gpio_output_state(INKY_PIN_DC, INKY_PINSTATE_HIGH,
+					       &intf), INKY_OK);
+
+	if (len > 0) {
+		CHECK_EQ(inky_spidev_spi_write(data, len, &intf), INKY_OK);
+	}
+}
+
+static void test_keyed_by_argument(void)
+{
+	const uint64_t busy = 80000;
+	const uint8_t full = 0xf7;
+	const uint8_t load_temp = 0xb1;
+
+	/* A long refresh must not teach a short temperature load to
+	 * sleep, though both end in 0x20 */
+	setup(busy);
+	send_cmd(0x22, &full, 1);
+	send_cmd(0x20, NULL, 0);
+	CHECK_EQ(inky_spidev_gpio_poll_pin(INKY_PIN_BUSY, 1000000, &intf),
+		 INKY_OK);
+	CHECK(inky_spidev_busy_expected(&intf, 0x20f7) >= busy);
+
+	send_cmd(0x22, &load_temp, 1);
+	send_cmd(0x20, NULL, 0);
+	CHECK_EQ(inky_spidev_busy_expected(&intf, 0x20b1), 0);
+
+	busy_until = test_now_us() + busy / 16;
+	CHECK_EQ(inky_spidev_gpio_poll_pin(INKY_PIN_BUSY, 1000000, &intf),
+		 INKY_OK);
+	CHECK(test_now_us() < busy_until + busy / 4);
+	CHECK(inky_spidev_busy_expected(&intf, 0x20b1) < busy / 2);
+}
+
+static void test_replay_hint(void)
+{
+	const uint64_t busy = 80000;
+	inky_spidev_seq seq = {0};
+	unsigned int first;
+
+	setup(busy);
+	CHECK_EQ(inky_spidev_seq_record_begin(&intf, &seq), INKY_OK);
+	send_cmd(0x12, NULL, 0);
+	CHECK_EQ(inky_spidev_gpio_poll_pin(INKY_PIN_BUSY, 1000000, &intf),
+		 INKY_OK);
+	CHECK_EQ(inky_spidev_seq_record_end(&intf), INKY_OK);
+	first = reads;
+
+	/* A new process has no history, only the wait in the sequence */
+	setup(busy);
+	CHECK_EQ(inky_spidev_seq_replay(&intf, &seq), INKY_OK);
+	CHECK(reads < first);
+	CHECK(inky_spidev_busy_expected(&intf, 0x1200) >= busy);
+
+	inky_spidev_seq_free(&seq);
+}
+
+static void test_release_latency(void)
+{
+	const uint64_t busy = 30000;
+	uint64_t t0;
+	uint64_t dt;
+
+	setup(busy);
+	t0 = test_now_us();
+
+	CHECK_EQ(inky_spidev_gpio_poll_pin(INKY_PIN_BUSY, 1000000, &intf),
+		 INKY_OK);
+
+	dt = test_now_us() - t0;
+	CHECK(dt >= busy);
+	CHECK(dt < busy + POLL_US + SLACK_US);
+}
+
+static void test_read_failure(void)
+{
+	setup(10000000);
+	fail_reads = 1;
+
+	CHECK_EQ(inky_spidev_gpio_poll_pin(INKY_PIN_BUSY, 1000000, &intf),
+		 INKY_E_FAILURE);
+	CHECK_EQ(reads, 1);
+}
+
+int main(void)
+{
+	RUN(test_idle_returns_fast);
+	RUN(test_timeout_accuracy);
+	RUN(test_release_latency);
+	RUN(test_fixed_interval);
+	RUN(test_short_wait_fast);
+	RUN(test_learned_wait);
+	RUN(test_keyed_by_argument);
+	RUN(test_replay_hint);
+	RUN(test_read_failure);
+
+	return TEST_RESULT();
+}
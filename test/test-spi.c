@@ -0,0 +1,247 @@
+/*
+ * SPI callback conformance, run under the ioctl shim.
+ */
+
+#include "inky-test.h"
+#include "ioctl-shim.h"
+
+#include <unistd.h>
+
+static inky_spidev_intf intf;
+static uint8_t payload[20000];
+static uint16_t words[2000];
+
+static void setup(const char *bufsiz)
+{
+	if (intf.fd > 0) {
+		close(intf.fd);
+	}
+
+	setenv("INKY_SHIM_BUFSIZ", bufsiz, 1);
+	test_intf_init(&intf, getenv("INKY_SHIM_DEV"));
+	inky_shim_reset();
+	CHECK_EQ(inky_spidev_spi_setup(&intf), INKY_OK);
+}
+
+static void test_setup_syscalls(void)
+{
+	const inky_shim_stats *st = inky_shim_stats_get();
+
+	setup("1000");
+
+	CHECK_EQ(st->opens, 1);
+	CHECK_EQ(st->ioctls, 3);
+	CHECK_EQ(st->mode, SPI_MODE_0);
+	CHECK_EQ(st->bits, 8);
+	CHECK_EQ(st->speed, INKY_SPI_SPEED_HZ_MAX);
+	CHECK_EQ(intf.bufsiz, 1000);
+}
+
+static void test_bufsiz_fallback(void)
+{
+	setup("none");
+	CHECK_EQ(intf.bufsiz, INKY_SPIDEV_BUFSIZ_DEFAULT);
+
+	setup("0");
+	CHECK_EQ(intf.bufsiz, INKY_SPIDEV_BUFSIZ_DEFAULT);
+}
+
+static void test_chunking(void)
+{
+	const inky_shim_stats *st = inky_shim_stats_get();
+	const uint32_t lens[] = {1000, 1000, 1000, 500};
+
+	setup("1000");
+	inky_shim_reset();
+
+	CHECK_EQ(inky_spidev_spi_write(payload, 3500, &intf), INKY_OK);
+
+	/* One message per bufsiz chunk, in order, covering the buffer */
+	CHECK_EQ(st->messages, 4);
+	CHECK_EQ(st->ioctls, 4);
+	CHECK_EQ(st->nxfers, 4);
+	CHECK_EQ(st->bytes, 3500);
+	CHECK_EQ(st->hash, inky_shim_hash(INKY_SHIM_HASH_INIT, payload,
+					  3500));
+
+	for (uint32_t i = 0; i < st->nxfers && i < 4; ++i) {
+		CHECK_EQ(st->xfers[i].msg, i);
+		CHECK_EQ(st->xfers[i].len, lens[i]);
+		CHECK_EQ(st->xfers[i].bits_per_word, 8);
+		CHECK_EQ(st->xfers[i].tx_buf,
+			 (uintptr_t) (payload + 1000 * i));
+	}
+}
+
+static void test_chunk_boundaries(void)
+{
+	const inky_shim_stats *st = inky_shim_stats_get();
+
+	setup("1000");
+
+	inky_shim_reset();
+	CHECK_EQ(inky_spidev_spi_write(payload, 2000, &intf), INKY_OK);
+	CHECK_EQ(st->messages, 2);
+
+	inky_shim_reset();
+	CHECK_EQ(inky_spidev_spi_write(payload, 1, &intf), INKY_OK);
+	CHECK_EQ(st->messages, 1);
+
+	inky_shim_reset();
+	CHECK_EQ(inky_spidev_spi_write(payload, 0, &intf), INKY_OK);
+	CHECK_EQ(st->ioctls, 0);
+
+	/* A full panel plane at the kernel's default bufsiz */
+	setup("4096");
+	inky_shim_reset();
+	CHECK_EQ(inky_spidev_spi_write(payload, 15000, &intf), INKY_OK);
+	CHECK_EQ(st->messages, 4);
+	CHECK_EQ(st->xfers[3].len, 15000 - 3 * 4096);
+}
+
+static void test_failure_stops(void)
+{
+	const inky_shim_stats *st = inky_shim_stats_get();
+
+	setup("1000");
+	inky_shim_reset();
+	inky_shim_fail_after(1);
+
+	CHECK(inky_spidev_spi_write(payload, 3000, &intf) != INKY_OK);
+
+	/* The failed chunk is the last ioctl issued */
+	CHECK_EQ(st->messages, 1);
+	CHECK_EQ(st->ioctls, 2);
+}
+
+static void test_write16(void)
+{
+	const inky_shim_stats *st = inky_shim_stats_get();
+	const uint32_t lens[] = {1000, 1000, 400};
+
+	setup("1000");
+	inky_shim_reset();
+
+	/* len counts words, chunks are bufsiz bytes */
+	CHECK_EQ(inky_spidev_spi_write16(words, 1200, &intf), INKY_OK);
+
+	CHECK_EQ(st->messages, 3);
+	CHECK_EQ(st->bytes, 2400);
+	CHECK_EQ(st->hash, inky_shim_hash(INKY_SHIM_HASH_INIT,
+					  (const uint8_t*) words, 2400));
+
+	for (uint32_t i = 0; i < st->nxfers && i < 3; ++i) {
+		CHECK_EQ(st->xfers[i].len, lens[i]);
+		CHECK_EQ(st->xfers[i].bits_per_word, 16);
+		CHECK_EQ(st->xfers[i].delay_usecs, 0);
+	}
+}
+
+static void test_write16_fallback(void)
+{
+	const inky_shim_stats *st = inky_shim_stats_get();
+	uint8_t be[2400];
+
+	for (uint32_t i = 0; i < 1200; ++i) {
+		be[2 * i] = words[i] >> 8;
+		be[2 * i + 1] = words[i] & 0xff;
+	}
+
+	setup("1000");
+	inky_shim_reset();
+	inky_shim_max_bits(8);
+
+	CHECK_EQ(inky_spidev_spi_write16(words, 1200, &intf), INKY_OK);
+
+	/* One rejected message, then byte pairs, high byte first */
+	CHECK_EQ(st->ioctls, 4);
+	CHECK_EQ(st->messages, 3);
+	CHECK_EQ(st->bytes, 2400);
+	CHECK_EQ(st->hash, inky_shim_hash(INKY_SHIM_HASH_INIT, be, 2400));
+
+	for (uint32_t i = 0; i < st->nxfers && i < 3; ++i) {
+		CHECK_EQ(st->xfers[i].bits_per_word, 8);
+	}
+
+	/* Later writes don't try 16 bit words again */
+	inky_shim_reset();
+	inky_shim_max_bits(8);
+
+	CHECK_EQ(inky_spidev_spi_write16(words, 10, &intf), INKY_OK);
+	CHECK_EQ(st->ioctls, 1);
+}
+
+static void test_write16_error(void)
+{
+	const inky_shim_stats *st = inky_shim_stats_get();
+
+	setup("1000");
+	inky_shim_reset();
+	inky_shim_fail_after(0);
+
+	/* An I/O error isn't taken for missing 16 bit support */
+	CHECK(inky_spidev_spi_write16(words, 1200, &intf) != INKY_OK);
+	CHECK_EQ(st->ioctls, 1);
+	CHECK(!intf.wire.swap16);
+}
+
+static void test_wire3_fallback(void)
+{
+	const inky_shim_stats *st = inky_shim_stats_get();
+
+	setup("1000");
+	CHECK_EQ(inky_spidev_wire_config(&intf, INKY_SPIDEV_WIRE_3), INKY_OK);
+	inky_shim_reset();
+	inky_shim_max_bits(8);
+
+	/* One rejected message, then packed bytes */
+	CHECK_EQ(inky_spidev_spi_write(payload, 16, &intf), INKY_OK);
+	CHECK_EQ(st->ioctls, 2);
+	CHECK_EQ(st->bytes, 18);
+	CHECK_EQ(intf.wire.mode, INKY_SPIDEV_WIRE_3_PACKED);
+}
+
+static void test_wire3_error(void)
+{
+	setup("1000");
+	CHECK_EQ(inky_spidev_wire_config(&intf, INKY_SPIDEV_WIRE_3), INKY_OK);
+	inky_shim_reset();
+	inky_shim_fail_after(0);
+
+	/* An I/O error isn't taken for missing 9 bit support */
+	CHECK(inky_spidev_spi_write(payload, 16, &intf) != INKY_OK);
+	CHECK_EQ(intf.wire.mode, INKY_SPIDEV_WIRE_3);
+}
+
+int main(void)
+{
+	if (!getenv("INKY_SHIM_DEV")) {
+		fprintf(stderr, "not running under the ioctl shim\n");
+		return INKY_TEST_SKIP;
+	}
+
+	for (size_t i = 0; i < sizeof(payload); ++i) {
+		payload[i] = i * 7 + 3;
+	}
+
+	for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); ++i) {
+		words[i] = i * 0x0101 + 0x1234;
+	}
+
+	RUN(test_setup_syscalls);
+	RUN(test_bufsiz_fallback);
+	RUN(test_chunking);
+	RUN(test_chunk_boundaries);
+	RUN(test_failure_stops);
+	RUN(test_write16);
+	RUN(test_write16_error);
+	RUN(test_write16_fallback);
+	RUN(test_wire3_fallback);
+	RUN(test_wire3_error);
+
+	if (intf.fd > 0) {
+		close(intf.fd);
+	}
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,918 @@
+/**
+ * @file inky-convert.c
+ *
+ * Batch converter from a directory tree of PGM and PPM images to
+ * packed frame files for one panel type, spread over all cores
+ */
+
+#ifdef INKY_SPIDEV_AS_SUBMODULE
+#include "inky-spidev-cache.h"
+#include "inky-spidev-frame.h"
+#include "inky-spidev-pack.h"
+#else
+#include <inkyuserspace/inky-spidev-cache.h>
+#include <inkyuserspace/inky-spidev-frame.h>
+#include <inkyuserspace/inky-spidev-pack.h>
+#endif /* #ifdef INKY_SPIDEV_AS_SUBMODULE */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define APP_ARG_BUFFER 256
+
+#define APP_MAX_THREADS 256
+
+#define FRAME_EXT ".inkf"
+
+/* Records the options the outputs were made with */
+#define STAMP_NAME ".inky-convert"
+
+/* Application flags */
+#define APP_FLAG_FORCE 0x0001 /* Convert even unchanged inputs */
+#define APP_FLAG_RLE 0x0002 /* Run length encode the planes */
+#define APP_FLAG_VERBOSE 0x0004 /* Print every file */
+
+/* For getopts */
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+/* Application definitions */
+
+typedef struct {
+	char indir[APP_ARG_BUFFER]; /* Tree of source images */
+	char outdir[APP_ARG_BUFFER]; /* Tree of frame files */
+
+	inky_product panel; /* Panel type */
+	uint16_t width; /* Panel width */
+	uint16_t height; /* Panel height */
+	inky_spidev_frame_color color; /* Panel third color */
+	inky_spidev_pack_cfg cfg; /* Conversion parameters */
+
+	unsigned int threads; /* Worker count, 0 for one per core */
+
+	uint16_t flags; /* Additional app control flags */
+} app_options;
+
+typedef struct {
+	char *in; /* Source image path */
+	char *out; /* Frame file path */
+} job;
+
+typedef struct {
+	job *jobs;
+	size_t len;
+	size_t cap;
+} job_list;
+
+typedef struct {
+	uint64_t converted;
+	uint64_t skipped;
+	uint64_t failed;
+	uint64_t bytes; /* Source bytes read */
+	uint64_t steals;
+} job_stats;
+
+struct pool;
+
+/* Each worker owns a contiguous range of the job list. It takes jobs
+ * from the front of its own range and, once that runs dry, steals the
+ * back half of another worker's range */
+typedef struct {
+	struct pool *pool;
+	unsigned int id;
+	pthread_t thread;
+	bool started; /* thread runs and needs joining */
+	pthread_mutex_t lock;
+	size_t head;
+	size_t tail;
+	job_stats stats;
+} worker;
+
+typedef struct pool {
+	const app_options *opts;
+	const job_list *list;
+	bool stamp_ok; /* Outputs were made with the same options */
+	unsigned int count;
+	worker workers[APP_MAX_THREADS];
+} pool;
+
+bool check_numeric(const char *str);
+
+int parse_options(int argc, char *const argv[], app_options *opts);
+
+void print_usage(void);
+
+int collect(job_list *list, const char *indir, const char *outdir,
+	    const char *rel);
+
+bool path_join(char *buf, size_t len, const char *dir, const char *name);
+
+int job_cmp(const void *a, const void *b);
+
+bool has_image_ext(const char *name);
+
+void stamp_format(const app_options *opts, char *buf, size_t len);
+
+bool stamp_check(const app_options *opts);
+
+void stamp_write(const app_options *opts);
+
+void pool_run(pool *p);
+
+void *worker_main(void *arg);
+
+bool take_job(worker *w, size_t *idx);
+
+void convert(worker *w, const job *j);
+
+uint8_t *read_pnm(const char *path, uint16_t *width, uint16_t *height,
+		  inky_spidev_pixfmt *format, size_t *file_len);
+
+int make_parents(const char *path);
+
+double now_s(void);
+
+/* Application Implementation */
+
+bool check_numeric(const char *str)
+{
+	if (str == NULL || str[0] == '\0') {
+		return false;
+	}
+
+	for (size_t i = 0; str[i] != '\0'; i++) {
+		if (!isdigit((unsigned char) str[i])) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int parse_options(int argc, char *const argv[], app_options *opts)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "i:o:p:c:r:t:j:mzfvh")) != -1) {
+		switch (opt) {
+		case 'i':
+			strncpy(opts->indir, optarg, APP_ARG_BUFFER - 1);
+
+			break;
+
+		case 'o':
+			strncpy(opts->outdir, optarg, APP_ARG_BUFFER - 1);
+
+			break;
+
+		case 'p':
+			if (strcmp(optarg, "what") == 0) {
+				opts->panel = INKY_WHAT;
+				opts->width = 400;
+				opts->height = 300;
+			} else if (strcmp(optarg, "phat") == 0) {
+				opts->panel = INKY_PHAT;
+				opts->width = 212;
+				opts->height = 104;
+			} else {
+				print_usage();
+				exit(EXIT_FAILURE);
+			}
+
+			break;
+
+		case 'c':
+			if (strcmp(optarg, "red") == 0) {
+				opts->color = INKY_SPIDEV_FRAME_RED;
+			} else if (strcmp(optarg, "yellow") == 0) {
+				opts->color = INKY_SPIDEV_FRAME_YELLOW;
+			} else if (strcmp(optarg, "bw") == 0) {
+				opts->color = INKY_SPIDEV_FRAME_BW;
+			} else {
+				print_usage();
+				exit(EXIT_FAILURE);
+			}
+
+			opts->cfg.color = opts->color != INKY_SPIDEV_FRAME_BW;
+
+			break;
+
+		case 'r':
+			if (!check_numeric(optarg) || atoi(optarg) % 90 != 0
+			    || atoi(optarg) >= 360) {
+				print_usage();
+				exit(EXIT_FAILURE);
+			}
+
+			opts->cfg.rotation = (inky_spidev_rotation)
+				(atoi(optarg) / 90);
+
+			break;
+
+		case 't':
+			if (!check_numeric(optarg) || atoi(optarg) > 255) {
+				print_usage();
+				exit(EXIT_FAILURE);
+			}
+
+			opts->cfg.threshold = atoi(optarg);
+
+			break;
+
+		case 'j':
+			if (!check_numeric(optarg)
+			    || atoi(optarg) > APP_MAX_THREADS) {
+				print_usage();
+				exit(EXIT_FAILURE);
+			}
+
+			opts->threads = atoi(optarg);
+
+			break;
+
+		case 'm':
+			opts->cfg.mirror = true;
+
+			break;
+
+		case 'z':
+			opts->flags |= APP_FLAG_RLE;
+
+			break;
+
+		case 'f':
+			opts->flags |= APP_FLAG_FORCE;
+
+			break;
+
+		case 'v':
+			opts->flags |= APP_FLAG_VERBOSE;
+
+			break;
+
+		case 'h':
+			print_usage();
+			exit(EXIT_SUCCESS);
+
+		default:
+			print_usage();
+			exit(EXIT_FAILURE);
+
+			break;
+		}
+	}
+
+	if (!opts->indir[0] || !opts->outdir[0]) {
+		print_usage();
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}
+
+void print_usage(void) {
+	fprintf(stderr,
+		"Usage:\n"
+		"inky-convert -i <dir> -o <dir> [-p what|phat] [-c bw|red|yellow]\n"
+		"             [-r <deg>] [-t <level>] [-j <threads>] [-mzfv]\n"
+		"inky-convert -h\n"
+		"\n"
+		"Converts every .pgm and .ppm image under the input directory\n"
+		"to a " FRAME_EXT " frame file at the same place under the output\n"
+		"directory. Images must match the panel once rotated.\n"
+		"\n"
+		"Options:\n"
+		"-i <dir>	Directory tree of source images\n"
+		"-o <dir>	Directory tree for frame files\n"
+		"-p <panel>	Panel type, default what\n"
+		"-c <color>	Panel third color, default red\n"
+		"-r <deg>	Clockwise rotation, 0, 90, 180 or 270\n"
+		"-t <level>	Level that counts as white, default 128\n"
+		"-j <threads>	Worker threads, default one per core\n"
+		"-m		Mirror left to right before rotating\n"
+		"-z		Run length encode the planes\n"
+		"-f		Convert even unchanged inputs\n"
+		"-v		Print every file\n"
+		"-h		Display this usage message\n");
+}
+
+int collect(job_list *list, const char *indir, const char *outdir,
+	    const char *rel)
+{
+	char path[PATH_MAX];
+	DIR *dir;
+	struct dirent *ent;
+	int n;
+
+	n = snprintf(path, sizeof(path), "%s%s%s", indir, rel[0] ? "/" : "",
+		     rel);
+
+	if (n < 0 || (size_t) n >= sizeof(path)) {
+		fprintf(stderr, "ERROR: Path too long: %s/%s\n", indir, rel);
+		return -1;
+	}
+
+	dir = opendir(path);
+
+	if (!dir) {
+		fprintf(stderr, "ERROR: Can't read %s: %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+
+	while ((ent = readdir(dir)) != NULL) {
+		char sub[PATH_MAX];
+		struct stat st;
+		job *j;
+
+		if (ent->d_name[0] == '.') {
+			continue;
+		}
+
+		if (!path_join(sub, sizeof(sub), rel, ent->d_name)
+		    || !path_join(path, sizeof(path), indir, sub)) {
+			continue;
+		}
+
+		/* Symlinked directories aren't followed, so a link back up
+		 * the tree can't recurse forever. Symlinked images are */
+		if (lstat(path, &st) < 0
+		    || (S_ISLNK(st.st_mode)
+			&& (stat(path, &st) < 0 || S_ISDIR(st.st_mode)))) {
+			continue;
+		}
+
+		if (S_ISDIR(st.st_mode)) {
+			collect(list, indir, outdir, sub);
+			continue;
+		}
+
+		if (!S_ISREG(st.st_mode) || !has_image_ext(ent->d_name)) {
+			continue;
+		}
+
+		if (list->len == list->cap) {
+			list->cap = list->cap ? list->cap * 2 : 64;
+			list->jobs = realloc(list->jobs,
+					     list->cap * sizeof(job));
+
+			if (!list->jobs) {
+				fprintf(stderr, "ERROR: Out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		j = &list->jobs[list->len];
+		j->in = strdup(path);
+
+		/* Same relative path, extension swapped */
+		n = snprintf(path, sizeof(path), "%s/%.*s" FRAME_EXT, outdir,
+			     (int) (strlen(sub) - 4), sub);
+
+		if (n < 0 || (size_t) n >= sizeof(path)) {
+			fprintf(stderr, "ERROR: Path too long: %s/%s\n",
+				outdir, sub);
+			free(j->in);
+			continue;
+		}
+
+		j->out = strdup(path);
+		++list->len;
+	}
+
+	closedir(dir);
+
+	return 0;
+}
+
+/* dir/name, or just name when dir is empty. False, with an error
+ * printed, if it doesn't fit */
+bool path_join(char *buf, size_t len, const char *dir, const char *name)
+{
+	int n = snprintf(buf, len, "%s%s%s", dir, dir[0] ? "/" : "", name);
+
+	if (n < 0 || (size_t) n >= len) {
+		fprintf(stderr, "ERROR: Path too long: %s/%s\n", dir, name);
+		return false;
+	}
+
+	return true;
+}
+
+int job_cmp(const void *a, const void *b)
+{
+	return strcmp(((const job *) a)->in, ((const job *) b)->in);
+}
+
+bool has_image_ext(const char *name)
+{
+	size_t len = strlen(name);
+
+	return len > 4 && (strcasecmp(name + len - 4, ".pgm") == 0
+			   || strcasecmp(name + len - 4, ".ppm") == 0);
+}
+
+void stamp_format(const app_options *opts, char *buf, size_t len)
+{
+	snprintf(buf, len, "%d %ux%u %d %d %d %u %d\n", (int) opts->panel,
+		 opts->width, opts->height, (int) opts->color,
+		 (int) opts->cfg.rotation, opts->cfg.mirror,
+		 opts->cfg.threshold, !!(opts->flags & APP_FLAG_RLE));
+}
+
+bool stamp_check(const app_options *opts)
+{
+	char path[PATH_MAX];
+	char want[128];
+	char have[128] = "";
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/" STAMP_NAME, opts->outdir);
+	stamp_format(opts, want, sizeof(want));
+
+	f = fopen(path, "r");
+
+	if (!f) {
+		return false;
+	}
+
+	if (!fgets(have, sizeof(have), f)) {
+		have[0] = '\0';
+	}
+
+	fclose(f);
+
+	return strcmp(want, have) == 0;
+}
+
+void stamp_write(const app_options *opts)
+{
+	char path[PATH_MAX];
+	char line[128];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/" STAMP_NAME, opts->outdir);
+	stamp_format(opts, line, sizeof(line));
+
+	f = fopen(path, "w");
+
+	if (!f) {
+		return;
+	}
+
+	fputs(line, f);
+	fclose(f);
+}
+
+void pool_run(pool *p)
+{
+	size_t per = p->list->len / p->count;
+	size_t extra = p->list->len % p->count;
+	size_t pos = 0;
+
+	/* Contiguous ranges, so a steal splits one interval */
+	for (unsigned int i = 0; i < p->count; ++i) {
+		worker *w = &p->workers[i];
+
+		w->pool = p;
+		w->id = i;
+		w->head = pos;
+		pos += per + (i < extra);
+		w->tail = pos;
+		memset(&w->stats, 0, sizeof(w->stats));
+		pthread_mutex_init(&w->lock, NULL);
+	}
+
+	/* A worker that fails to start leaves its range to be stolen */
+	for (unsigned int i = 1; i < p->count; ++i) {
+		p->workers[i].started = pthread_create(&p->workers[i].thread,
+						       NULL, worker_main,
+						       &p->workers[i]) == 0;
+	}
+
+	worker_main(&p->workers[0]);
+
+	for (unsigned int i = 1; i < p->count; ++i) {
+		if (p->workers[i].started) {
+			pthread_join(p->workers[i].thread, NULL);
+		}
+	}
+
+	for (unsigned int i = 0; i < p->count; ++i) {
+		pthread_mutex_destroy(&p->workers[i].lock);
+	}
+}
+
+void *worker_main(void *arg)
+{
+	worker *w = arg;
+	size_t idx;
+
+	while (take_job(w, &idx)) {
+		convert(w, &w->pool->list->jobs[idx]);
+	}
+
+	return NULL;
+}
+
+bool take_job(worker *w, size_t *idx)
+{
+	pool *p = w->pool;
+
+	pthread_mutex_lock(&w->lock);
+
+	if (w->head < w->tail) {
+		*idx = w->head++;
+		pthread_mutex_unlock(&w->lock);
+		return true;
+	}
+
+	pthread_mutex_unlock(&w->lock);
+
+	/* Only one lock is held at a time, so thieves can't deadlock */
+	for (unsigned int k = 1; k < p->count; ++k) {
+		worker *v = &p->workers[(w->id + k) % p->count];
+		size_t start;
+		size_t end;
+
+		pthread_mutex_lock(&v->lock);
+
+		if (v->head >= v->tail) {
+			pthread_mutex_unlock(&v->lock);
+			continue;
+		}
+
+		end = v->tail;
+		start = end - (end - v->head + 1) / 2;
+		v->tail = start;
+
+		pthread_mutex_unlock(&v->lock);
+
+		pthread_mutex_lock(&w->lock);
+		w->head = start + 1;
+		w->tail = end;
+		++w->stats.steals;
+		pthread_mutex_unlock(&w->lock);
+
+		*idx = start;
+
+		return true;
+	}
+
+	return false;
+}
+
+void convert(worker *w, const job *j)
+{
+	const app_options *opts = w->pool->opts;
+	bool force = opts->flags & APP_FLAG_FORCE;
+	struct stat in_st;
+	struct stat out_st;
+	inky_spidev_frame old;
+	inky_spidev_fb fb;
+	inky_spidev_pack_cfg cfg = opts->cfg;
+	uint16_t width;
+	uint16_t height;
+	size_t file_len;
+	uint8_t *pixels;
+	uint32_t stride;
+	inky_spidev_frame_tag key;
+	bool quarter;
+	int8_t rst;
+
+	if (stat(j->in, &in_st) < 0) {
+		++w->stats.failed;
+		return;
+	}
+
+	/* Cheap check first: an output newer than its input, made with
+	 * the same options, needs nothing reading */
+	if (!force && w->pool->stamp_ok && stat(j->out, &out_st) == 0
+	    && (out_st.st_mtim.tv_sec > in_st.st_mtim.tv_sec
+		|| (out_st.st_mtim.tv_sec == in_st.st_mtim.tv_sec
+		    && out_st.st_mtim.tv_nsec >= in_st.st_mtim.tv_nsec))) {
+		++w->stats.skipped;
+		return;
+	}
+
+	pixels = read_pnm(j->in, &width, &height, &cfg.format, &file_len);
+
+	if (!pixels) {
+		fprintf(stderr, "ERROR: %s is not a binary PGM or PPM\n",
+			j->in);
+		++w->stats.failed;
+		return;
+	}
+
+	w->stats.bytes += file_len;
+	stride = (uint32_t) width
+		* (cfg.format == INKY_SPIDEV_PIX_RGB888 ? 3 : 1);
+
+	/* Touched but unchanged inputs are caught by the source hash the
+	 * frame was tagged with */
+	inky_spidev_cache_key(pixels, width, height, stride, &cfg, &key);
+
+	/* The tag doesn't cover the encoding. An --rle frame that nothing
+	 * shrank is stored raw and just gets written again */
+	if (!force && inky_spidev_frame_open(&old, j->out, false) == INKY_OK) {
+		bool rle = old.enc[0] == INKY_SPIDEV_FRAME_RLE
+			|| old.enc[1] == INKY_SPIDEV_FRAME_RLE;
+		bool same = memcmp(&old.tag, &key, sizeof(key)) == 0
+			&& old.panel == opts->panel
+			&& old.color == opts->color
+			&& rle == !!(opts->flags & APP_FLAG_RLE);
+
+		inky_spidev_frame_release(&old);
+
+		if (same) {
+			utimensat(AT_FDCWD, j->out, NULL, 0);
+			free(pixels);
+			++w->stats.skipped;
+			return;
+		}
+	}
+
+	quarter = cfg.rotation == INKY_SPIDEV_ROTATE_90
+		|| cfg.rotation == INKY_SPIDEV_ROTATE_270;
+
+	if ((quarter ? height : width) != opts->width
+	    || (quarter ? width : height) != opts->height) {
+		fprintf(stderr, "ERROR: %s is %ux%u, the panel needs %ux%u\n",
+			j->in, quarter ? height : width,
+			quarter ? width : height, opts->width, opts->height);
+		free(pixels);
+		++w->stats.failed;
+		return;
+	}
+
+	rst = inky_spidev_fb_init(&fb, opts->width, opts->height);
+
+	if (rst == INKY_OK) {
+		rst = inky_spidev_fb_pack(&fb, pixels, width, height, stride,
+					  &cfg);
+
+		if (rst == INKY_OK && make_parents(j->out) < 0) {
+			rst = INKY_E_BAD_PERMISSIONS;
+		}
+
+		if (rst == INKY_OK) {
+			rst = inky_spidev_frame_write(j->out, &fb,
+						      (uint8_t) opts->panel,
+						      opts->color, &key,
+						      opts->flags
+						      & APP_FLAG_RLE);
+		}
+
+		inky_spidev_fb_free(&fb);
+	}
+
+	free(pixels);
+
+	if (rst != INKY_OK) {
+		fprintf(stderr, "ERROR: Converting %s failed with %d\n",
+			j->in, rst);
+		++w->stats.failed;
+		return;
+	}
+
+	if (opts->flags & APP_FLAG_VERBOSE) {
+		printf("%s -> %s\n", j->in, j->out);
+	}
+
+	++w->stats.converted;
+}
+
+uint8_t *read_pnm(const char *path, uint16_t *width, uint16_t *height,
+		  inky_spidev_pixfmt *format, size_t *file_len)
+{
+	FILE *f;
+	long len;
+	uint8_t *buf;
+	uint8_t *pixels = NULL;
+	unsigned long val[3];
+	size_t pos = 2;
+	size_t count;
+	int bpp;
+
+	f = fopen(path, "rb");
+
+	if (!f) {
+		return NULL;
+	}
+
+	if (fseek(f, 0, SEEK_END) < 0 || (len = ftell(f)) < 3
+	    || fseek(f, 0, SEEK_SET) < 0) {
+		fclose(f);
+		return NULL;
+	}
+
+	buf = malloc(len);
+
+	if (!buf || fread(buf, 1, len, f) != (size_t) len) {
+		fclose(f);
+		free(buf);
+		return NULL;
+	}
+
+	fclose(f);
+
+	*file_len = len;
+
+	if (buf[0] != 'P' || (buf[1] != '5' && buf[1] != '6')) {
+		goto out;
+	}
+
+	bpp = buf[1] == '6' ? 3 : 1;
+
+	/* Width, height and maxval, separated by whitespace and comments */
+	for (int i = 0; i < 3; ++i) {
+		while (pos < (size_t) len
+		       && (isspace(buf[pos]) || buf[pos] == '#')) {
+			if (buf[pos] == '#') {
+				while (pos < (size_t) len && buf[pos] != '\n') {
+					++pos;
+				}
+			} else {
+				++pos;
+			}
+		}
+
+		if (pos >= (size_t) len || !isdigit(buf[pos])) {
+			goto out;
+		}
+
+		val[i] = 0;
+
+		while (pos < (size_t) len && isdigit(buf[pos])
+		       && val[i] < 100000) {
+			val[i] = val[i] * 10 + (buf[pos++] - '0');
+		}
+	}
+
+	/* Exactly one whitespace byte before the raster */
+	++pos;
+
+	if (val[0] == 0 || val[0] > UINT16_MAX || val[1] == 0
+	    || val[1] > UINT16_MAX || val[2] == 0 || val[2] > 255) {
+		goto out;
+	}
+
+	count = (size_t) val[0] * val[1] * bpp;
+
+	if (pos > (size_t) len || (size_t) len - pos < count) {
+		goto out;
+	}
+
+	pixels = malloc(count);
+
+	if (!pixels) {
+		goto out;
+	}
+
+	if (val[2] == 255) {
+		memcpy(pixels, buf + pos, count);
+	} else {
+		for (size_t i = 0; i < count; ++i) {
+			unsigned long v = buf[pos + i];
+
+			pixels[i] = (uint8_t) ((v > val[2] ? val[2] : v) * 255
+					       / val[2]);
+		}
+	}
+
+	*width = val[0];
+	*height = val[1];
+	*format = bpp == 3 ? INKY_SPIDEV_PIX_RGB888 : INKY_SPIDEV_PIX_GRAY8;
+
+out:
+	free(buf);
+
+	return pixels;
+}
+
+int make_parents(const char *path)
+{
+	char dir[PATH_MAX];
+	char *slash;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+
+	for (slash = strchr(dir + 1, '/'); slash;
+	     slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+
+		/* Other workers may be creating the same directory */
+		if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+			return -1;
+		}
+
+		*slash = '/';
+	}
+
+	return 0;
+}
+
+double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *const argv[])
+{
+	app_options opts = {0};
+	static pool p;
+	job_list list = {0};
+	job_stats total = {0};
+	double start;
+	double elapsed;
+	long cores;
+
+	opts.panel = INKY_WHAT;
+	opts.width = 400;
+	opts.height = 300;
+	opts.color = INKY_SPIDEV_FRAME_RED;
+	opts.cfg = (inky_spidev_pack_cfg) INKY_SPIDEV_PACK_CFG_DEFAULT;
+	opts.cfg.color = true;
+
+	parse_options(argc, argv, &opts);
+
+	if (opts.threads == 0) {
+		cores = sysconf(_SC_NPROCESSORS_ONLN);
+		opts.threads = cores < 1 ? 1 : cores > APP_MAX_THREADS ?
+			APP_MAX_THREADS : cores;
+	}
+
+	start = now_s();
+
+	if (collect(&list, opts.indir, opts.outdir, "") < 0) {
+		return EXIT_FAILURE;
+	}
+
+	qsort(list.jobs, list.len, sizeof(job), job_cmp);
+
+	if (make_parents(opts.outdir) < 0
+	    || (mkdir(opts.outdir, 0755) < 0 && errno != EEXIST)) {
+		fprintf(stderr, "ERROR: Can't create %s: %s\n", opts.outdir,
+			strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	p.opts = &opts;
+	p.list = &list;
+	p.stamp_ok = stamp_check(&opts);
+	p.count = list.len < opts.threads ? (list.len ? list.len : 1)
+		: opts.threads;
+
+	pool_run(&p);
+
+	elapsed = now_s() - start;
+
+	for (unsigned int i = 0; i < p.count; ++i) {
+		total.converted += p.workers[i].stats.converted;
+		total.skipped += p.workers[i].stats.skipped;
+		total.failed += p.workers[i].stats.failed;
+		total.bytes += p.workers[i].stats.bytes;
+		total.steals += p.workers[i].stats.steals;
+	}
+
+	if (total.failed == 0) {
+		stamp_write(&opts);
+	}
+
+	printf("%zu images: %llu converted, %llu unchanged, %llu failed\n",
+	       list.len, (unsigned long long) total.converted,
+	       (unsigned long long) total.skipped,
+	       (unsigned long long) total.failed);
+	printf("%.3f s on %u threads, %.1f images/s, %.1f MB/s read, "
+	       "%llu steals\n", elapsed, p.count,
+	       elapsed > 0 ? total.converted / elapsed : 0.0,
+	       elapsed > 0 ? total.bytes / elapsed / 1e6 : 0.0,
+	       (unsigned long long) total.steals);
+
+	for (size_t i = 0; i < list.len; ++i) {
+		free(list.jobs[i].in);
+		free(list.jobs[i].out);
+	}
+
+	free(list.jobs);
+
+	return total.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}